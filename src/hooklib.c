@@ -14,23 +14,48 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <aio.h>
+#include <pthread.h>
 #define __USE_GNU
 #include <dlfcn.h>
 
+#ifdef IOMIDDLE_WRAP
+/*
+ * Static library linked with -Wl,--wrap (see iomiddle.wrap):
+ *	Calls to a function of the program go to __wrap_func, and
+ *	__real_func is the function itself, which is resolved by the linker.
+ */
+#define HOOK(func)	__wrap_ ## func
+#define PTR_DECL(name, ret, args)	\
+    extern ret __real_ ## name args __attribute__((weak)); \
+    ret (*_hijacked_ ## name) args = NULL;
+
+#define HIJACK(ret, func)				\
+    {							\
+	if (__atomic_load_n(&_hijack_init, __ATOMIC_ACQUIRE) == 0) { \
+	    hijack_init();				\
+	}						\
+    }
+#else
+#define HOOK(func)	func
 #define PTR_DECL(name, ret, args)	\
     ret (*__real_ ## name) args = NULL;	\
     ret (*_hijacked_ ## name) args = NULL;
     
+/*
+ * Initialization and symbol lookup may race among threads.
+ * __real_ pointers are idempotent, so they are atomically published.
+ */
 #define HIJACK(ret, func)				\
     {							\
-	if (_hijack_init == 0) {			\
-	    _hijack_init = 1;				\
-	    _myhijack_init();				\
+	if (__atomic_load_n(&_hijack_init, __ATOMIC_ACQUIRE) == 0) { \
+	    hijack_init();				\
 	}						\
-	if (__real_ ## func == NULL) {			\
-	    __real_ ## func = dlsym(RTLD_NEXT, #func);	\
+	if (__atomic_load_n(&__real_ ## func, __ATOMIC_ACQUIRE) == NULL) { \
+	    __atomic_store_n(&__real_ ## func,		\
+			     dlsym(RTLD_NEXT, #func), __ATOMIC_RELEASE); \
 	}						\
     }
+#endif /* IOMIDDLE_WRAP */
 
 #define HIJACK_DO(ret, func, args)			\
     {							\
@@ -43,8 +68,45 @@
     }
 
 static int _hijack_init = 0;
+static pthread_mutex_t _hijack_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int _hijack_initializing;
 
 extern void _myhijack_init();
+static void hijack_resolve();
+
+/*
+ * _myhijack_init is invoked once.  System calls issued inside it
+ * (e.g., printf) go through the real ones on the initializing thread,
+ * and other threads wait for completion of the initialization.
+ */
+static void
+hijack_init()
+{
+    if (_hijack_initializing) {
+	return;
+    }
+    pthread_mutex_lock(&_hijack_lock);
+    if (_hijack_init == 0) {
+	_hijack_initializing = 1;
+	hijack_resolve();
+	_myhijack_init();
+	_hijack_initializing = 0;
+	__atomic_store_n(&_hijack_init, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&_hijack_lock);
+}
+
+/*
+ * Invoked by the interface of iomiddle.h, which does not go through
+ * the hooks
+ */
+void
+_hijack_ensure()
+{
+    if (__atomic_load_n(&_hijack_init, __ATOMIC_ACQUIRE) == 0) {
+	hijack_init();
+    }
+}
 
 PTR_DECL(creat, int, (const char* path, mode_t mode));
 PTR_DECL(open, int, (const char *path, int flags, ...));
@@ -52,6 +114,20 @@ PTR_DECL(close, int, (int fd));
 PTR_DECL(write, ssize_t, (int fd, const void *buf, size_t count));
 PTR_DECL(read, ssize_t, (int fd, void *buf, size_t count));
 PTR_DECL(lseek64, off64_t, (int fd, off64_t offset, int whence));
+PTR_DECL(fsync, int, (int fd));
+PTR_DECL(fdatasync, int, (int fd));
+PTR_DECL(stat, int, (const char* path, struct stat *buf));
+PTR_DECL(stat64, int, (const char* path, struct stat64 *buf));
+PTR_DECL(lstat, int, (const char* path, struct stat *buf));
+PTR_DECL(lstat64, int, (const char* path, struct stat64 *buf));
+PTR_DECL(fstat, int, (int fd, struct stat *buf));
+PTR_DECL(fstat64, int, (int fd, struct stat64 *buf));
+PTR_DECL(__fxstat, int, (int vers, int fd, struct stat *buf));
+PTR_DECL(__fxstat64, int, (int vers, int fd, struct stat64 *buf));
+PTR_DECL(__lxstat, int, (int vers, const char* path, struct stat *buf));
+PTR_DECL(__lxstat64, int, (int vers, const char* path, struct stat64 *buf));
+PTR_DECL(__xstat, int, (int vers, const char* path, struct stat *buf));
+PTR_DECL(__xstat64, int, (int vers, const char* path, struct stat64 *buf));
 
 #if 0
 PTR_DECL(creat64, int, (const char* path, mode_t mode));
@@ -64,12 +140,6 @@ PTR_DECL(pwrite64, ssize_t, (int fd, const void *buf, size_t count, off64_t offs
 ));
 PTR_DECL(readv, ssize_t, (int fd, const struct iovec *iov, int iovcnt));
 PTR_DECL(writev, ssize_t, (int fd, const struct iovec *iov, int iovcnt));
-PTR_DECL(__fxstat, int, (int vers, int fd, struct stat *buf));
-PTR_DECL(__fxstat64, int, (int vers, int fd, struct stat64 *buf));
-PTR_DECL(__lxstat, int, (int vers, const char* path, struct stat *buf));
-PTR_DECL(__lxstat64, int, (int vers, const char* path, struct stat64 *buf));
-PTR_DECL(__xstat, int, (int vers, const char* path, struct stat *buf));
-PTR_DECL(__xstat64, int, (int vers, const char* path, struct stat64 *buf));
 PTR_DECL(mmap, void*, (void *addr, size_t length, int prot, int flags, int fd, off_t offset));
 PTR_DECL(mmap64, void*, (void *addr, size_t length, int prot, int flags, int fd, off64_t offset));
 PTR_DECL(fopen, FILE*, (const char *path, const char *mode));
@@ -88,16 +158,36 @@ PTR_DECL(putc, int, (int c, FILE *stream));
 PTR_DECL(puchar, int, (int c));
 PTR_DECL(puts, int, (const char *s));
 PTR_DECL(fseek, int, (FILE *stream, long offset, int whence));
-PTR_DECL(fsync, int, (int fd));
-PTR_DECL(fdatasync, int, (int fd));
 PTR_DECL(aio_read, int, (struct aiocb *aiocbp));
 PTR_DECL(aio_read64, int, (struct aiocb64 *aiocbp));
 PTR_DECL(aio_write, int, (struct aiocb *aiocbp));
 PTR_DECL(aio_write64, int, (struct aiocb64 *aiocbp));
 #endif /**/
 
+/*
+ * The real functions are resolved before _myhijack_init, so that the
+ * middleware may call them before the hooks are called.
+ */
+#define RESOLVE(func)	\
+    __atomic_store_n(&__real_ ## func, dlsym(RTLD_NEXT, #func), __ATOMIC_RELEASE)
+
+static void
+hijack_resolve()
+{
+#ifndef IOMIDDLE_WRAP
+    RESOLVE(creat); RESOLVE(open); RESOLVE(close);
+    RESOLVE(write); RESOLVE(read); RESOLVE(lseek64);
+    RESOLVE(fsync); RESOLVE(fdatasync);
+    RESOLVE(stat); RESOLVE(stat64); RESOLVE(lstat); RESOLVE(lstat64);
+    RESOLVE(fstat); RESOLVE(fstat64);
+    RESOLVE(__fxstat); RESOLVE(__fxstat64);
+    RESOLVE(__lxstat); RESOLVE(__lxstat64);
+    RESOLVE(__xstat); RESOLVE(__xstat64);
+#endif
+}
+
 int
-creat(const char* path, mode_t mode)
+HOOK(creat)(const char* path, mode_t mode)
 {
     int	ret;
     HIJACK_DO(ret, creat, (path, mode));
@@ -105,7 +195,7 @@ creat(const char* path, mode_t mode)
 }
 
 int
-open(const char *path, int flags, ...)
+HOOK(open)(const char *path, int flags, ...)
 {
     int		ret;
     mode_t	mode;
@@ -133,7 +223,7 @@ open(const char *path, int flags, ...)
 }
 
 int
-close(int fd)
+HOOK(close)(int fd)
 {
     int	ret;
 
@@ -142,7 +232,8 @@ close(int fd)
     return ret;
 }
 
-ssize_t write(int fd, const void *buf, size_t count)
+ssize_t
+HOOK(write)(int fd, const void *buf, size_t count)
 {
     ssize_t	ret;
 
@@ -151,7 +242,8 @@ ssize_t write(int fd, const void *buf, size_t count)
     return ret;
 }
 
-ssize_t read(int fd, void *buf, size_t count)
+ssize_t
+HOOK(read)(int fd, void *buf, size_t count)
 {
     ssize_t	ret;
 
@@ -161,9 +253,125 @@ ssize_t read(int fd, void *buf, size_t count)
 }
 
 off64_t
-lseek64(int fd, off64_t offset, int whence)
+HOOK(lseek64)(int fd, off64_t offset, int whence)
 {
     ssize_t	ret;
     HIJACK_DO(ret, lseek64, (fd, offset, whence));
     return ret;
 }
+
+int
+HOOK(fsync)(int fd)
+{
+    int	ret;
+    HIJACK_DO(ret, fsync, (fd));
+    return ret;
+}
+
+int
+HOOK(fdatasync)(int fd)
+{
+    int	ret;
+    HIJACK_DO(ret, fdatasync, (fd));
+    return ret;
+}
+
+/*
+ * stat family: glibc 2.33 or later exports stat, fstat, ..., and
+ * programs compiled with older ones call __xstat, __fxstat, ...
+ */
+int
+HOOK(stat)(const char* path, struct stat *buf)
+{
+    int	ret;
+    HIJACK_DO(ret, stat, (path, buf));
+    return ret;
+}
+
+int
+HOOK(stat64)(const char* path, struct stat64 *buf)
+{
+    int	ret;
+    HIJACK_DO(ret, stat64, (path, buf));
+    return ret;
+}
+
+int
+HOOK(lstat)(const char* path, struct stat *buf)
+{
+    int	ret;
+    HIJACK_DO(ret, lstat, (path, buf));
+    return ret;
+}
+
+int
+HOOK(lstat64)(const char* path, struct stat64 *buf)
+{
+    int	ret;
+    HIJACK_DO(ret, lstat64, (path, buf));
+    return ret;
+}
+
+int
+HOOK(fstat)(int fd, struct stat *buf)
+{
+    int	ret;
+    HIJACK_DO(ret, fstat, (fd, buf));
+    return ret;
+}
+
+int
+HOOK(fstat64)(int fd, struct stat64 *buf)
+{
+    int	ret;
+    HIJACK_DO(ret, fstat64, (fd, buf));
+    return ret;
+}
+
+int
+HOOK(__xstat)(int vers, const char* path, struct stat *buf)
+{
+    int	ret;
+    HIJACK_DO(ret, __xstat, (vers, path, buf));
+    return ret;
+}
+
+int
+HOOK(__xstat64)(int vers, const char* path, struct stat64 *buf)
+{
+    int	ret;
+    HIJACK_DO(ret, __xstat64, (vers, path, buf));
+    return ret;
+}
+
+int
+HOOK(__lxstat)(int vers, const char* path, struct stat *buf)
+{
+    int	ret;
+    HIJACK_DO(ret, __lxstat, (vers, path, buf));
+    return ret;
+}
+
+int
+HOOK(__lxstat64)(int vers, const char* path, struct stat64 *buf)
+{
+    int	ret;
+    HIJACK_DO(ret, __lxstat64, (vers, path, buf));
+    return ret;
+}
+
+int
+HOOK(__fxstat)(int vers, int fd, struct stat *buf)
+{
+    int	ret;
+    HIJACK_DO(ret, __fxstat, (vers, fd, buf));
+    return ret;
+}
+
+int
+HOOK(__fxstat64)(int vers, int fd, struct stat64 *buf)
+{
+    int	ret;
+    HIJACK_DO(ret, __fxstat64, (vers, fd, buf));
+    return ret;
+}
@@ -3,7 +3,9 @@
  *	Copyright 2018, RIKEN
  *	  2018/04/30
  */
+#ifndef _LARGEFILE64_SOURCE
 #define _LARGEFILE64_SOURCE
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
@@ -13,12 +15,23 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <aio.h>
+#ifndef __USE_GNU
 #define __USE_GNU
+#endif
 #include <dlfcn.h>
 
+#ifdef IOMIDDLE_WRAP
+/* __real_ functions are resolved by the linker with -Wl,--wrap */
+#define EXTERN_PTR_DECL(name,ret,args)		\
+    extern ret __real_ ## name args __attribute__((weak));	\
+    extern ret (*_hijacked_ ## name) args
+#else
 #define EXTERN_PTR_DECL(name,ret,args)		\
     extern ret (*__real_ ## name) args;	\
     extern ret (*_hijacked_ ## name) args
+#endif
+
+extern void _hijack_ensure();
 
 EXTERN_PTR_DECL(creat, int, (const char* path, mode_t mode));
 EXTERN_PTR_DECL(creat64, int, (const char* path, mode_t mode));
@@ -36,6 +49,12 @@ EXTERN_PTR_DECL(pwrite64, ssize_t, (int fd, const void *buf, size_t count, off64
 ));
 EXTERN_PTR_DECL(readv, ssize_t, (int fd, const struct iovec *iov, int iovcnt));
 EXTERN_PTR_DECL(writev, ssize_t, (int fd, const struct iovec *iov, int iovcnt));
+EXTERN_PTR_DECL(stat, int, (const char* path, struct stat *buf));
+EXTERN_PTR_DECL(stat64, int, (const char* path, struct stat64 *buf));
+EXTERN_PTR_DECL(lstat, int, (const char* path, struct stat *buf));
+EXTERN_PTR_DECL(lstat64, int, (const char* path, struct stat64 *buf));
+EXTERN_PTR_DECL(fstat, int, (int fd, struct stat *buf));
+EXTERN_PTR_DECL(fstat64, int, (int fd, struct stat64 *buf));
 EXTERN_PTR_DECL(__fxstat, int, (int vers, int fd, struct stat *buf));
 EXTERN_PTR_DECL(__fxstat64, int, (int vers, int fd, struct stat64 *buf));
 EXTERN_PTR_DECL(__lxstat, int, (int vers, const char* path, struct stat *buf));
@@ -8,17 +8,268 @@
  *	2) lseek is always issued for the next stripe.
  *	3) read and write sizes are always the same length over all processes.
  *	   This length is used for stripe size.
+ *	Assumptions 2) and 3) are relaxed for write in the extent mode
+ *	(IOMIDDLE_EXTENT), where each process may write any length at any
+ *	offset.  Every process, however, must issue the same number of
+ *	write calls per flush round, except the last round before close.
+ *	In the stripe mode, a process may write fewer stripes than others
+ *	in the end, and its last write may be shorter than the stripe size.
+ *	Only the stripes written are exchanged and written at close.
+ *	4) Threads may access different files concurrently.  A file
+ *	   descriptor is handled by one thread at a time.  If MPI provides
+ *	   MPI_THREAD_MULTIPLE, each care file has a communicator of its
+ *	   own, created at the collective open, so that collectives of
+ *	   files accessed by different threads do not depend on each other.
+ *	   A path is not opened, closed or stat'ed by two threads at the
+ *	   same time.  Otherwise, MPI calls of this middleware are
+ *	   serialized by a global lock on MPI_COMM_WORLD, and collective
+ *	   operations of all files must be issued in the same order over
+ *	   processes.
  * Captured system calls:
- *	creat, open, close, read, lseek64, write
+ *	creat, open, close, read, lseek64, write, fsync, fdatasync,
+ *	stat, lstat, fstat (and their 64-bit and __xstat variants)
+ *	fsync and fdatasync on a care file descriptor opened for write are
+ *	collective.  Buffered data, including a partially filled round, are
+ *	flushed, each process which has written the file syncs it once, and
+ *	the result is agreed by one reduction.
+ *	Files of the IOMIDDLE_CONTAINER pattern are not created, but packed
+ *	into one container file.  Each process opens one file of the
+ *	pattern at a time, and open and close of the files are collective.
+ *	The data of a file are staged in memory and written at close, where
+ *	fsync and fdatasync do nothing.  Reads are served by the container,
+ *	and do not need to be collective.  Unless opened with O_TRUNC, files
+ *	are added to the existing container, and a file of the same number
+ *	supersedes the earlier one.
+ *	A care file opened with O_APPEND for write is appended collectively.
+ *	Processes may append any number of records of any length.  Each
+ *	write reserves its range at the end by an atomic counter in rank 0
+ *	(MPI_Fetch_and_op), and the records are buffered as in the extent
+ *	mode and written by aggregators at fsync, fdatasync and close.
+ *	lseek with SEEK_END returns the end including ranges reserved so
+ *	far.  Records beyond IOMIDDLE_MEMLIMIT are written by each process.
+ *	st_size reported by fstat of a care file descriptor includes data
+ *	buffered in this middleware.  In the stripe mode, other processes
+ *	are assumed to have buffered as many stripes as this process.
  * Shell environment:
  *	IOMIDDLE_CARE_PATH 
- *	   -- file path taken care by this middleware.
- *	     The user must specify this variable.
+ *	   -- file paths taken care by this middleware, separated by ':'.
+ *	      Each path may be followed by its policy, e.g.,
+ *	      "./results:./ckpt,mode=extent,memlimit=64M".
+ *	      Files at or under the path are taken care, where the policy
+ *	      of the longest matching path is applied.  The last component
+ *	      ending with '*' matches names beginning with it.  Paths are
+ *	      made absolute and normalized without resolving symbolic
+ *	      links, though the real path of a rule is also registered.
+ *	      Policy keys are:
+ *		mode=stripe|extent|rma|bcast|bypass  (bypass: not taken care)
+ *		memlimit=size, bypass_size=size, trunc=0|1, sparse=0|1|2,
+ *		tier=0|1, cache=0|1, server=0|1
+ *	      whose defaults are given by the other variables.
+ *	     The user must specify this variable or IOMIDDLE_CONFIG,
+ *	     which may be empty if only iomiddle_open opens care files.
+ *	     Neither is required with libiomiddle.a.
+ *	IOMIDDLE_CONFIG
+ *	   -- file of rules, one per line in the above syntax, where
+ *	      policy keys may be separated by blanks.  '#' begins a comment.
+ *	      Rules of IOMIDDLE_CARE_PATH override the ones of this file.
  *	IOMIDDLE_TRUNC
  *	   -- if specify, enable global file truncation at the close time.
+ *	      Rank 0 sets the size to the largest end of writes over
+ *	      processes by one ftruncate after all stripes are written.
  *	      Note that this behavior is different than POSIX,
  *	      because procccesses independently close a file descriptor
  *	      whose file pointer is local and differs than others in POSIX.
+ *	IOMIDDLE_SPARSE
+ *	   -- 1 if aggregators scan blocks and do not write their all-zero
+ *	      pieces of 4 KiB aligned in the file, so that the file has
+ *	      holes there.  2 if, in addition, all-zero stripes are not
+ *	      exchanged, where processes exchange the bitmap of their
+ *	      all-zero stripes per flush round.  The bitmap is not used
+ *	      with IOMIDDLE_CHECKSUM or IOMIDDLE_PROGRESS.  It applies to
+ *	      files opened with O_TRUNC in the stripe and RMA modes, and
+ *	      rank 0 extends the file to the largest end of writes at
+ *	      close if it ends with a hole.
+ *	IOMIDDLE_TIER
+ *	   -- node-local directory, e.g., on SSD or tmpfs, for staging.
+ *	      Aggregators write blocks of the stripe and RMA modes to their
+ *	      staging files there, and a thread copies them to the files
+ *	      in the background, also after close.  The copies complete
+ *	      at fsync/fdatasync of the file, when this process opens the
+ *	      file again for write, and at exit.  Until then, reads of
+ *	      this process are served from its staging files, and other
+ *	      processes must not read or truncate the file except through
+ *	      stripe-mode reads with the same stripe size.  tier=0 of a
+ *	      rule writes the files directly.
+ *	IOMIDDLE_CACHE
+ *	   -- memory budget per process, K, M, or G suffix may be specified,
+ *	      of the cache of blocks read in the stripe mode.  Aggregators
+ *	      keep the blocks they read, and the least recently used ones
+ *	      are evicted.  A block of the same file, offset and length is
+ *	      scattered from the cache while the mtime of the file at the
+ *	      first read is unchanged.  The blocks of a file are dropped
+ *	      when it is opened or closed for write.  cache=0 of a rule
+ *	      reads the files always.
+ *	IOMIDDLE_EXTENT
+ *	   -- if specified, the arbitrary-offset aggregation (extent mode)
+ *	      is used for write.  Processes exchange (offset, length) lists
+ *	      of buffered data, and the data are moved by MPI_Alltoallv to
+ *	      aggregators, each of which writes contiguous runs of its own
+ *	      file domain.  read is directly issued in this mode.  A
+ *	      failed write is reported by the next fsync, fdatasync or
+ *	      close of the process with EIO.
+ *	IOMIDDLE_RMA
+ *	   -- if specified, the stripe mode of write uses one-sided
+ *	      communication.  A stripe is put into the window of the
+ *	      aggregator of its block as soon as it is written, and the
+ *	      aggregator writes the block when all stripes have arrived.
+ *	      Only the aggregator waits, so processes need not move in
+ *	      lockstep.  As in the stripe mode, processes may write
+ *	      different numbers of stripes, and the last write of a
+ *	      process may be short.  It is not used in the adaptive mode
+ *	      or with IOMIDDLE_PROGRESS.  The rule of mode=rma is the same.
+ *	IOMIDDLE_RMA_DEPTH
+ *	   -- # of blocks an aggregator keeps in its window, 2 by default.
+ *	      A process waits for the aggregator if it is this number of
+ *	      blocks ahead.  It is reduced under IOMIDDLE_MEMLIMIT.
+ *	IOMIDDLE_SERVERS
+ *	   -- # of I/O server processes spawned by MPI_Comm_spawn at the
+ *	      first open of a care file.  Consecutive ranks are served by
+ *	      each server, which assembles the blocks of their stripes and
+ *	      writes them, so that processes hand off full rounds by
+ *	      non-blocking sends and go on.  Only files opened O_WRONLY in
+ *	      the stripe mode are written by the servers, and not in the
+ *	      adaptive mode, with IOMIDDLE_PROGRESS or IOMIDDLE_CHECKSUM.
+ *	      server=0 of a rule writes the files by aggregators.  Servers
+ *	      run with io_middle.so preloaded as the job does.
+ *	IOMIDDLE_SERVER_PATH
+ *	   -- executable of servers, "iomiddle-server" (tools) by default.
+ *	IOMIDDLE_SERVER_HOSTS
+ *	   -- comma-separated hosts, on which servers are placed in turn.
+ *	      MPI places the servers by default.
+ *	IOMIDDLE_SERVER_MEMLIMIT
+ *	   -- buffer capacity per server, K, M, or G suffix may be
+ *	      specified, 1G by default.  A process waits at the next
+ *	      round when its previous round does not fit.
+ *	IOMIDDLE_TRACE
+ *	   -- path prefix of trace files.  open, creat, close, lseek64,
+ *	      read, write, fsync and fdatasync of care files are recorded
+ *	      with the file position, size and time to the trace file
+ *	      prefix.rank of each process in the binary format of
+ *	      iomiddle.h.  tools/iomiddle-replay re-issues the recorded
+ *	      calls with synthetic data.
+ *	IOMIDDLE_MONITOR
+ *	   -- name of a shared memory segment, e.g., "iomiddle.job1", where
+ *	      the processes of a node publish counters: bytes staged,
+ *	      written and read, flush rounds completed and in progress,
+ *	      rounds queued to the progress thread, and the time blocked
+ *	      in exchanges and in writes.  tools/iomiddle-top name shows
+ *	      them live on the node.  The segment is created at the first
+ *	      open of a care file, and removed at exit.
+ *	IOMIDDLE_COPY_NT
+ *	   -- copies of data to the buffers of this middleware at or above
+ *	      this size use non-temporal stores, K, M, or G suffix may be
+ *	      specified.  The default is 1M, and 0 disables them.
+ *	      The buffers are placed on the NUMA node of the thread first
+ *	      copying data into them.
+ *	IOMIDDLE_COPY_THREADS
+ *	   -- # of helper threads per process splitting copies of 2 MiB or
+ *	      more between user buffers and the buffers of this middleware.
+ *	      The helpers inherit the cpu affinity of the thread first
+ *	      splitting a copy.  The default is 0.
+ *	IOMIDDLE_CHECKSUM
+ *	   -- if specified, the CRC32C of each stripe is computed while it
+ *	      is copied to the buffer of this middleware, and is sent to
+ *	      the aggregator with the stripe.  The aggregator writes the
+ *	      records of its block to the checksum file, the path name
+ *	      suffixed by ".crc".  Read verifies the stripe by the record
+ *	      while copying it out, and fails with EIO on a mismatch.  It
+ *	      is used in the stripe mode without IOMIDDLE_RMA,
+ *	      IOMIDDLE_ADAPTIVE or IOMIDDLE_PROGRESS.
+ *	IOMIDDLE_BCAST_PATH
+ *	   -- files of this path opened for read only are read in the
+ *	      replicated-read mode, where every process reads the same
+ *	      range by each read call.  The range is read by one process and
+ *	      broadcast to others.  The files need not be under
+ *	      IOMIDDLE_CARE_PATH.  It is the same as the rule of mode=bcast.
+ *	IOMIDDLE_BCAST_AUTO
+ *	   -- if specified, the replicated-read mode is also selected for a
+ *	      care file opened for read only when all processes issue the
+ *	      first read at the same offset with the same length.
+ *	      lseek before the first read is checked at the read.
+ *	IOMIDDLE_BCAST_SCOPE
+ *	   -- "node" if one process per node reads and broadcasts the data
+ *	      in the node.  The default is "global", where rank 0 reads.
+ *	IOMIDDLE_CONTAINER
+ *	   -- path pattern of files packed into a container, e.g.,
+ *	      "./results/out.%d", where %d matches the number of a file.
+ *	      The files need not be under IOMIDDLE_CARE_PATH.
+ *	      If the data of a file exceed IOMIDDLE_MEMLIMIT, the file is
+ *	      written outside the container in the adaptive mode.
+ *	IOMIDDLE_CONTAINER_FILE
+ *	   -- path of the container.  The default is the pattern whose %d
+ *	      is replaced by "container".
+ *	IOMIDDLE_ADAPTIVE
+ *	   -- if specified, an access pattern which does not fit this
+ *	      middleware does not abort the program.  Whether aggregation
+ *	      pays off is collectively decided per file at the first access.
+ *	      The file falls back to direct POSIX calls if the pattern is
+ *	      irregular, stripes differ over processes or are larger than
+ *	      IOMIDDLE_BYPASS_SIZE, or the file read is smaller than a block.
+ *	      If a process deviates from the pattern later, it writes its
+ *	      buffered stripes by itself and all processes fall back to
+ *	      direct calls at the next flush round.
+ *	IOMIDDLE_DETECT
+ *	   -- if specified, the access pattern of a care file is detected
+ *	      at the first read or write instead of assumptions 2) and 3),
+ *	      where lseek before it only moves the file position.  All
+ *	      processes must issue the first read or write.  Their offsets
+ *	      and lengths are exchanged, and the stripe mode is used if
+ *	      process r accesses base + r*length with the same length.
+ *	      The stripe size is the length, and base may be any multiple
+ *	      of the block length.  Otherwise, the file is written in the
+ *	      extent mode, and read by direct calls.
+ *	IOMIDDLE_BYPASS_SIZE
+ *	   -- stripe size in bytes at or above which direct POSIX calls are
+ *	      used in the adaptive mode.  The default is 8 MiB.
+ *	IOMIDDLE_MEMLIMIT
+ *	   -- memory budget in bytes per file descriptor, K, M, or G suffix
+ *	      may be specified.  If the user and system buffers of
+ *	      stripe size * nprocs each exceed this budget, fewer stripes
+ *	      are buffered per round and a block is exchanged and written
+ *	      in pieces of fewer stripes.  The staging buffer of the extent
+ *	      mode is also capped by this budget.
+ *	IOMIDDLE_PROGRESS
+ *	   -- if specified, a progress thread is created per process under
+ *	      MPI_THREAD_MULTIPLE.  In the stripe mode, write only copies
+ *	      data to the user buffer, and a full buffer is handed to the
+ *	      progress thread, which exchanges and writes it by
+ *	      non-blocking collectives while the application computes.
+ *	      They are posted on a duplicate of the communicator of the
+ *	      file.  Another user buffer is allocated per file descriptor.
+ *	      It is not used in the adaptive mode.
+ *	IOMIDDLE_ASYNC_SYNC
+ *	   -- if specified with IOMIDDLE_PROGRESS, fsync and fdatasync return
+ *	      after handing the sync to the progress thread.  The completion
+ *	      is queried by iomiddle_sync_test/iomiddle_sync_wait declared
+ *	      in iomiddle.h.
+ *	IOMIDDLE_PROGRESS_CPU
+ *	   -- cpu list, e.g., "12,13", the progress thread is pinned to.
+ *	      The i-th process in a node uses the (i % length)-th cpu.
+ *	IOMIDDLE_STAT_COLLECTIVE
+ *	   -- if specified, stat and lstat of a care path are collective:
+ *	      all processes must stat the same path in the same order.
+ *	      Rank 0 stats it and broadcasts the result, and st_size is the
+ *	      file length including data buffered by all processes.
+ *	      Rank 0 keeps the result for IOMIDDLE_STAT_TTL, unless it
+ *	      writes, truncates or closes the file, or a flush round writes
+ *	      the file, in the meantime.
+ *	IOMIDDLE_STAT_TTL
+ *	   -- lifetime of a cached stat result in milliseconds.
+ *	      The default is 1000.  0 disables the cache.
+ *	IOMIDDLE_NCOMM
+ *	   -- # of communicators of closed files kept under
+ *	      MPI_THREAD_MULTIPLE, which are reused when the same paths are
+ *	      opened again.  The default is 16.
  *	IOMIDDLE_DISABLE
  *	   -- disable this middleware hooks.
  *	IOMIDDLE_DEBUG
@@ -32,33 +283,70 @@
  *	Note that the LD_PRELOAD environment should not be set on your bash
  *	   currently used.  If set, all commands/programs invoked on that bash 
  *	   are contolled under this IO Middleware.
+ *	Instead of preloading, the program may be linked with the static
+ *	   library, which wraps calls of the program only, not the ones of
+ *	   MPI or other shared libraries:
+ *	$ mpicc -o mytest mytest.c -Wl,@../src/iomiddle.wrap \
+ *	   ../src/libiomiddle.a -ldl -lpthread -lrt
  */
 #include "io_middle.h"
+#include "iomiddle.h"
 #include <mpi.h>
 #include <limits.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+/*
+ * File domains of aggregators in the extent mode are aligned to this size
+ */
+#define EXT_DOMAIN_ALIGN	(1024*1024)
+#define EXT_IOV_MAX		1024
+#define EXT_ROUND_MAX		(1024*1024*1024) /* bytes buffered per round */
+#define EXT_XCHG_MAX		INT_MAX	/* bytes received per exchange */
+
+#define BYPASS_SIZE_DEFAULT	(8*1024*1024)
+#define NCOMM_DEFAULT		16
+#define COMM_TAG_MIN		32767	/* the least MPI_TAG_UB */
+#define COMM_TAG_RETRY		16	/* tag collisions tolerated per path */
+#define PROG_POLL_MIN		1000	/* nsec */
+#define PROG_POLL_MAX		(1000*1000)
+#define BCAST_CHUNK		(1024*1024*1024)
+#define STAT_CACHE_MAX		64
+#define CONT_MAGIC		"IOMCONT2"
+#define CONT_ALIGN		4096
+#define CONT_CHUNK		(16*1024*1024)
+#define STAT_TTL_DEFAULT	1000	/* msec */
+#define PATH_HASH		4096
+#define RMA_DEPTH_DEFAULT	2
+#define TRACE_BUFSIZE		(64*1024)
+#define COPY_NT_DEFAULT		(1024*1024)
+#define SRV_MEM_DEFAULT		(1024*1024*1024)
+#define SRV_PATH_DEFAULT	"iomiddle-server"
+#define COPY_SLICE_MIN		(1024*1024)
+#define CRC_MAGIC		"IOMCRC1"
+#define CRC_HDRSIZE		16	/* magic and stripe size */
+#define CRC_SUFFIX		".crc"
+#define SPARSE_GRAIN		4096
+#define ZBIT(map, i)		((map)[(i)/32] & (1U << ((i)%32)))
+#define FD_PAGE			64	/* # of fdinfo entries per page */
+
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH		0x1000
+#endif
 
 #define Myrank 	(_inf.rank)
 #define Nprocs 	(_inf.nprocs)
+/* the page of fd must have been allocated, see fd_page() */
+#define FDINFO(fd)	(&_inf.fdpages[(fd)/FD_PAGE][(fd)%FD_PAGE])
 
 static struct ioinfo _inf;
-static char	care_path[PATH_MAX];
-
-#if 0
-static char	*dont_path[] = {
-    "/",
-    "/mnt1/",
-    "linux-vdso",
-    "/etc/",
-    "/proc/",
-    "/usr/lib/",
-    "/lib/",
-    "/dev/",
-    "/sys/",
-    "../src/",
-    "log",
-    0
-};
-#endif
+static char	cont_pattern[PATH_MAX];
+static char	cont_file[PATH_MAX];
+
+static void	prog_init(int rank);
+static void	prog_pin(MPI_Comm node);
+static void	mon_init(MPI_Comm node);
+static void	srv_spawn();
 
 static int
 dbgprintf(const char *fmt, ...)
@@ -78,517 +366,6084 @@ static void
 info_show(int fd, const char *fname)
 {
     DEBUGWRITE("[%d] %s: nprocs(%d) bufsize(%ld) strsize(%d) "
-	       "block size(%ld) mybufcount(%d)\n",
+	       "block size(%ld) mybufcount(%d) strgrp(%d)\n",
 	       Myrank, fname, Nprocs,
-	       _inf.fdinfo[fd].bufsize, _inf.fdinfo[fd].strsize,
-	       _inf.fdinfo[fd].filblklen, _inf.mybufcount);
+	       FDINFO(fd)->bufsize, FDINFO(fd)->strsize,
+	       FDINFO(fd)->filblklen, FDINFO(fd)->mybufcount,
+	       FDINFO(fd)->strgrp);
 }
 
 void
-data_show(const char *msg, int *ip, int len, int idx)
+data_show(const char *msg, int *ip, int len, size_t idx)
 {
     int	i;
     dbgprintf("%s: ", msg);
     for (i = 0; i < len; i++) {
-	fprintf(stderr, "[%d] %d ", idx + i, ip[i]); fflush(stderr);
+	fprintf(stderr, "[%ld] %d ", idx + i, ip[i]); fflush(stderr);
     }
     fprintf(stderr, "\n");
 }
 
-static int
-is_dont_care_path(const char *path)
+/*
+ * Size with K, M, or G suffix
+ */
+static size_t
+size_parse(const char *cp)
 {
-    if (care_path[0] && !strncmp(care_path, path, strlen(care_path))) {
-	return 0;
-    } else {
-	return 1;
+    char	*ep;
+    size_t	sz = strtoull(cp, &ep, 0);
+    switch (*ep) {
+    case 'g': case 'G': sz *= 1024;	/* fall through */
+    case 'm': case 'M': sz *= 1024;	/* fall through */
+    case 'k': case 'K': sz *= 1024;
     }
-#if 0
-    int rc = 0;
-    int i;
-    for (i = 0; dont_path[i] != 0; i++) {
-	int len = strlen(dont_path[i]);
-	if (!strcmp(path, dont_path[i]) /* exact matching */
-	    || (i != 0 && !strncmp(path, dont_path[i], len))) {
-	    rc = 1; break;
-	}
+    return sz;
+}
+
+/*
+ * Path rules:
+ *	Rules are registered in the trie at the initialization, and are
+ *	read only afterward.  Looking up a path costs one hash probe per
+ *	path component, regardless of the number of rules.
+ */
+static unsigned int
+path_hash(int parent, const char *name, size_t len)
+{
+    unsigned int	h = 5381 + parent;
+
+    while (len-- > 0) {
+	h = h*33 + (unsigned char) *name++;
     }
-    return rc;
-#endif
+    return h % PATH_HASH;
 }
 
-static inline void
-rank_init()
+static int
+path_child(int parent, const char *name, size_t len)
 {
-    if (Myrank < 0) {
-	MPI_Comm_size(MPI_COMM_WORLD, &Nprocs);
-	MPI_Comm_rank(MPI_COMM_WORLD, &Myrank);
+    int	i;
+
+    for (i = _inf.phash[path_hash(parent, name, len)]; i >= 0;
+	 i = _inf.pnodes[i].next) {
+	if (_inf.pnodes[i].parent == parent
+	    && !strncmp(_inf.pnodes[i].name, name, len)
+	    && _inf.pnodes[i].name[len] == 0) {
+	    return i;
+	}
     }
+    return -1;
 }
 
-static inline int
-info_flagcheck(int flags)
+static int
+path_newnode(int parent, const char *name, size_t len)
 {
-    rank_init();
-    return (Myrank ==0) ? flags : (flags & ~O_TRUNC);
+    struct pnode	*np;
+    unsigned int	h;
+
+    if (_inf.npnodes == _inf.maxpnodes) {
+	_inf.maxpnodes = _inf.maxpnodes ? _inf.maxpnodes*2 : 64;
+	_inf.pnodes = realloc(_inf.pnodes,
+			      sizeof(struct pnode)*_inf.maxpnodes);
+	IOMIDDLE_IFERROR((_inf.pnodes == NULL), "%s",
+			 "Cannot allocate working memory\n");
+    }
+    np = &_inf.pnodes[_inf.npnodes];
+    np->parent = parent;
+    np->rule = np->wild = -1;
+    np->name = strndup(name, len);
+    IOMIDDLE_IFERROR((np->name == NULL), "%s",
+		     "Cannot allocate working memory\n");
+    h = path_hash(parent, name, len);
+    np->next = _inf.phash[h];
+    _inf.phash[h] = _inf.npnodes;
+    return _inf.npnodes++;
 }
 
 /*
- * flags and mode are values specified by arguments
+ * Absolute path without ".", ".." and duplicated '/'.  Symbolic links
+ * are not resolved so that no metadata access is issued.
  */
-static void
-info_init(int fd, int flags, int mode)
+static int
+path_canon(const char *path, char *out)
 {
-    fdinfo	*info = &_inf.fdinfo[fd];
+    char	buf[PATH_MAX*2];
+    const char	*cp;
+    char	*op = out;
+    size_t	n = 0;
 
-    rank_init();
-    info->iofd   = fd;
-    info->bufpos = 0;
-    info->filpos = 0;
-    info->bufcount = 0;
-    info->dntcare  = 0;
-    info->flags    = flags;
-    info->mode   = mode;
-    info->trunc = (((flags|mode) & O_TRUNC) == O_TRUNC);
+    if (path[0] != '/') {
+	if (getcwd(buf, PATH_MAX) == NULL) {
+	    return -1;
+	}
+	n = strlen(buf);
+    }
+    snprintf(buf + n, sizeof(buf) - n, "/%s", path);
+    *op = 0;
+    for (cp = buf; *cp; cp += n) {
+	while (*cp == '/') cp++;
+	if (*cp == 0) break;
+	n = strcspn(cp, "/");
+	if (n == 1 && cp[0] == '.') {
+	    continue;
+	} else if (n == 2 && cp[0] == '.' && cp[1] == '.') {
+	    while (op > out && *--op != '/');
+	    *op = 0;
+	} else {
+	    if ((op - out) + n + 2 > PATH_MAX) {
+		return -1;
+	    }
+	    *op++ = '/';
+	    memcpy(op, cp, n);
+	    op += n;
+	    *op = 0;
+	}
+    }
+    if (op == out) {
+	strcpy(out, "/");
+    }
+    return 0;
 }
 
 static void
-buf_init(int fd, int strsize)
+rule_insert(const char *canon, const struct policy *pol)
 {
-    int	strcnt = Nprocs;
-    _inf.fdinfo[fd].notfirst = 1;
-    _inf.fdinfo[fd].strsize = strsize;
-    _inf.fdinfo[fd].strcnt = strcnt;
-    _inf.fdinfo[fd].filoff = _inf.fdinfo[fd].strsize*Myrank;
-    _inf.fdinfo[fd].filblklen = strsize * strcnt;
-    _inf.mybufcount = strcnt;
-    _inf.fdinfo[fd].bufsize = _inf.fdinfo[fd].filblklen;
-    _inf.fdinfo[fd].ubuf = malloc(_inf.fdinfo[fd].bufsize);
-    _inf.fdinfo[fd].sbuf = malloc(_inf.fdinfo[fd].bufsize);
-    IOMIDDLE_IFERROR(
-	(_inf.fdinfo[fd].ubuf == NULL || _inf.fdinfo[fd].sbuf == NULL),
-	"%s", "Cannot allocate IO middleware buffer\n");
-    memset(_inf.fdinfo[fd].ubuf, 0, _inf.fdinfo[fd].bufsize);
-    memset(_inf.fdinfo[fd].sbuf, 0, _inf.fdinfo[fd].bufsize);
-    _inf.fdinfo[fd].filcurb = Myrank;
-    _inf.fdinfo[fd].filtail = Myrank;
-    DEBUG(DLEVEL_BUFMGR) {
-	dbgprintf("%s: strsize = %d\n", __func__, _inf.fdinfo[fd].strsize);
+    struct pathrule	*rp;
+    const char		*cp;
+    int			node = 0, child, r;
+    size_t		n;
+
+    r = _inf.nrules++;
+    _inf.rules = realloc(_inf.rules, sizeof(struct pathrule)*_inf.nrules);
+    IOMIDDLE_IFERROR((_inf.rules == NULL), "%s",
+		     "Cannot allocate working memory\n");
+    rp = &_inf.rules[r];
+    rp->prefix = NULL;
+    rp->next = -1;
+    rp->pol = *pol;
+    for (cp = canon; *cp; cp += n) {
+	while (*cp == '/') cp++;
+	if (*cp == 0) break;
+	n = strcspn(cp, "/");
+	if (cp[n] == 0 && cp[n - 1] == '*') {
+	    /* name prefix in the directory of node */
+	    rp->prefix = strndup(cp, n - 1);
+	    IOMIDDLE_IFERROR((rp->prefix == NULL), "%s",
+			     "Cannot allocate working memory\n");
+	    rp->next = _inf.pnodes[node].wild;
+	    _inf.pnodes[node].wild = r;
+	    return;
+	}
+	if ((child = path_child(node, cp, n)) < 0) {
+	    child = path_newnode(node, cp, n);
+	}
+	node = child;
     }
+    /* a later rule of the same path overrides */
+    _inf.pnodes[node].rule = r;
 }
 
 /*
- * Checking if this file descriptor is controlled by this middleware.
+ * A rule, e.g., "./results,mode=extent,memlimit=64M".  The policy
+ * keys may be separated by blanks.
  */
-static inline int
-dontcare_mode_check(int fd, int mode)
+static void
+rule_add(char *spec, int mode)
 {
-    if (_inf.fdinfo[fd].dntcare || _inf.fdinfo[fd].iofd == 0) {
-	return 1;
+    struct policy	pol = _inf.defpol;
+    char		canon[PATH_MAX], real[PATH_MAX];
+    char		*path, *key, *val, *save;
+
+    if ((path = strtok_r(spec, ", \t\n", &save)) == NULL) {
+	return;
     }
-    if (_inf.fdinfo[fd].rwmode == MODE_UNKNOWN) {
-	_inf.fdinfo[fd].rwmode = mode;
+    if (mode >= 0) {
+	pol.mode = mode;
+    }
+    while ((key = strtok_r(NULL, ", \t\n", &save)) != NULL) {
+	if ((val = strchr(key, '=')) == NULL) {
+	    fprintf(stderr, "%s: no value of %s for %s\n", __func__, key, path);
+	    continue;
+	}
+	*val++ = 0;
+	if (!strcmp(key, "mode")) {
+	    if (!strcmp(val, "stripe")) pol.mode = POLICY_STRIPE;
+	    else if (!strcmp(val, "extent")) pol.mode = POLICY_EXTENT;
+	    else if (!strcmp(val, "rma")) pol.mode = POLICY_RMA;
+	    else if (!strcmp(val, "bcast")) pol.mode = POLICY_BCAST;
+	    else if (!strcmp(val, "bypass")) pol.mode = POLICY_BYPASS;
+	    else fprintf(stderr, "%s: unknown mode %s\n", __func__, val);
+	} else if (!strcmp(key, "memlimit")) {
+	    pol.memlimit = size_parse(val);
+	} else if (!strcmp(key, "bypass_size")) {
+	    pol.bypass_size = size_parse(val);
+	} else if (!strcmp(key, "trunc")) {
+	    pol.trunc = atoi(val) > 0;
+	} else if (!strcmp(key, "sparse")) {
+	    pol.sparse = atoi(val);
+	} else if (!strcmp(key, "tier")) {
+	    pol.tier = atoi(val) > 0 && _inf.tierdir;
+	} else if (!strcmp(key, "cache")) {
+	    pol.cache = atoi(val) > 0;
+	} else if (!strcmp(key, "server")) {
+	    pol.server = atoi(val) > 0;
+	} else {
+	    fprintf(stderr, "%s: unknown key %s\n", __func__, key);
+	}
+    }
+    if (path_canon(path, canon) < 0) {
+	fprintf(stderr, "%s: too long path %s\n", __func__, path);
+	return;
+    }
+    rule_insert(canon, &pol);
+    if (!strchr(canon, '*') && realpath(canon, real) && strcmp(real, canon)) {
+	rule_insert(real, &pol);
+    }
+    DEBUG(DLEVEL_CONFIRM) {
+	printf("rule: %s mode(%d) memlimit(%ld) bypass_size(%ld) trunc(%d) "
+	       "sparse(%d) tier(%d) cache(%d) server(%d)\n", canon, pol.mode,
+	       pol.memlimit, pol.bypass_size, pol.trunc, pol.sparse, pol.tier,
+	       pol.cache, pol.server);
     }
-    IOMIDDLE_IFERROR((_inf.fdinfo[fd].rwmode != mode), "%s",
-		     "read and write issued\n");
-    return 0;
 }
 
 /*
- *  Stripe size is checked or determined
+ * Rules separated by sep, or in lines of a file if sep is 0
  */
-static inline int
-stripe_check_init(int fd, size_t len, int lseek)
+static void
+rule_list(const char *list, int sep, int mode)
 {
-    int	rc = 0;
-    int	strsize;
-    if (!_inf.fdinfo[fd].notfirst) {
-	if (lseek) {
-	    if (Myrank == 0) {
-		IOMIDDLE_IFERROR((len != 0), "%s",
-			 "lseek is issued before write/read on rank 0\n");
-		/* len == 0 OK, strsize will be determined at the first read/write call  */
-		goto ext;
-	    }
-	    strsize = len/Myrank;
-	} else {
-	    IOMIDDLE_IFERROR((Myrank != 0), /* unexpected usage ! */
-			     "write/read is issued before lseek offset(%ld)\n",
-			     len);
-	    strsize = len;
-	}
-	IOMIDDLE_IFERROR((strsize == 0
-		  || (Myrank != 0 && ((len/Myrank)*Myrank != len))),
-			 "lseek offset is expected multiple of rank, "
-			 "requested offset is %d on rank %d\n",
-			 len, Myrank);
-	buf_init(fd, strsize);
-    } else {
-	if (lseek == 0) {
-	    if (len != _inf.fdinfo[fd].strsize) {
-		dbgprintf("read/write size must be always stripe size: "
-			  "stripe size(%ld), requested size(%d)\n",
-			  len, _inf.fdinfo[fd].strsize);
-		rc = -1;
+    FILE	*fp;
+    char	line[PATH_MAX*2], *cp, *ep;
+
+    if (sep) {
+	for (cp = (char*) list; cp && *cp; cp = ep) {
+	    if ((ep = strchr(cp, sep)) != NULL) {
+		snprintf(line, sizeof(line), "%.*s", (int)(ep++ - cp), cp);
+	    } else {
+		snprintf(line, sizeof(line), "%s", cp);
 	    }
+	    rule_add(line, mode);
 	}
+	return;
     }
-ext:
-    return rc;
+    if ((fp = fopen(list, "r")) == NULL) {
+	fprintf(stderr, "%s: cannot open %s\n", __func__, list);
+	return;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+	if ((cp = strchr(line, '#')) != NULL) *cp = 0;
+	rule_add(line, mode);
+    }
+    fclose(fp);
 }
 
-static size_t
-buf_flush(fdinfo *info)
+/*
+ * The policy of the path, or NULL if it is not taken care
+ */
+static const struct policy *
+path_policy(const char *path)
 {
-    size_t	cc = -1ULL;
-    int	i;
-    int off;
-    size_t	strsize = info->strsize;
-    size_t	blksize = info->filblklen;
-    /*
-     * ubuf : user data buffer, contining stripe * bufcount
-     * sbuf : system data buffer
-     * ubuf --> sbuf per stripe
-     */
-    off = 0;
-    for (i = 0; i < info->bufcount; i++) {
-	DEBUG(DLEVEL_BUFMGR) {
-	    data_show("ubuf", (int*) info->ubuf + off, 5, off);
-	}
-	MPI_CALL(
-	    MPI_Gather(info->ubuf + off, strsize, MPI_BYTE,
-		       info->sbuf, strsize, MPI_BYTE,
-		       i, MPI_COMM_WORLD));
-	    off += strsize;
-    }
-    /*
-     * bufcount: # of strips has been written to the buffer
-     *   (nprocs == bufcount): buffers are fulled over all processes
-     *   (nprocs < bufcount):  ranks, smaller than bufcount, only keep data
-     * Variables with prefix "fil" are file view
-     *   filpos:  pointer
-     *   filcurb: current block number
-     *		Each block is the maximum contiguous area in file view.
-     *		writing/reading to/from file is performed per block.
-     *		filcurb is advanced by stripe count, not +1.
-     *   filtail: last block buffered in local
-     *   filblklen: block length (stripe size * nprocs)
-     *		stripe count is equal to nprocs
-     *  E.g.
-     *	         rank 0	  rank 1     rank 2     rank 3
-     *  ubuf   #0#1#2#3   #0#1#2#3   #0#1#2#3   #0#1#2#3
-     *         <------------- Exchange ---------------->
-     *	sbuf     blk#0	  blk#1	      blk#2	blk#3
-     */
-    if (Myrank < info->bufcount) {
-	size_t	sz;
-	off_t	filpos = info->filcurb * blksize;
+    char	canon[PATH_MAX];
+    const char	*cp;
+    int		node = 0, best, w, wbest;
+    size_t	n, plen, wlen;
 
-	DEBUG(DLEVEL_BUFMGR) {
-	    dbgprintf("writing size(%ld) filpos(%ld) "
-		      "curblk#(%d) tailblk#(%d)\n",
-		      info->bufsize, filpos,  info->filcurb, info->filtail);
-	    /* showing one block */
-	    for (i = 0; i < info->bufsize; i += strsize) {
-		data_show("sbuf", (int*) (info->sbuf + i), 5, i);
-	    }
-	}
-	sz = pwrite(info->iofd, info->sbuf, blksize, filpos);
-#if 0
-	__real_lseek64(info->iofd, filpos, SEEK_SET);
-	sz = __real_write(info->iofd, info->sbuf, blksize);
-#endif
-	if (sz < blksize) { cc = -1ULL; }
-    } else {
-	DEBUG(DLEVEL_BUFMGR) {
-	    dbgprintf("No needs to write\n", Myrank);
+    if (_inf.nrules == 0 || path_canon(path, canon) < 0) {
+	return NULL;
+    }
+    best = _inf.pnodes[0].rule;
+    for (cp = canon; *cp; cp += n) {
+	while (*cp == '/') cp++;
+	if (*cp == 0) break;
+	n = strcspn(cp, "/");
+	/* the longest prefix, the later rule of the same one */
+	wbest = -1;
+	wlen = 0;
+	for (w = _inf.pnodes[node].wild; w >= 0; w = _inf.rules[w].next) {
+	    plen = strlen(_inf.rules[w].prefix);
+	    if ((wbest < 0 || plen > wlen)
+		&& !strncmp(cp, _inf.rules[w].prefix, plen)) {
+		wbest = w;
+		wlen = plen;
+	    }
+	}
+	if (wbest >= 0) {
+	    best = wbest;
+	}
+	if ((node = path_child(node, cp, n)) < 0) {
+	    break;
+	}
+	if (_inf.pnodes[node].rule >= 0) {
+	    best = _inf.pnodes[node].rule;
 	}
     }
-    if(info->filcurb != info->filtail) {
-	dbgprintf("%s: Something Wrong ???? filcurb(%d) filtail(%d)\n",
-		  __func__, info->filcurb, info->filtail);
+    if (best < 0 || _inf.rules[best].pol.mode == POLICY_BYPASS) {
+	return NULL;
     }
-    info->filcurb += info->strcnt;
-    info->filtail += info->strcnt;
-    info->bufcount = 0;
-    info->bufpos = 0;
-    return cc;
+    return &_inf.rules[best].pol;
 }
 
 /*
- * creat system call
+ * fstat without going through the hook, which locks the fd
  */
-int
-_iomiddle_creat(const char* path, mode_t mode)
+static inline int
+sys_fstat64(int fd, struct stat64 *sb)
 {
-    int	fd;
+    return fstatat64(fd, "", sb, AT_EMPTY_PATH);
+}
 
-    if (is_dont_care_path(path)) {
-	fd = __real_creat(path, mode);
-	return fd;
-    }
-    DEBUG(DLEVEL_HIJACKED|DLEVEL_CONFIRM) {
-	fprintf(stderr, "%s DO-CARE path=%s\n", __func__, path);
+/*
+ * Invoked by the first thread accessing a care file, which may be done
+ * by this process alone, e.g., a read of the container.  No collective
+ * is issued here.  Myrank is published at last so that other threads
+ * see the initialized communicators.
+ */
+static inline void
+rank_init()
+{
+    int	rank;
+
+    if (__atomic_load_n(&Myrank, __ATOMIC_ACQUIRE) >= 0) {
+	return;
     }
-    fd = __real_creat(path, mode);
-    if (fd >= 0) {
-	info_init(fd, 0, mode);
+    pthread_mutex_lock(&_inf.initlock);
+    if (Myrank < 0) {
+	MPI_Query_thread(&_inf.thrlevel);
+	MPI_Comm_size(MPI_COMM_WORLD, &Nprocs);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	if (_inf.thrlevel == MPI_THREAD_MULTIPLE) {
+	    /* communicators of files are created by comm_get() */
+	    int	*ub, flag;
+	    MPI_CALL(MPI_Comm_group(MPI_COMM_WORLD, &_inf.worldgrp));
+	    MPI_CALL(MPI_Comm_get_attr(MPI_COMM_WORLD, MPI_TAG_UB, &ub, &flag));
+	    _inf.tagub = flag ? *ub : COMM_TAG_MIN;
+	}
+	if (_inf.progress && _inf.thrlevel != MPI_THREAD_MULTIPLE) {
+	    if (rank == 0) {
+		fprintf(stderr, "[0] %s: MPI_THREAD_MULTIPLE is required, "
+			"no progress thread\n", __func__);
+	    }
+	    _inf.progress = 0;
+	}
+	if (_inf.progress) {
+	    prog_init(rank);
+	}
+	__atomic_store_n(&Myrank, rank, __ATOMIC_RELEASE);
     }
-    return fd;
+    pthread_mutex_unlock(&_inf.initlock);
 }
 
 /*
- * open system call
+ * Invoked at the first open of a care file which is collective by
+ * contract, i.e., issued by all processes, so that the collectives
+ * over MPI_COMM_WORLD for the processes of a node are matched.
  */
-int
-_iomiddle_open(const char *path, int flags, ...)
+static void
+coll_init()
 {
-    int	fd;
-    int mode = 0;
-    int dont_care = is_dont_care_path(path);
+    MPI_Comm	node;
 
-    DEBUG(DLEVEL_ALL) {
-	fprintf(stderr, "[%d] %s path=%s\n", Myrank, __func__, path);
-    }
-    if (flags & O_CREAT) {
-        va_list arg;
-        va_start(arg, flags);
-        mode = va_arg(arg, int);
-        va_end(arg);
-    }
-    if (dont_care) {
-	fd = __real_open(path, flags, mode);
-    } else {
-	int umode  = info_flagcheck(mode);
-	int uflags = info_flagcheck(flags);
-	fd = __real_open(path, uflags, umode);
+    rank_init();
+    if (__atomic_load_n(&_inf.collinit, __ATOMIC_ACQUIRE)) {
+	return;
     }
-    if (fd < 0) goto err;
-    if (dont_care) {
-	_inf.fdinfo[fd].notfirst = 1;
-	_inf.fdinfo[fd].dntcare = 1;
-    } else {
-	DEBUG(DLEVEL_HIJACKED|DLEVEL_CONFIRM) {
-	    fprintf(stderr, "[%d] open() DO-CARE file fd(%d) path(%s)\n",
-		    Myrank, fd, path);
+    pthread_mutex_lock(&_inf.initlock);
+    if (!_inf.collinit) {
+	if (_inf.monitor || _inf.bcast_node
+	    || (_inf.progress && _inf.progcpu)) {
+	    MPI_CALL(MPI_Comm_split_type(MPI_COMM_WORLD,
+					 MPI_COMM_TYPE_SHARED, 0,
+					 MPI_INFO_NULL, &node));
+	    if (_inf.progress && _inf.progcpu) {
+		prog_pin(node);
+	    }
+	    if (_inf.monitor) {
+		mon_init(node);
+	    }
+	    if (_inf.bcast_node && _inf.thrlevel != MPI_THREAD_MULTIPLE) {
+		/* processes in a node for the replicated-read mode */
+		_inf.world.nodecomm = node;
+	    } else {
+		MPI_Comm_free(&node);
+	    }
 	}
-	info_init(fd, flags, mode);
+	__atomic_store_n(&_inf.collinit, 1, __ATOMIC_RELEASE);
     }
-err:
-    return fd;
+    pthread_mutex_unlock(&_inf.initlock);
 }
 
 /*
- * close system call
+ * The communicator of collectives on a path.  Under MPI_THREAD_MULTIPLE,
+ * each file opened has its own communicator, so that threads access
+ * different files concurrently.  The communicator is created by all
+ * processes with the tag of the path, where communicators of different
+ * paths created concurrently by threads are told apart.  The tag is a
+ * hash of the path up to MPI_TAG_UB.  The path is checked over
+ * processes, and the creation is retried with another tag if tags of
+ * paths have collided.  The retry steps the tag by a second hash of the
+ * path, so that paths whose tags have collided once are parted, and
+ * gives up after COMM_TAG_RETRY collisions.  Otherwise, MPI_COMM_WORLD
+ * is used with the global lock.
  */
-int
-_iomiddle_close(int fd)
+static struct commslot *
+comm_get(const char *path)
 {
-    int	rc;
-    fdinfo	*info;
-    
-    if (_inf.fdinfo[fd].dntcare || _inf.fdinfo[fd].iofd == 0) {
-	rc = __real_close(fd);
-	return rc;
+    struct commslot	*cs, **csp;
+    unsigned long long	h = 1469598103934665603ULL;	/* FNV-1a */
+    unsigned long long	h2 = 5381;			/* djb2 */
+    unsigned long long	tag, step;
+    long long		v[2];
+    const char		*cp;
+    int			try;
+
+    if (_inf.thrlevel != MPI_THREAD_MULTIPLE) {
+	return &_inf.world;
     }
-    info =  &_inf.fdinfo[fd];
-    DEBUG(DLEVEL_HIJACKED) { fprintf(stderr, "%s DO-CARE fd(%d)\n", __func__, fd); }
-    if (_inf.fdinfo[fd].bufcount > 0) {
-	DEBUG(DLEVEL_BUFMGR) {
-	    dbgprintf("%s: bufcount(%d)\n", __func__, _inf.fdinfo[fd].bufcount);
+    pthread_mutex_lock(&_inf.cfreelock);
+    for (csp = &_inf.cfree; (cs = *csp) != NULL; csp = &cs->next) {
+	if (!strcmp(cs->path, path)) {
+	    *csp = cs->next;
+	    _inf.ncfree--;
+	    break;
 	}
-	rc = buf_flush(info);
     }
-    if (_inf.reqtrunc && info->trunc) {
-	off64_t	filpos = info->filpos;
-	if (Myrank == 0) {
-	    /* Rank 0 only has created or opened this file with the O_TRUNC flag
-	     * if specified. */
-	    MPI_Reduce(&info->filpos, &filpos, 1, MPI_UNSIGNED_LONG_LONG,
-		       MPI_MAX, 0, MPI_COMM_WORLD);
-	    if (filpos != info->filpos) {
-		__real_lseek64(info->iofd, filpos, SEEK_SET);
-	    }
-	    rc = __real_close(fd);
-	} else {
-	    rc = __real_close(fd);
-	    MPI_Reduce(&info->filpos, &filpos, 1, MPI_UNSIGNED_LONG_LONG,
-		       MPI_MAX, 0, MPI_COMM_WORLD);
+    pthread_mutex_unlock(&_inf.cfreelock);
+    if (cs) {
+	return cs;
+    }
+    cs = calloc(1, sizeof(struct commslot));
+    IOMIDDLE_IFERROR((cs == NULL || (cs->path = strdup(path)) == NULL),
+		     "%s", "Cannot allocate working memory\n");
+    for (cp = path; *cp; cp++) {
+	h = (h ^ (unsigned char) *cp)*1099511628211ULL;
+	h2 = h2*33 + (unsigned char) *cp;
+    }
+    tag = h % ((unsigned) _inf.tagub + 1);
+    step = 1 + h2 % (unsigned) _inf.tagub;
+    for (try = 0; ; try++) {
+	MPI_CALL(MPI_Comm_create_group(MPI_COMM_WORLD, _inf.worldgrp,
+				       (int) tag, &cs->comm));
+	/* the same hash over processes if min == max */
+	v[0] = (long long) (h >> 2);
+	v[1] = -v[0];
+	MPI_CALL(MPI_Allreduce(MPI_IN_PLACE, v, 2, MPI_LONG_LONG, MPI_MIN,
+			       cs->comm));
+	if (v[0] == -v[1]) {
+	    break;
+	}
+	DEBUG(DLEVEL_CONFIRM) {
+	    dbgprintf("%s: path(%s) tag collision, retry(%d)\n",
+		      __func__, path, try + 1);
 	}
+	MPI_Comm_free(&cs->comm);
+	IOMIDDLE_IFERROR((try + 1 >= COMM_TAG_RETRY),
+			 "%s: path(%s) tag collides after %d retries\n",
+			 __func__, path, try + 1);
+	tag = (tag + step) % ((unsigned) _inf.tagub + 1);
     }
-    info->attrall = 0;
-    info->iofd = -1;
-    free(info->ubuf);
-    free(info->sbuf);
-    info->ubuf = 0;
-    info->sbuf = 0;
-    return rc;
+    cs->nodecomm = MPI_COMM_NULL;
+    if (_inf.bcast_node) {
+	/* processes in a node for the replicated-read mode */
+	MPI_CALL(MPI_Comm_split_type(cs->comm, MPI_COMM_TYPE_SHARED, 0,
+				     MPI_INFO_NULL, &cs->nodecomm));
+    }
+    cs->pcomm = MPI_COMM_NULL;
+    if (_inf.progress) {
+	/* rounds in flight never match collectives of the application */
+	MPI_CALL(MPI_Comm_dup(cs->comm, &cs->pcomm));
+    }
+    pthread_mutex_init(&cs->lock, NULL);
+    return cs;
 }
 
 /*
- * write system call
- *	DO not call printf/fprintf stuffs inside this function for debugging.
+ * Releasing the communicator after the last collective on the path.
+ * Whether it is kept for reuse is agreed over processes, because the
+ * number of kept ones depends on the order of closes by threads.
  */
-ssize_t
-_iomiddle_write(int fd, const void *buf, size_t len)
+static void
+comm_put(struct commslot *cs)
 {
-    size_t	rc = len;
-    fdinfo	*info;
-    if (dontcare_mode_check(fd, MODE_WRITE)) {
-	rc = __real_write(fd, buf, len);
-	return rc;
+    struct commslot	*p;
+    int		keep, reserved;
+
+    if (cs == &_inf.world) {
+	return;
     }
-    DEBUG(DLEVEL_HIJACKED) {
-	DEBUGWRITE("[%d] %s DO-CARE fd(%d) len(%ld)\n",
-		   Myrank, __func__, fd, len);
+    pthread_mutex_lock(&_inf.cfreelock);
+    /* one per path, which may have been kept by stat meanwhile */
+    for (p = _inf.cfree; p && strcmp(p->path, cs->path); p = p->next);
+    keep = reserved = (p == NULL && _inf.ncfree < _inf.ncomm);
+    if (reserved) _inf.ncfree++;
+    pthread_mutex_unlock(&_inf.cfreelock);
+    MPI_CALL(MPI_Allreduce(MPI_IN_PLACE, &keep, 1, MPI_INT, MPI_MIN,
+			   cs->comm));
+    pthread_mutex_lock(&_inf.cfreelock);
+    if (keep) {
+	cs->next = _inf.cfree;
+	_inf.cfree = cs;
+	pthread_mutex_unlock(&_inf.cfreelock);
+	return;
+    }
+    if (reserved) {
+	_inf.ncfree--;
+    }
+    pthread_mutex_unlock(&_inf.cfreelock);
+    if (cs->nodecomm != MPI_COMM_NULL) {
+	MPI_Comm_free(&cs->nodecomm);
+    }
+    if (cs->pcomm != MPI_COMM_NULL) {
+	MPI_Comm_free(&cs->pcomm);
+    }
+    MPI_Comm_free(&cs->comm);
+    pthread_mutex_destroy(&cs->lock);
+    free(cs->path);
+    free(cs);
+}
+
+static void
+comm_assign(fdinfo *info, const char *path)
+{
+    struct commslot	*cs = comm_get(path);
+
+    info->cslot = cs;
+    info->comm = cs->comm;
+    info->commlock = &cs->lock;
+    info->nodecomm = cs->nodecomm;
+    info->pcomm = cs->pcomm;
+}
+
+/*
+ * File descriptor table:
+ *	fdinfo entries are allocated in pages of FD_PAGE on the first
+ *	care open of an fd in the page, and never freed.  A care fd has
+ *	its bit set in fdcare from info_init until close, which is the
+ *	only check for other fds.
+ */
+static inline int
+is_dontcare_fd(int fd)
+{
+    return fd < 0 || fd >= _inf.fdlimit
+	|| !(__atomic_load_n(&_inf.fdcare[fd/64], __ATOMIC_ACQUIRE)
+	     & (1ULL << (fd%64)));
+}
+
+static void
+fd_setcare(int fd, int care)
+{
+    if (care) {
+	__atomic_or_fetch(&_inf.fdcare[fd/64], 1ULL << (fd%64),
+			  __ATOMIC_RELEASE);
+    } else {
+	__atomic_and_fetch(&_inf.fdcare[fd/64], ~(1ULL << (fd%64)),
+			   __ATOMIC_RELEASE);
+    }
+}
+
+static fdinfo *
+fd_page(int fd)
+{
+    fdinfo	*page;
+    int		i;
+
+    IOMIDDLE_IFERROR((fd < 0 || fd >= _inf.fdlimit),
+		     "fd(%d) exceeds the limit %ld\n", fd, (long) _inf.fdlimit);
+    page = __atomic_load_n(&_inf.fdpages[fd/FD_PAGE], __ATOMIC_ACQUIRE);
+    if (page) {
+	return &page[fd%FD_PAGE];
+    }
+    pthread_mutex_lock(&_inf.fdlock);
+    if ((page = _inf.fdpages[fd/FD_PAGE]) == NULL) {
+	page = calloc(FD_PAGE, sizeof(fdinfo));
+	IOMIDDLE_IFERROR((page == NULL), "%s",
+			 "Cannot allocate working memory\n");
+	for (i = 0; i < FD_PAGE; i++) {
+	    pthread_mutex_init(&page[i].lock, NULL);
+	}
+	__atomic_store_n(&_inf.fdpages[fd/FD_PAGE], page, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&_inf.fdlock);
+    return &page[fd%FD_PAGE];
+}
+
+/*
+ * Locking a care file descriptor.  NULL is returned if it is not taken
+ * care, or it has been closed by another thread.
+ */
+static fdinfo *
+care_lock(int fd)
+{
+    fdinfo	*info;
+
+    if (is_dontcare_fd(fd)) {
+	return NULL;
+    }
+    info = FDINFO(fd);
+    pthread_mutex_lock(&info->lock);
+    if (is_dontcare_fd(fd)) {
+	pthread_mutex_unlock(&info->lock);
+	return NULL;
+    }
+    pthread_mutex_lock(info->commlock);
+    return info;
+}
+
+static void
+care_unlock(fdinfo *info)
+{
+    pthread_mutex_unlock(info->commlock);
+    pthread_mutex_unlock(&info->lock);
+}
+
+static inline int
+info_flagcheck(int flags)
+{
+    rank_init();
+    return (Myrank ==0) ? flags : (flags & ~O_TRUNC);
+}
+
+/*
+ * I/O pattern recorder (IOMIDDLE_TRACE).  Calls on care file
+ * descriptors are recorded to the trace file of this process in the
+ * format of iomiddle.h.  Records are buffered and written at close of
+ * a care file, and at exit.
+ */
+static void
+trace_flush(void)
+{
+    if (_inf.trfd >= 0 && _inf.trpos > 0) {
+	if (__real_write(_inf.trfd, _inf.trbuf, _inf.trpos) != _inf.trpos) {
+	    dbgprintf("%s: cannot write the trace file\n", __func__);
+	}
+    }
+    _inf.trpos = 0;
+}
+
+static void
+trace_exit(void)
+{
+    pthread_mutex_lock(&_inf.trlock);
+    trace_flush();
+    pthread_mutex_unlock(&_inf.trlock);
+}
+
+static void
+trace_open(void)
+{
+    char	path[PATH_MAX];
+    struct iomiddle_trace_hdr	hdr;
+
+    snprintf(path, PATH_MAX, "%s.%d", _inf.trace, Myrank);
+    _inf.trfd = __real_open(path, O_CREAT|O_WRONLY|O_TRUNC, 0644);
+    _inf.trbuf = malloc(TRACE_BUFSIZE);
+    if (_inf.trfd < 0 || _inf.trbuf == NULL) {
+	dbgprintf("%s: cannot open the trace file %s\n", __func__, path);
+	_inf.trace = NULL;
+	return;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, IOMIDDLE_TRACE_MAGIC, sizeof(IOMIDDLE_TRACE_MAGIC));
+    hdr.rank = Myrank;
+    hdr.nprocs = Nprocs;
+    memcpy(_inf.trbuf, &hdr, sizeof(hdr));
+    _inf.trpos = sizeof(hdr);
+    clock_gettime(CLOCK_MONOTONIC, &_inf.trt0);
+    atexit(trace_exit);
+}
+
+static void
+trace_rec(int op, int fd, int whence, off64_t off, off64_t len,
+	  const char *path)
+{
+    struct iomiddle_trace	tr;
+    struct timespec	ts;
+    size_t	plen = path ? len : 0;
+
+    pthread_mutex_lock(&_inf.trlock);
+    if (_inf.trfd < 0) {
+	trace_open();
+	if (_inf.trace == NULL) goto out;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    memset(&tr, 0, sizeof(tr));
+    tr.op = op;
+    tr.whence = whence;
+    tr.fd = fd;
+    tr.off = off;
+    tr.len = len;
+    tr.nsec = (ts.tv_sec - _inf.trt0.tv_sec)*1000000000ULL
+	+ ts.tv_nsec - _inf.trt0.tv_nsec;
+    if (_inf.trpos + sizeof(tr) + plen > TRACE_BUFSIZE) {
+	trace_flush();
+    }
+    memcpy(_inf.trbuf + _inf.trpos, &tr, sizeof(tr));
+    _inf.trpos += sizeof(tr);
+    if (plen > 0) {
+	/* plen < PATH_MAX fits in the buffer */
+	memcpy(_inf.trbuf + _inf.trpos, path, plen);
+	_inf.trpos += plen;
+    }
+    if (op == IOMIDDLE_TR_CLOSE) {
+	trace_flush();
+    }
+out:
+    pthread_mutex_unlock(&_inf.trlock);
+}
+
+#define TRACE(op, fd, whence, off, len, path) do {		\
+    if (_inf.trace) trace_rec(op, fd, whence, off, len, path);	\
+} while (0)
+
+/*
+ * Live counters (IOMIDDLE_MONITOR).  Processes of a node share one
+ * segment created by the first process in the node, and each updates
+ * its own record of iomiddle.h.  The segment is removed at exit.
+ */
+static void
+mon_exit(void)
+{
+    char	name[NAME_MAX];
+
+    snprintf(name, NAME_MAX, "/%s", _inf.monitor);
+    shm_unlink(name);
+}
+
+static void
+mon_init(MPI_Comm node)
+{
+    int		lrank, lsize, fd = -1, ok = 0;
+    size_t	sz;
+    char	name[NAME_MAX];
+    struct iomiddle_mon_hdr	*hdr = MAP_FAILED;
+
+    snprintf(name, NAME_MAX, "/%s", _inf.monitor);
+    MPI_Comm_rank(node, &lrank);
+    MPI_Comm_size(node, &lsize);
+    sz = sizeof(struct iomiddle_mon_hdr) + sizeof(struct iomiddle_mon)*lsize;
+    if (lrank == 0) {
+	fd = shm_open(name, O_CREAT|O_RDWR|O_TRUNC, 0644);
+	if (fd >= 0 && ftruncate(fd, sz) == 0) {
+	    hdr = mmap(NULL, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	if (hdr != MAP_FAILED) {
+	    hdr->nprocs = Nprocs;
+	    hdr->nlocal = lsize;
+	    hdr->recsize = sizeof(struct iomiddle_mon);
+	    memcpy(hdr->magic, IOMIDDLE_MON_MAGIC, sizeof(IOMIDDLE_MON_MAGIC));
+	    atexit(mon_exit);
+	    ok = 1;
+	}
+    }
+    MPI_CALL(MPI_Bcast(&ok, 1, MPI_INT, 0, node));
+    if (ok && lrank != 0) {
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd >= 0) {
+	    hdr = mmap(NULL, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+    }
+    if (fd >= 0) {
+	__real_close(fd);
+    }
+    if (hdr == MAP_FAILED) {
+	if (lrank == 0) {
+	    fprintf(stderr, "[%d] %s: cannot create the shared memory %s\n",
+		    Myrank, __func__, name);
+	}
+	return;
+    }
+    _inf.mon = (struct iomiddle_mon*) (hdr + 1) + lrank;
+    _inf.mon->rank = Myrank;
+    _inf.mon->pid = getpid();
+}
+
+static inline uint64_t
+mon_now(void)
+{
+    struct timespec	ts;
+
+    if (_inf.mon == NULL) {
+	return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+#define MON_ADD(field, v) do {						\
+    if (_inf.mon) __atomic_fetch_add(&_inf.mon->field, (v), __ATOMIC_RELAXED); \
+} while (0)
+#define MON_SINCE(field, t0)	MON_ADD(field, mon_now() - (t0))
+
+/*
+ * Staging copies between user buffers and the buffers of this
+ * middleware.  Copies to the buffers at or above IOMIDDLE_COPY_NT bytes
+ * use non-temporal stores, because the data are sent and written
+ * rather than read again by this process.  The buffers are not touched
+ * at allocation, so that their pages are placed on the NUMA node of the
+ * thread first copying data into them.
+ */
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+static void
+copy_range(char *dst, const char *src, size_t len, int nt)
+{
+#if defined(__x86_64__)
+    if (nt) {
+	size_t	head = (16 - ((uintptr_t) dst & 15)) & 15;
+	if (head > len) head = len;
+	memcpy(dst, src, head);
+	dst += head; src += head; len -= head;
+	for (; len >= 64; len -= 64, dst += 64, src += 64) {
+	    __m128i	a = _mm_loadu_si128((const __m128i*) src);
+	    __m128i	b = _mm_loadu_si128((const __m128i*) (src + 16));
+	    __m128i	c = _mm_loadu_si128((const __m128i*) (src + 32));
+	    __m128i	d = _mm_loadu_si128((const __m128i*) (src + 48));
+	    _mm_stream_si128((__m128i*) dst, a);
+	    _mm_stream_si128((__m128i*) (dst + 16), b);
+	    _mm_stream_si128((__m128i*) (dst + 32), c);
+	    _mm_stream_si128((__m128i*) (dst + 48), d);
+	}
+	memcpy(dst, src, len);
+	_mm_sfence();
+	return;
+    }
+#elif defined(__aarch64__) && defined(__clang__)
+    if (nt) {
+	typedef uint64_t	v2du __attribute__((vector_size(16)));
+	size_t	head = (16 - ((uintptr_t) dst & 15)) & 15;
+	if (head > len) head = len;
+	memcpy(dst, src, head);
+	dst += head; src += head; len -= head;
+	for (; len >= 32; len -= 32, dst += 32, src += 32) {
+	    v2du	a, b;
+	    memcpy(&a, src, 16);
+	    memcpy(&b, src + 16, 16);
+	    __builtin_nontemporal_store(a, (v2du*) dst);
+	    __builtin_nontemporal_store(b, (v2du*) (dst + 16));
+	}
+	memcpy(dst, src, len);
+	__asm__ volatile("dmb ishst" ::: "memory");
+	return;
+    }
+#endif
+    memcpy(dst, src, len);
+}
+
+/*
+ * Slices are taken with the pool lock held, and copied without it
+ */
+static void
+copy_slices(struct copypool *cp)
+{
+    int		k;
+
+    while ((k = cp->next) < cp->nslice) {
+	char		*dst = cp->dst + k*cp->slice;
+	const char	*src = cp->src + k*cp->slice;
+	size_t	len = (k == cp->nslice - 1) ? cp->len - k*cp->slice : cp->slice;
+	int	nt = cp->nt;
+	cp->next++;
+	pthread_mutex_unlock(&cp->lock);
+	copy_range(dst, src, len, nt);
+	pthread_mutex_lock(&cp->lock);
+	if (++cp->ndone == cp->nslice) {
+	    pthread_cond_signal(&cp->done);
+	}
+    }
+}
+
+static void *
+copy_main(void *arg)
+{
+    struct copypool	*cp = arg;
+    unsigned	gen = 0;
+
+    pthread_mutex_lock(&cp->lock);
+    for (;;) {
+	while (cp->gen == gen) {
+	    pthread_cond_wait(&cp->cond, &cp->lock);
+	}
+	gen = cp->gen;
+	copy_slices(cp);
+    }
+    return arg;
+}
+
+/*
+ * Helper threads are created at the first split copy, and inherit the
+ * cpu affinity of the thread, i.e., they run in its NUMA node if the
+ * process is bound to the node.
+ */
+static void
+copy_start(struct copypool *cp)
+{
+    int	i;
+
+    cp->thr = malloc(sizeof(pthread_t)*cp->nthr);
+    IOMIDDLE_IFERROR((cp->thr == NULL), "%s",
+		     "Cannot allocate working memory\n");
+    for (i = 0; i < cp->nthr; i++) {
+	IOMIDDLE_IFERROR(
+	    (pthread_create(&cp->thr[i], NULL, copy_main, cp) != 0),
+	    "%s", "Cannot create a copy thread\n");
+    }
+}
+
+/*
+ * Copying len bytes.  nt is set for copies to the buffers of this
+ * middleware.  A copy of COPY_SLICE_MIN*2 bytes or more is split among
+ * IOMIDDLE_COPY_THREADS helper threads and the caller unless another
+ * thread is splitting its copy.
+ */
+static void
+stage_copy(void *dst, const void *src, size_t len, int nt)
+{
+    struct copypool	*cp = &_inf.copy;
+    size_t	slice;
+
+    nt = nt && _inf.copynt > 0 && len >= _inf.copynt;
+    if (cp->nthr == 0 || len < COPY_SLICE_MIN*2
+	|| pthread_mutex_trylock(&cp->busy) != 0) {
+	copy_range(dst, src, len, nt);
+	return;
+    }
+    if (cp->thr == NULL) {
+	copy_start(cp);
+    }
+    slice = (len/(cp->nthr + 1) + 4095) & ~(size_t) 4095;
+    if (slice < COPY_SLICE_MIN) slice = COPY_SLICE_MIN;
+    pthread_mutex_lock(&cp->lock);
+    cp->dst = dst;
+    cp->src = src;
+    cp->len = len;
+    cp->slice = slice;
+    cp->nt = nt;
+    cp->nslice = (len + slice - 1)/slice;
+    cp->next = cp->ndone = 0;
+    cp->gen++;
+    pthread_cond_broadcast(&cp->cond);
+    copy_slices(cp);
+    while (cp->ndone < cp->nslice) {
+	pthread_cond_wait(&cp->done, &cp->lock);
+    }
+    pthread_mutex_unlock(&cp->lock);
+    pthread_mutex_unlock(&cp->busy);
+}
+
+/*
+ * Buffers of this middleware are page aligned and not touched here
+ */
+static void *
+stage_alloc(size_t size)
+{
+    void	*p;
+
+    if (posix_memalign(&p, 4096, size) != 0) {
+	return NULL;
+    }
+    return p;
+}
+
+/*
+ * Hole-aware writes (IOMIDDLE_SPARSE).  All-zero pieces of a block are
+ * not written, so that the file system leaves holes there.  Pieces are
+ * SPARSE_GRAIN bytes aligned in the file, the unit of allocation of
+ * most file systems.
+ */
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static int
+is_zero(const void *buf, size_t len)
+{
+    const unsigned char	*p = buf;
+    size_t	i = 0;
+
+#if defined(__x86_64__)
+    const __m128i	zero = _mm_setzero_si128();
+    for (; i + 64 <= len; i += 64) {
+	__m128i	a = _mm_or_si128(_mm_loadu_si128((const __m128i*) (p + i)),
+				 _mm_loadu_si128((const __m128i*) (p + i + 16)));
+	__m128i	b = _mm_or_si128(_mm_loadu_si128((const __m128i*) (p + i + 32)),
+				 _mm_loadu_si128((const __m128i*) (p + i + 48)));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(a, b), zero))
+	    != 0xffff) {
+	    return 0;
+	}
+    }
+#elif defined(__aarch64__)
+    for (; i + 64 <= len; i += 64) {
+	uint8x16_t	a = vorrq_u8(vld1q_u8(p + i), vld1q_u8(p + i + 16));
+	uint8x16_t	b = vorrq_u8(vld1q_u8(p + i + 32), vld1q_u8(p + i + 48));
+	if (vmaxvq_u8(vorrq_u8(a, b)) != 0) {
+	    return 0;
+	}
+    }
+#endif
+    for (; i < len; i++) {
+	if (p[i]) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Burst-buffer tier (IOMIDDLE_TIER):
+ *	Blocks written by an aggregator go to its staging file in the
+ *	node-local directory at their offsets in the file, and the drainer
+ *	thread copies the extents to the file in order.  The staging file
+ *	is unlinked at creation, and extents copied after close are
+ *	punched out of it.
+ *	Copying continues after close, and completes at fsync/fdatasync of
+ *	the file, at the next open of the file for write by this process,
+ *	and at exit.  Reads of this process are served from the staging
+ *	file for extents not copied yet.
+ */
+#define TIER_CHUNK	(4*1024*1024)
+
+static void
+tier_reap(struct tierfile *tf)
+{
+    struct tierfile	**tpp;
+
+    for (tpp = &_inf.tiers; *tpp != tf; tpp = &(*tpp)->next);
+    *tpp = tf->next;
+    __real_close(tf->sfd);
+    __real_close(tf->rfd);
+    free(tf->ext);
+    free(tf);
+}
+
+static int
+tier_copy(struct tierfile *tf, off64_t off, off64_t len, char **bufp)
+{
+    loff_t	in = off, out = off;
+    ssize_t	cc;
+
+    while (len > 0) {
+	cc = copy_file_range(tf->sfd, &in, tf->rfd, &out, len, 0);
+	if (cc < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL
+		       || errno == EOPNOTSUPP)) {
+	    /* copied through the user space */
+	    if (*bufp == NULL && (*bufp = malloc(TIER_CHUNK)) == NULL) {
+		return -1;
+	    }
+	    cc = pread(tf->sfd, *bufp, len < TIER_CHUNK ? len : TIER_CHUNK, in);
+	    if (cc > 0 && pwrite(tf->rfd, *bufp, cc, out) != cc) {
+		return -1;
+	    }
+	    if (cc > 0) {
+		in += cc;
+		out += cc;
+	    }
+	}
+	if (cc <= 0) {
+	    if (cc == 0) errno = EIO;
+	    return -1;
+	}
+	len -= cc;
+    }
+    return 0;
+}
+
+static void *
+tier_main(void *arg)
+{
+    struct tierfile	*tf;
+    struct extent	ext;
+    char	*buf = NULL;
+    int		rc;
+
+    pthread_mutex_lock(&_inf.tierlock);
+    for (;;) {
+	for (tf = _inf.tiers; tf && tf->head == tf->cnt; tf = tf->next);
+	if (tf == NULL) {
+	    pthread_cond_wait(&_inf.tiercond, &_inf.tierlock);
+	    continue;
+	}
+	ext = tf->ext[tf->head];
+	tf->busy = 1;
+	pthread_mutex_unlock(&_inf.tierlock);
+	rc = tier_copy(tf, ext.off, ext.len, &buf);
+	pthread_mutex_lock(&_inf.tierlock);
+	if (rc < 0) {
+	    tf->err = errno;
+	    dbgprintf("%s: copy error at offset %ld, errno(%d)\n",
+		      __func__, (long) ext.off, errno);
+	}
+	DEBUG(DLEVEL_CONFIRM) {
+	    dbgprintf("%s: copied offset(%ld) len(%ld)\n",
+		      __func__, (long) ext.off, (long) ext.len);
+	}
+	tf->busy = 0;
+	if (++tf->head == tf->cnt) {
+	    tf->head = tf->cnt = 0;
+	    tf->end = 0;
+	}
+	if (tf->closed) {
+	    /* neither readers nor writers use the extent any longer */
+	    fallocate(tf->sfd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+		      ext.off, ext.len);
+	}
+	if (tf->closed && tf->cnt == 0) {
+	    tier_reap(tf);
+	}
+	pthread_cond_broadcast(&_inf.tierdone);
+    }
+    return NULL;
+}
+
+static void
+tier_exit(void)
+{
+    struct tierfile	*tf;
+
+    pthread_mutex_lock(&_inf.tierlock);
+    for (tf = _inf.tiers; tf; ) {
+	if (tf->cnt > 0) {
+	    pthread_cond_wait(&_inf.tierdone, &_inf.tierlock);
+	    tf = _inf.tiers;
+	} else {
+	    tf = tf->next;
+	}
+    }
+    pthread_mutex_unlock(&_inf.tierlock);
+}
+
+/*
+ * The staging file is created at the first write of blocks.  If it
+ * cannot be created, blocks are written to the file.
+ */
+static struct tierfile *
+tier_create(fdinfo *info)
+{
+    struct tierfile	*tf, **tpp;
+    struct stat64	sb;
+    char	path[PATH_MAX];
+
+    tf = calloc(1, sizeof(struct tierfile));
+    IOMIDDLE_IFERROR((tf == NULL), "%s", "Cannot allocate working memory\n");
+    pthread_mutex_lock(&_inf.tierlock);
+    snprintf(path, PATH_MAX, "%s/iomiddle.%d.%d",
+	     _inf.tierdir, (int) getpid(), _inf.tierseq++);
+    pthread_mutex_unlock(&_inf.tierlock);
+    tf->sfd = __real_open(path, O_CREAT|O_RDWR|O_TRUNC, 0600);
+    if (tf->sfd < 0 || sys_fstat64(info->iofd, &sb) < 0
+	|| (tf->rfd = dup(info->iofd)) < 0) {
+	dbgprintf("%s: cannot create staging file %s, errno(%d)\n",
+		  __func__, path, errno);
+	if (tf->sfd >= 0) {
+	    __real_close(tf->sfd);
+	    unlink(path);
+	}
+	free(tf);
+	info->notier = 1;
+	return NULL;
+    }
+    unlink(path);
+    DEBUG(DLEVEL_CONFIRM) {
+	dbgprintf("%s: fd(%d) staged in %s\n", __func__, info->iofd, path);
+    }
+    tf->dev = sb.st_dev;
+    tf->ino = sb.st_ino;
+    tf->strsize = info->strsize;
+    tf->naggr = info->naggr;
+    pthread_mutex_lock(&_inf.tierlock);
+    for (tpp = &_inf.tiers; *tpp; tpp = &(*tpp)->next);
+    *tpp = tf;
+    if (!_inf.tierthr) {
+	pthread_t	thr;
+	IOMIDDLE_IFERROR(
+	    (pthread_create(&thr, NULL, tier_main, NULL) != 0),
+	    "%s", "Cannot create the drainer thread\n");
+	pthread_detach(thr);
+	atexit(tier_exit);
+	_inf.tierthr = 1;
+    }
+    pthread_mutex_unlock(&_inf.tierlock);
+    return tf;
+}
+
+static void
+tier_add(struct tierfile *tf, off64_t off, off64_t len)
+{
+    struct extent	*ep;
+
+    pthread_mutex_lock(&_inf.tierlock);
+    ep = tf->cnt > 0 ? &tf->ext[tf->cnt - 1] : NULL;
+    if (ep && tf->cnt > tf->head + tf->busy && ep->off + ep->len == off) {
+	/* appended to the last extent not being copied */
+	ep->len += len;
+    } else {
+	if (tf->cnt == tf->max) {
+	    tf->max = tf->max ? tf->max*2 : 64;
+	    tf->ext = realloc(tf->ext, sizeof(struct extent)*tf->max);
+	    IOMIDDLE_IFERROR((tf->ext == NULL), "%s",
+			     "Cannot allocate working memory\n");
+	}
+	tf->ext[tf->cnt].off = off;
+	tf->ext[tf->cnt].len = len;
+	tf->cnt++;
+    }
+    if (off + len > tf->end) {
+	tf->end = off + len;
+    }
+    pthread_cond_signal(&_inf.tiercond);
+    pthread_mutex_unlock(&_inf.tierlock);
+}
+
+/*
+ * Waiting for the copies of extents of the file written so far.
+ * -1 is returned if any of them failed.
+ */
+static int
+tier_wait(struct tierfile *tf)
+{
+    int		rc;
+
+    pthread_mutex_lock(&_inf.tierlock);
+    while (tf->cnt > 0) {
+	pthread_cond_wait(&_inf.tierdone, &_inf.tierlock);
+    }
+    rc = tf->err ? -1 : 0;
+    tf->err = 0;
+    pthread_mutex_unlock(&_inf.tierlock);
+    return rc;
+}
+
+static struct tierfile *
+tier_lookup(dev_t dev, ino_t ino)
+{
+    struct tierfile	*tf;
+
+    for (tf = _inf.tiers; tf; tf = tf->next) {
+	if (tf->dev == dev && tf->ino == ino && tf->cnt > 0) {
+	    break;
+	}
+    }
+    return tf;
+}
+
+/*
+ * Before opening path for write, the copies of its previous writes by
+ * this process are completed so that they do not overwrite new data.
+ */
+static void
+tier_open(const char *path, int flags)
+{
+    struct tierfile	*tf;
+    struct stat64	sb;
+
+    if ((flags & O_ACCMODE) == O_RDONLY
+	|| __atomic_load_n(&_inf.tiers, __ATOMIC_ACQUIRE) == NULL
+	|| fstatat64(AT_FDCWD, path, &sb, 0) < 0) {
+	return;
+    }
+    pthread_mutex_lock(&_inf.tierlock);
+    while ((tf = tier_lookup(sb.st_dev, sb.st_ino)) != NULL) {
+	DEBUG(DLEVEL_CONFIRM) {
+	    dbgprintf("%s: waiting for %d copies of %s\n",
+		      __func__, tf->cnt - tf->head, path);
+	}
+	pthread_cond_wait(&_inf.tierdone, &_inf.tierlock);
+    }
+    pthread_mutex_unlock(&_inf.tierlock);
+}
+
+static void
+tier_close(fdinfo *info)
+{
+    struct tierfile	*tf = info->tier;
+
+    if (tf == NULL) {
+	return;
+    }
+    pthread_mutex_lock(&_inf.tierlock);
+    tf->closed = 1;
+    if (tf->cnt == 0) {
+	tier_reap(tf);
+    }
+    pthread_mutex_unlock(&_inf.tierlock);
+    info->tier = NULL;
+}
+
+/*
+ * Checking extents of the file not copied yet at the first read.  The
+ * largest end of them is reflected to *end.  1 is returned if they are
+ * not read by this process in the stripe mode, i.e., the stripe size or
+ * aggregators differ from the writes.
+ */
+static int
+tier_pending(fdinfo *info, long long *end)
+{
+    struct tierfile	*tf;
+    int		rc = 0;
+
+    if (__atomic_load_n(&_inf.tiers, __ATOMIC_ACQUIRE) == NULL) {
+	return 0;
+    }
+    pthread_mutex_lock(&_inf.tierlock);
+    if ((tf = tier_lookup(info->stdev, info->stino)) != NULL) {
+	if (tf->end > *end) *end = tf->end;
+	rc = (tf->strsize != info->strsize || tf->naggr != info->naggr);
+    }
+    pthread_mutex_unlock(&_inf.tierlock);
+    return rc;
+}
+
+static void
+tier_drain(fdinfo *info)
+{
+    struct tierfile	*tf;
+
+    pthread_mutex_lock(&_inf.tierlock);
+    while ((tf = tier_lookup(info->stdev, info->stino)) != NULL) {
+	pthread_cond_wait(&_inf.tierdone, &_inf.tierlock);
+    }
+    pthread_mutex_unlock(&_inf.tierlock);
+}
+
+/*
+ * Writing to the file, or its staging file in the tier
+ */
+static ssize_t
+file_pwrite(fdinfo *info, const void *buf, size_t len, off64_t off)
+{
+    ssize_t	cc;
+
+    if (info->tier == NULL && info->pol->tier && _inf.tierdir
+	&& !info->notier) {
+	info->tier = tier_create(info);
+    }
+    if (info->tier == NULL) {
+	return pwrite(info->iofd, buf, len, off);
+    }
+    cc = pwrite(info->tier->sfd, buf, len, off);
+    if (cc > 0) {
+	tier_add(info->tier, off, cc);
+    }
+    return cc;
+}
+
+/*
+ * Reading from the file.  Extents not copied yet by this process are
+ * read from its staging file.
+ */
+static ssize_t
+file_pread(fdinfo *info, void *buf, size_t len, off64_t off)
+{
+    struct tierfile	*tf;
+    ssize_t	cc;
+    off64_t	lo, hi;
+    int		i;
+
+    cc = pread(info->iofd, buf, len, off);
+    if (cc < 0 || __atomic_load_n(&_inf.tiers, __ATOMIC_ACQUIRE) == NULL) {
+	return cc;
+    }
+    pthread_mutex_lock(&_inf.tierlock);
+    if ((tf = tier_lookup(info->stdev, info->stino)) != NULL) {
+	for (i = tf->head; i < tf->cnt; i++) {
+	    lo = tf->ext[i].off > off ? tf->ext[i].off : off;
+	    hi = tf->ext[i].off + tf->ext[i].len;
+	    if (hi > off + (off64_t) len) hi = off + len;
+	    if (lo >= hi) continue;
+	    if (lo - off > cc) {
+		/* not written to the file yet */
+		memset((char*) buf + cc, 0, lo - off - cc);
+	    }
+	    if (pread(tf->sfd, (char*) buf + (lo - off), hi - lo, lo)
+		!= hi - lo) {
+		cc = -1;
+		break;
+	    }
+	    if (hi - off > cc) cc = hi - off;
+	}
+    }
+    pthread_mutex_unlock(&_inf.tierlock);
+    return cc;
+}
+
+/*
+ * Block cache (IOMIDDLE_CACHE):
+ *	Blocks read by an aggregator are kept in the LRU list up to the
+ *	budget, keyed by the file, its mtime at the first read, and the
+ *	offset and length of the block.  A block found there is scattered
+ *	without reading the file.  Entries of a file are dropped at open
+ *	and close for write, which are collective, so that all aggregators
+ *	drop theirs.
+ */
+#define CACHE_HASH	1024
+
+static inline int
+cache_hash(ino_t ino, off64_t off)
+{
+    uint64_t	h = ((uint64_t) ino ^ (uint64_t) off)*0x9e3779b97f4a7c15ULL;
+
+    return (int) ((h >> 32) % CACHE_HASH);
+}
+
+static void
+cache_unlink(struct blkent *ent)
+{
+    struct blkent	**pp = &_inf.cachehash[cache_hash(ent->ino, ent->off)];
+
+    while (*pp != ent) pp = &(*pp)->hnext;
+    *pp = ent->hnext;
+    if (ent->prev) ent->prev->next = ent->next;
+    else _inf.cachehead = ent->next;
+    if (ent->next) ent->next->prev = ent->prev;
+    else _inf.cachetail = ent->prev;
+    _inf.cacheused -= sizeof(*ent) + ent->cc;
+    free(ent);
+}
+
+static struct blkent *
+cache_find(fdinfo *info, off64_t off, size_t len)
+{
+    struct blkent	*ent;
+
+    for (ent = _inf.cachehash[cache_hash(info->stino, off)];
+	 ent; ent = ent->hnext) {
+	if (ent->ino == info->stino && ent->dev == info->stdev
+	    && ent->off == off && ent->len == len) {
+	    break;
+	}
+    }
+    return ent;
+}
+
+/*
+ * The block at off is copied to buf if cached.  Returns its length
+ * read from the file, or -1 if not cached.
+ */
+static ssize_t
+cache_get(fdinfo *info, off64_t off, size_t len, char *buf)
+{
+    struct blkent	*ent;
+    ssize_t	cc = -1;
+
+    pthread_mutex_lock(&_inf.cachelock);
+    if ((ent = cache_find(info, off, len)) != NULL
+	&& (ent->mtime.tv_sec != info->stmtim.tv_sec
+	    || ent->mtime.tv_nsec != info->stmtim.tv_nsec)) {
+	/* the file has been modified since */
+	cache_unlink(ent);
+	ent = NULL;
+    }
+    if (ent) {
+	if (ent != _inf.cachehead) {
+	    /* moved to the head */
+	    ent->prev->next = ent->next;
+	    if (ent->next) ent->next->prev = ent->prev;
+	    else _inf.cachetail = ent->prev;
+	    ent->prev = NULL;
+	    ent->next = _inf.cachehead;
+	    _inf.cachehead->prev = ent;
+	    _inf.cachehead = ent;
+	}
+	stage_copy(buf, ent->data, ent->cc, 0);
+	cc = ent->cc;
+    }
+    pthread_mutex_unlock(&_inf.cachelock);
+    DEBUG(DLEVEL_BUFMGR) {
+	dbgprintf("%s: offset(%ld) size(%ld) %s\n",
+		  __func__, off, len, cc < 0 ? "miss" : "hit");
+    }
+    return cc;
+}
+
+/*
+ * Keeping cc bytes of the block at off, whose length requested is len.
+ * Least recently used blocks are evicted to fit the budget.
+ */
+static void
+cache_put(fdinfo *info, off64_t off, size_t len, const char *buf, ssize_t cc)
+{
+    struct blkent	*ent, **hp;
+    size_t	need = sizeof(*ent) + cc;
+
+    if (need > _inf.cachemax) {
+	return;
+    }
+    pthread_mutex_lock(&_inf.cachelock);
+    if ((ent = cache_find(info, off, len)) != NULL) {
+	cache_unlink(ent);
+    }
+    while (_inf.cacheused + need > _inf.cachemax) {
+	cache_unlink(_inf.cachetail);
+    }
+    if ((ent = malloc(need)) == NULL) {
+	pthread_mutex_unlock(&_inf.cachelock);
+	return;
+    }
+    ent->dev = info->stdev;
+    ent->ino = info->stino;
+    ent->mtime = info->stmtim;
+    ent->off = off;
+    ent->len = len;
+    ent->cc = cc;
+    /* not read until the next pass */
+    stage_copy(ent->data, buf, cc, 1);
+    hp = &_inf.cachehash[cache_hash(ent->ino, off)];
+    ent->hnext = *hp;
+    *hp = ent;
+    ent->prev = NULL;
+    ent->next = _inf.cachehead;
+    if (_inf.cachehead) _inf.cachehead->prev = ent;
+    else _inf.cachetail = ent;
+    _inf.cachehead = ent;
+    _inf.cacheused += need;
+    pthread_mutex_unlock(&_inf.cachelock);
+}
+
+/*
+ * Dropping the blocks of the file, which is opened or closed for write
+ */
+static void
+cache_invalidate(fdinfo *info)
+{
+    struct blkent	*ent, *next;
+
+    if (__atomic_load_n(&_inf.cacheused, __ATOMIC_RELAXED) == 0) {
+	return;
+    }
+    pthread_mutex_lock(&_inf.cachelock);
+    for (ent = _inf.cachehead; ent; ent = next) {
+	next = ent->next;
+	if (ent->ino == info->stino && ent->dev == info->stdev) {
+	    cache_unlink(ent);
+	}
+    }
+    pthread_mutex_unlock(&_inf.cachelock);
+}
+
+/*
+ * Writing the non-zero pieces of buf at off.  Returns len on success.
+ */
+static ssize_t
+sparse_pwrite(fdinfo *info, const char *buf, size_t len, off64_t off)
+{
+    size_t	pos = 0, start, n;
+
+    for (start = 0; pos < len; ) {
+	n = SPARSE_GRAIN - (off + pos) % SPARSE_GRAIN;
+	if (n > len - pos) n = len - pos;
+	if (!is_zero(buf + pos, n)) {
+	    pos += n;
+	    if (pos < len) continue;
+	}
+	/* the run of non-zero pieces ends here */
+	if (pos > start) {
+	    if (file_pwrite(info, buf + start, pos - start, off + start)
+		!= pos - start) {
+		return -1;
+	    }
+	    MON_ADD(written, pos - start);
+	}
+	if (pos < len) pos += n;
+	start = pos;
+    }
+    return len;
+}
+
+/*
+ * CRC32C (Castagnoli) of stripes.  The checksum is computed while the
+ * data are copied between the user buffer and ubuf, so that the data
+ * are not read again.  SSE4.2 on x86 and the CRC extension of ARMv8
+ * are used if available.
+ */
+#define CRC_POLY	0x82f63b78U
+
+static uint32_t	crc_tab[256];
+
+static uint32_t
+crc_copy_sw(void *dst, const void *src, size_t len, uint32_t crc)
+{
+    const unsigned char	*sp = src;
+    size_t	i;
+
+    memcpy(dst, src, len);
+    for (i = 0; i < len; i++) {
+	crc = crc_tab[(crc ^ sp[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+#define CRC_HW
+__attribute__((target("sse4.2"))) static uint32_t
+crc_copy_hw(void *dst, const void *src, size_t len, uint32_t crc)
+{
+    const char	*sp = src;
+    char	*dp = dst;
+    uint64_t	c = crc, v;
+
+    for (; len >= sizeof(v); len -= sizeof(v)) {
+	memcpy(&v, sp, sizeof(v));
+	memcpy(dp, &v, sizeof(v));
+	c = __builtin_ia32_crc32di(c, v);
+	sp += sizeof(v); dp += sizeof(v);
+    }
+    crc = c;
+    for (; len > 0; len--) {
+	*dp++ = *sp;
+	crc = __builtin_ia32_crc32qi(crc, *sp++);
+    }
+    return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC_HW
+static uint32_t
+crc_copy_hw(void *dst, const void *src, size_t len, uint32_t crc)
+{
+    const char	*sp = src;
+    char	*dp = dst;
+    uint64_t	v;
+
+    for (; len >= sizeof(v); len -= sizeof(v)) {
+	memcpy(&v, sp, sizeof(v));
+	memcpy(dp, &v, sizeof(v));
+	crc = __crc32cd(crc, v);
+	sp += sizeof(v); dp += sizeof(v);
+    }
+    for (; len > 0; len--) {
+	*dp++ = *sp;
+	crc = __crc32cb(crc, *sp++);
+    }
+    return crc;
+}
+#endif
+
+static uint32_t	(*crc_copy_fn)(void *, const void *, size_t, uint32_t)
+    = crc_copy_sw;
+
+static void
+crc_init(void)
+{
+    uint32_t	c;
+    int		i, k;
+
+    for (i = 0; i < 256; i++) {
+	for (c = i, k = 0; k < 8; k++) {
+	    c = (c & 1) ? (c >> 1) ^ CRC_POLY : c >> 1;
+	}
+	crc_tab[i] = c;
+    }
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+	crc_copy_fn = crc_copy_hw;
+    }
+#elif defined(CRC_HW)
+    crc_copy_fn = crc_copy_hw;
+#endif
+}
+
+/*
+ * Copying len bytes from src to dst, and returning the CRC32C of them
+ */
+static inline uint32_t
+crc_copy(void *dst, const void *src, size_t len)
+{
+    return ~crc_copy_fn(dst, src, len, ~0U);
+}
+
+/*
+ * The checksum file of a care file is the path name suffixed by ".crc".
+ * After the header of CRC_HDRSIZE bytes, the magic and the stripe size,
+ * the record of the k-th stripe of the file, i.e., the one at offset
+ * k*strsize, is the CRC32C at CRC_HDRSIZE + 4*k in the native byte
+ * order.  Records of stripes not written are zero, and are not checked.
+ * The checksum file is accessed directly by each process.
+ */
+static void
+crc_open(fdinfo *info, const char *path)
+{
+    char	cpath[PATH_MAX];
+    int		flags;
+
+    info->crcfd = -1;
+    info->crcsize = 0;
+    if (!_inf.checksum || info->extmode || info->bcast || info->rma
+	|| _inf.adaptive || _inf.progress) {
+	return;
+    }
+    snprintf(cpath, PATH_MAX, "%s%s", path, CRC_SUFFIX);
+    if ((info->flags & O_ACCMODE) == O_RDONLY) {
+	flags = O_RDONLY;
+    } else {
+	flags = O_CREAT|O_WRONLY;
+	if (Myrank == 0 && info->trunc) flags |= O_TRUNC;
+    }
+    info->crcfd = __real_open(cpath, flags, 0644);
+    if (info->crcfd < 0) {
+	DEBUG(DLEVEL_CONFIRM) {
+	    dbgprintf("%s: no checksum file %s, errno(%d)\n",
+		      __func__, cpath, errno);
+	}
+	return;
+    }
+    info->crc = 1;
+}
+
+/*
+ * Checking the header of the checksum file, or writing it by rank 0
+ * at the first flush.
+ */
+static void
+crc_header(fdinfo *info, int rwmode)
+{
+    char	hdr[CRC_HDRSIZE];
+    int64_t	strsize = info->strsize;
+
+    memset(hdr, 0, CRC_HDRSIZE);
+    memcpy(hdr, CRC_MAGIC, sizeof(CRC_MAGIC));
+    memcpy(hdr + 8, &strsize, sizeof(strsize));
+    if (rwmode == MODE_WRITE) {
+	if (Myrank == 0
+	    && pwrite(info->crcfd, hdr, CRC_HDRSIZE, 0) != CRC_HDRSIZE) {
+	    dbgprintf("%s: cannot write the checksum file\n", __func__);
+	}
+    } else {
+	char	buf[CRC_HDRSIZE];
+	if (pread(info->crcfd, buf, CRC_HDRSIZE, 0) != CRC_HDRSIZE
+	    || memcmp(buf, hdr, CRC_HDRSIZE) != 0) {
+	    DEBUG(DLEVEL_CONFIRM) {
+		dbgprintf("%s: checksum file of another stripe size, "
+			  "not verified\n", __func__);
+	    }
+	    info->crc = 0;
+	}
+    }
+    info->crcsize = info->strsize;
+}
+
+/*
+ * Writing the records of a piece of block blk, whose stripes are
+ * written by blk_write_runs().  The record of the stripe of rank q + p
+ * has been gathered to recs[q + p] by the aggregator.
+ */
+static int
+crc_write_runs(fdinfo *info, off64_t blk, int *cnts, int q, int n,
+	       uint32_t *recs)
+{
+    int		p, r;
+    size_t	len;
+    off64_t	pos = CRC_HDRSIZE + ((off64_t)blk*Nprocs + q)*sizeof(uint32_t);
+    int		rc = 0;
+
+    for (p = 0; p < n; p = r) {
+	if (cnts[p] == 0) {
+	    r = p + 1;
+	    continue;
+	}
+	for (r = p + 1; r < n && cnts[r] > 0; r++);
+	len = (r - p)*sizeof(uint32_t);
+	if (pwrite(info->crcfd, recs + q + p, len,
+		   pos + p*sizeof(uint32_t)) != len) {
+	    rc = -1;
+	}
+    }
+    return rc;
+}
+
+/*
+ * Reading the records of all blocks in this round at buf_fill().
+ * The record of the i-th stripe of rank p is crcall[i*Nprocs + p].
+ */
+static void
+crc_read_round(fdinfo *info)
+{
+    size_t	len = sizeof(uint32_t)*Nprocs*info->mybufcount;
+    off64_t	pos = CRC_HDRSIZE
+		      + (off64_t)info->filcurb*Nprocs*sizeof(uint32_t);
+    ssize_t	cc;
+
+    if (info->crcsize == 0) {
+	crc_header(info, MODE_READ);
+	if (!info->crc) return;
+    }
+    cc = pread(info->crcfd, info->crcall, len, pos);
+    info->crcrecs = (cc > 0) ? cc/sizeof(uint32_t) : 0;
+}
+
+static void
+crc_close(fdinfo *info)
+{
+    if (info->crcfd >= 0) {
+	__real_close(info->crcfd);
+    }
+    free(info->crcs);
+    free(info->crcall);
+    info->crcs = 0;
+    info->crcall = 0;
+    info->crcfd = -1;
+}
+
+/*
+ * flags and mode are values specified by arguments
+ */
+static void stat_invalidate(fdinfo *info);
+static void append_init(fdinfo *info);
+static void srv_open(fdinfo *info, const char *path);
+static int srv_close(fdinfo *info);
+
+static void
+info_init(int fd, const char *path, int flags, int mode,
+	  const struct policy *pol)
+{
+    fdinfo	*info = fd_page(fd);
+
+    rank_init();
+    /* the previous owner of this fd number may be still in close */
+    pthread_mutex_lock(&info->lock);
+    info->attrall = 0;
+    info->iofd   = fd;
+    info->bufpos = 0;
+    info->filpos = 0;
+    info->wrend = 0;
+    info->bufcount = 0;
+    info->bufdone = 0;
+    info->syncerr = 0;
+    info->wrerr = 0;
+    info->wrote = 0;
+    info->flags    = flags;
+    info->mode   = mode;
+    info->trunc = (((flags|mode) & O_TRUNC) == O_TRUNC);
+    info->pol = pol;
+    info->append = ((flags & O_APPEND) && (flags & O_ACCMODE) != O_RDONLY);
+    info->extmode = (info->append || pol->mode == POLICY_EXTENT
+		     || (pol->mode == POLICY_BCAST && _inf.extmode));
+    info->bcast = ((flags & O_ACCMODE) == O_RDONLY
+		   && pol->mode == POLICY_BCAST);
+    info->rma = ((flags & O_ACCMODE) != O_RDONLY && pol->mode == POLICY_RMA
+		 && !info->append && !_inf.adaptive && !_inf.progress);
+    /* holes are left only in a file written from scratch */
+    info->sparse = ((flags & O_ACCMODE) != O_RDONLY && info->trunc
+		    && !info->extmode) ? pol->sparse : SPARSE_OFF;
+    info->naggr = info->depth = 0;
+    info->tier = NULL;
+    comm_assign(info, path);
+    crc_open(info, path);
+    info->server = (_inf.nservers > 0 && pol->server
+		    && (flags & O_ACCMODE) == O_WRONLY
+		    && !info->extmode && !info->rma && !info->crc
+		    && !_inf.adaptive && !_inf.progress);
+    if (info->server) {
+	srv_spawn();
+	info->server = (fd <= _inf.srvfdmax);
+    }
+    if (_inf.statcoll || _inf.tierdir || _inf.cachemax > 0) {
+	struct stat64	sb;
+	if (sys_fstat64(fd, &sb) == 0) {
+	    info->stdev = sb.st_dev;
+	    info->stino = sb.st_ino;
+	}
+    }
+    if (_inf.statcoll && info->trunc) {
+	stat_invalidate(info);
+    }
+    if ((flags & O_ACCMODE) != O_RDONLY) {
+	cache_invalidate(info);
+    }
+    if (info->append) {
+	pthread_mutex_lock(info->commlock);
+	append_init(info);
+	pthread_mutex_unlock(info->commlock);
+    }
+    if (info->server) {
+	pthread_mutex_lock(info->commlock);
+	srv_open(info, path);
+	pthread_mutex_unlock(info->commlock);
+    }
+    fd_setcare(fd, 1);
+    pthread_mutex_unlock(&info->lock);
+    pthread_mutex_lock(&_inf.statlock);
+    if (fd >= _inf.fdhigh) {
+	_inf.fdhigh = fd + 1;
+    }
+    pthread_mutex_unlock(&_inf.statlock);
+}
+
+/*
+ * Marking a file descriptor which is not taken care
+ */
+static void
+info_dontcare(int fd)
+{
+    if (fd < _inf.fdlimit) {
+	fd_setcare(fd, 0);
+    }
+}
+
+static void rma_init(fdinfo *info);
+
+static void
+buf_init(int fd, int strsize)
+{
+    fdinfo	*info = FDINFO(fd);
+    int	strcnt = Nprocs;
+    int	nbuf = info->depth > 0 ? info->depth : strcnt, ngrp = strcnt;
+    int	nubuf = (_inf.progress || info->server) ? 2 : 1; /* # of user buffers */
+    size_t	memlimit = info->pol->memlimit;
+
+    if (memlimit > 0
+	&& (size_t)strsize*((size_t)nubuf*nbuf + ngrp) > memlimit) {
+	/*
+	 * Memory bounded: nbuf stripes are buffered per round, and
+	 * a block is exchanged in pieces of ngrp stripes
+	 */
+	if (nbuf > memlimit/((nubuf + 1)*(size_t)strsize)) {
+	    nbuf = memlimit/((nubuf + 1)*(size_t)strsize);
+	}
+	if (nbuf < 1) nbuf = 1;
+	ngrp = (memlimit - (size_t)nubuf*nbuf*strsize)/strsize;
+	if (ngrp < 1) ngrp = 1;
+	if (ngrp > strcnt) ngrp = strcnt;
+    }
+    info->notfirst = 1;
+    info->strsize = strsize;
+    info->strcnt = strcnt;
+    info->strgrp = ngrp;
+    info->filoff = (off64_t)info->strsize*Myrank;
+    info->filblklen = (off64_t)strsize*strcnt;
+    if (info->rma) {
+	/* the window is the only buffer */
+	info->rmadepth = info->depth > 0 ? info->depth : _inf.rmadepth;
+	if (memlimit > 0 && info->rmadepth*info->filblklen > memlimit) {
+	    info->rmadepth = memlimit/info->filblklen;
+	    if (info->rmadepth < 1) info->rmadepth = 1;
+	}
+	rma_init(info);
+	return;
+    }
+    info->mybufcount = nbuf;
+    info->bufsize = (size_t)strsize*nbuf;
+    info->sbufsize = (size_t)strsize*ngrp;
+    info->ubuf = stage_alloc(info->bufsize);
+    if (info->server) {
+	/* blocks are assembled by the server */
+	info->sbufsize = 0;
+	info->spare = stage_alloc(info->bufsize);
+    } else {
+	info->sbuf = stage_alloc(info->sbufsize);
+    }
+    IOMIDDLE_IFERROR(
+	(info->ubuf == NULL
+	 || (info->server ? info->spare == NULL : info->sbuf == NULL)),
+	"%s", "Cannot allocate IO middleware buffer\n");
+    if (info->crc) {
+	info->crcs = malloc(sizeof(uint32_t)*nbuf);
+	/* records of all processes are read, but not exchanged in write */
+	info->crcall = (info->rwmode == MODE_WRITE) ? NULL
+		: malloc(sizeof(uint32_t)*nbuf*Nprocs);
+	IOMIDDLE_IFERROR((info->crcs == NULL
+			  || (info->rwmode != MODE_WRITE && info->crcall == NULL)),
+			 "%s", "Cannot allocate working memory\n");
+	memset(info->crcs, 0, sizeof(uint32_t)*nbuf);
+    }
+    if (info->sparse == SPARSE_SEND && !info->crc && !_inf.progress
+	&& !info->server) {
+	info->zwords = (nbuf + 31)/32;
+	info->zmap = calloc(info->zwords*(Nprocs + 1), sizeof(uint32_t));
+	IOMIDDLE_IFERROR((info->zmap == NULL), "%s",
+			 "Cannot allocate working memory\n");
+	info->zall = info->zmap + info->zwords;
+    }
+    info->filcurb = 0;
+    info->filsize = -1;
+    DEBUG(DLEVEL_BUFMGR) {
+	dbgprintf("%s: strsize = %d mybufcount = %d strgrp = %d\n",
+		  __func__, info->strsize, info->mybufcount, info->strgrp);
+    }
+}
+
+/*
+ * RMA mode:
+ *	The k-th stripe of each process is the block k, which is handled
+ *	by rank k % nprocs as in the stripe mode.  A process puts the
+ *	stripe into the slot of the block in the window of the aggregator,
+ *	and adds one to the arrival counter of the slot.  The aggregator
+ *	writes its blocks in order once all stripes arrive, which is
+ *	checked whenever it issues write, fsync or close.  Before putting,
+ *	a process checks the # of blocks written by the aggregator so that
+ *	the slot is free.
+ *	A process publishes the # of bytes of its stripes to the ends of
+ *	all aggregators before its short last stripe is counted, or at
+ *	close.  A block beyond the end of some processes is written for
+ *	the stripes within the ends once they arrive.
+ *	  window: | counter[depth] | # of written blocks | end[nprocs]
+ *		  | slot[depth] |
+ */
+#define RMA_DONE(info)	((MPI_Aint) sizeof(long long)*(info)->rmadepth)
+#define RMA_END(info)	((MPI_Aint) sizeof(long long)*((info)->rmadepth + 1))
+#define RMA_DATA(info)	((MPI_Aint) sizeof(long long)*((info)->rmadepth + 1 \
+							+ Nprocs))
+
+static int blk_write_runs(fdinfo *info, char *blk, int *cnts, int n,
+			  size_t strsize, off64_t filpos, int sparse);
+
+static void
+rma_init(fdinfo *info)
+{
+    MPI_Aint	size = RMA_DATA(info) + (MPI_Aint) info->filblklen*info->rmadepth;
+
+    info->filcurb = 0;
+    info->rmanext = 0;
+    info->rmaend = 0;
+    info->rmadone = calloc(Nprocs, sizeof(long long));
+    info->rmacnts = malloc(sizeof(int)*Nprocs);
+    IOMIDDLE_IFERROR((info->rmadone == NULL || info->rmacnts == NULL), "%s",
+		     "Cannot allocate working memory\n");
+    MPI_CALL(MPI_Win_allocate(size, 1, MPI_INFO_NULL, info->comm,
+			      &info->wbase, &info->win));
+    memset(info->wbase, 0, RMA_DATA(info));
+    MPI_CALL(MPI_Win_lock_all(MPI_MODE_NOCHECK, info->win));
+    /* counters are cleared before any put */
+    MPI_CALL(MPI_Barrier(info->comm));
+    DEBUG(DLEVEL_BUFMGR) {
+	dbgprintf("%s: strsize = %d depth = %d\n",
+		  __func__, info->strsize, info->rmadepth);
+    }
+}
+
+/*
+ * Publishing the end of nstr stripes of this process, the last of
+ * which is taillen bytes if short, to all aggregators.  An end is kept
+ * plus one so that zero is unknown.
+ */
+static void
+rma_publish(fdinfo *info, off64_t nstr)
+{
+    long long	end;
+    int		p;
+
+    end = (long long) nstr*info->strsize + 1;
+    if (info->taillen) {
+	end -= info->strsize - info->taillen;
+    }
+    for (p = 0; p < Nprocs; p++) {
+	MPI_CALL(MPI_Put(&end, 1, MPI_LONG_LONG, p,
+			 RMA_END(info) + (MPI_Aint) Myrank*sizeof(long long),
+			 1, MPI_LONG_LONG, info->win));
+    }
+    MPI_CALL(MPI_Win_flush_all(info->win));
+    info->rmaend = 1;
+}
+
+/*
+ * Stripe lengths of block blk by the ends published to this aggregator.
+ * The # of stripes is returned, and *full is set if all processes have
+ * full stripes in the block.
+ */
+static int
+rma_counts(fdinfo *info, off64_t blk, int *full)
+{
+    long long	*end = (long long*) (info->wbase + RMA_END(info));
+    long long	rest;
+    int		p, n = 0;
+
+    *full = 1;
+    for (p = 0; p < Nprocs; p++) {
+	rest = end[p] ? end[p] - 1 - (long long) blk*info->strsize
+	    : info->strsize;
+	if (rest > info->strsize) rest = info->strsize;
+	if (rest < 0) rest = 0;
+	info->rmacnts[p] = rest;
+	if (rest > 0) n++;
+	if (rest < info->strsize) *full = 0;
+    }
+    return n;
+}
+
+/*
+ * Writing blocks of this aggregator whose stripes have all arrived
+ */
+static void
+rma_progress(fdinfo *info)
+{
+    long long	cnt, zero = 0, one = 1, old;
+    uint64_t	t0;
+    ssize_t	cc;
+    int		n, full;
+
+    for (;;) {
+	MPI_Aint	slot = info->rmanext % info->rmadepth;
+	off64_t		blk = (off64_t) info->rmanext*Nprocs + Myrank;
+	char		*sp = info->wbase + RMA_DATA(info) + slot*info->filblklen;
+
+	MPI_CALL(MPI_Fetch_and_op(NULL, &cnt, MPI_LONG_LONG, Myrank,
+				  slot*sizeof(long long), MPI_NO_OP,
+				  info->win));
+	MPI_CALL(MPI_Win_flush(Myrank, info->win));
+	/* the ends published before the stripes were counted */
+	MPI_CALL(MPI_Win_sync(info->win));
+	n = rma_counts(info, blk, &full);
+	if (n == 0 || cnt < n) {
+	    break;
+	}
+	DEBUG(DLEVEL_BUFMGR) {
+	    dbgprintf("%s: writing blk#(%ld) slot(%ld) stripes(%d)\n",
+		      __func__, blk, slot, n);
+	}
+	t0 = mon_now();
+	if (!full) {
+	    /* stripes within the ends of processes */
+	    cc = blk_write_runs(info, sp, info->rmacnts, Nprocs,
+				info->strsize, blk*info->filblklen,
+				info->sparse) < 0 ? -1 : info->filblklen;
+	} else if (info->sparse) {
+	    cc = sparse_pwrite(info, sp, info->filblklen,
+			       blk*info->filblklen);
+	} else {
+	    cc = file_pwrite(info, sp, info->filblklen, blk*info->filblklen);
+	    MON_ADD(written, info->filblklen);
+	}
+	if (cc != info->filblklen) {
+	    dbgprintf("%s: write error\n", __func__);
+	    info->wrerr = 1;
+	}
+	MON_SINCE(write_nsec, t0);
+	info->dirty = 1;
+	MPI_CALL(MPI_Fetch_and_op(&zero, &old, MPI_LONG_LONG, Myrank,
+				  slot*sizeof(long long), MPI_REPLACE,
+				  info->win));
+	MPI_CALL(MPI_Fetch_and_op(&one, &old, MPI_LONG_LONG, Myrank,
+				  RMA_DONE(info), MPI_SUM, info->win));
+	MPI_CALL(MPI_Win_flush(Myrank, info->win));
+	info->rmanext++;
+    }
+}
+
+/*
+ * Putting a stripe of len bytes.  A short one is the last stripe of
+ * this process, whose end is published before it is counted.
+ */
+static void
+rma_put(fdinfo *info, const void *buf, size_t len)
+{
+    off64_t	blk = info->filcurb;
+    int		root = blk % Nprocs;
+    long long	k = blk/Nprocs, one = 1, old;
+    MPI_Aint	slot = k % info->rmadepth;
+
+    uint64_t	t0 = mon_now();
+
+    /* the slot is free once the aggregator wrote the previous block */
+    while (k >= info->rmadone[root] + info->rmadepth) {
+	MPI_CALL(MPI_Fetch_and_op(NULL, &info->rmadone[root], MPI_LONG_LONG,
+				  root, RMA_DONE(info), MPI_NO_OP, info->win));
+	MPI_CALL(MPI_Win_flush(root, info->win));
+	rma_progress(info);
+    }
+    MPI_CALL(MPI_Put(buf, len, MPI_BYTE, root,
+		     RMA_DATA(info) + slot*info->filblklen
+		     + (MPI_Aint) Myrank*info->strsize,
+		     len, MPI_BYTE, info->win));
+    MPI_CALL(MPI_Win_flush(root, info->win));
+    if (len < info->strsize) {
+	rma_publish(info, blk + 1);
+    }
+    MPI_CALL(MPI_Fetch_and_op(&one, &old, MPI_LONG_LONG, root,
+			      slot*sizeof(long long), MPI_SUM, info->win));
+    MPI_CALL(MPI_Win_flush(root, info->win));
+    MON_SINCE(xchg_nsec, t0);
+    info->filcurb++;
+    rma_progress(info);
+}
+
+/*
+ * Collective: waiting until this aggregator writes the blocks which all
+ * processes have reached, or at close (last), all blocks after the ends
+ * are published.  Blocks are written while waiting for others, which
+ * may still put stripes.
+ */
+static void
+rma_drain(fdinfo *info, int last)
+{
+    long long	nblk = info->filcurb, gblk;
+    MPI_Request	req;
+    int		flag;
+
+    if (last && !info->rmaend) {
+	rma_publish(info, info->filcurb);
+    }
+    MPI_CALL(MPI_Iallreduce(&nblk, &gblk, 1, MPI_LONG_LONG,
+			    last ? MPI_MAX : MPI_MIN, info->comm, &req));
+    do {
+	rma_progress(info);
+	MPI_CALL(MPI_Test(&req, &flag, MPI_STATUS_IGNORE));
+    } while (!flag);
+    if (gblk > 0) {
+	/* aggregators have written blocks since the stat of rank 0 */
+	stat_invalidate(info);
+    }
+    while ((long long) info->rmanext*Nprocs + Myrank < gblk) {
+	rma_progress(info);
+    }
+}
+
+static void
+rma_fin(fdinfo *info)
+{
+    rma_drain(info, 1);
+    MPI_CALL(MPI_Win_unlock_all(info->win));
+    MPI_CALL(MPI_Win_free(&info->win));
+    free(info->rmadone);
+    free(info->rmacnts);
+    info->rmadone = 0;
+    info->rmacnts = 0;
+    info->wbase = 0;
+}
+
+/*
+ * Checking if this file descriptor is controlled by this middleware.
+ */
+static void adapt_deviate(fdinfo *info);
+
+static inline int
+dontcare_mode_check(int fd, int mode)
+{
+    if (is_dontcare_fd(fd) || FDINFO(fd)->iofd == 0) {
+	return 1;
+    }
+    if (FDINFO(fd)->rwmode == MODE_UNKNOWN) {
+	FDINFO(fd)->rwmode = mode;
+    }
+    IOMIDDLE_IFUNFIT((FDINFO(fd)->rwmode != mode),
+		     adapt_deviate(FDINFO(fd)),
+		     "%s", "read and write issued\n");
+    return 0;
+}
+
+/*
+ * Adaptive mode:
+ *	Whether aggregation pays off for this file is collectively decided
+ *	at the first access.  Each process tells if its first access fits
+ *	the stripe pattern and its stripe size.
+ */
+static void
+adapt_decide(int fd, int fit, size_t strsize)
+{
+    fdinfo	*info = FDINFO(fd);
+    long long	val[3], gval[3];
+    struct stat64 sb;
+
+    val[0] = !fit;
+    val[1] = strsize;
+    val[2] = -(long long) strsize;
+    if (fit && info->rwmode == MODE_READ
+	&& sys_fstat64(info->iofd, &sb) == 0 && sb.st_size < strsize*Nprocs) {
+	/* tiny file: not even one block */
+	val[0] = 1;
+    }
+    MPI_CALL(MPI_Allreduce(val, gval, 3, MPI_LONG_LONG, MPI_MAX,
+			   info->comm));
+    if (gval[0] || gval[1] != -gval[2]
+	|| gval[1] >= info->pol->bypass_size || Nprocs == 1) {
+	info->bypass = 1;
+    }
+    DEBUG(DLEVEL_CONFIRM) {
+	if (Myrank == 0) {
+	    dbgprintf("%s: fd(%d) %s (unfit(%lld) strsize(%lld, %lld))\n",
+		      __func__, fd, info->bypass ? "bypass" : "aggregate",
+		      gval[0], -gval[2], gval[1]);
+	}
+    }
+}
+
+/*
+ * This process deviates from the expected pattern.  The stripes buffered
+ * so far are written by this process to keep the order of writes.  At
+ * its next read or write, it joins the collective which the others issue
+ * next, i.e., the flush of this round in write, or the check at the
+ * beginning of the next round in read, see adapt_check(), where all
+ * processes agree to fall back to direct calls.  The number of its calls
+ * may differ from the others.
+ */
+static void
+adapt_deviate(fdinfo *info)
+{
+    int		i;
+    size_t	strsize = info->strsize;
+    off64_t	filpos;
+
+    if (info->deviant || info->bypass) return;
+    DEBUG(DLEVEL_CONFIRM) {
+	dbgprintf("%s: fd(%d) filpos(%ld) bufcount(%d)\n",
+		  __func__, info->iofd, info->filpos, info->bufcount);
+    }
+    if (info->notfirst && info->rwmode == MODE_WRITE) {
+	for (i = info->bufdone; i < info->bufcount; i++) {
+	    filpos = (info->filcurb + i)*info->filblklen + Myrank*strsize;
+	    if (pwrite(info->iofd, info->ubuf + i*strsize, strsize, filpos)
+		!= strsize) {
+		dbgprintf("%s: write error\n", __func__);
+		info->wrerr = 1;
+	    }
+	    if (filpos + (off64_t) strsize > info->wrend) {
+		info->wrend = filpos + strsize;
+	    }
+	    info->dirty = 1;
+	}
+    }
+    info->deviant = 1;
+}
+
+/*
+ * Whether a process has deviated is checked by all processes at the
+ * beginning of each read round and at close.
+ */
+static void
+adapt_check(fdinfo *info)
+{
+    int	dev = info->deviant, gdev;
+
+    MPI_CALL(MPI_Allreduce(&dev, &gdev, 1, MPI_INT, MPI_MAX, info->comm));
+    if (gdev) {
+	info->bypass = 1;
+    }
+}
+
+static size_t buf_flush(fdinfo *info, int endround, int last);
+
+/*
+ * A deviated process joins the next collective of the others at once,
+ * which depends on the mode of the file, not on its call.
+ */
+static void
+adapt_join(fdinfo *info)
+{
+    if (info->rwmode == MODE_WRITE) {
+	buf_flush(info, 1, 0);
+    } else if (info->rwmode == MODE_READ) {
+	adapt_check(info);
+    }
+}
+
+/*
+ * The last write of a process may be shorter than the stripe size,
+ * e.g., the file size is not a multiple of the block length.
+ */
+static inline int
+is_tail_stripe(int fd, size_t len)
+{
+    fdinfo	*info = FDINFO(fd);
+
+    return len < info->strsize && info->rwmode == MODE_WRITE
+	&& !_inf.adaptive;
+}
+
+/*
+ * Access pattern detection (IOMIDDLE_DETECT).  The first access of all
+ * processes, (offset, length), are exchanged at the first read or
+ * write, where lseek issued before it only moves the file position.
+ *	strided:   every process accesses the same length, and process r
+ *		   at base + r*length, where base is a multiple of the
+ *		   block length.  The stripe mode is used.
+ *	blocked:   offsets increase with rank without overlapping, e.g.,
+ *		   each process accesses its own contiguous region.
+ *	irregular: otherwise.
+ * Files of the last two are written in the extent mode, and read by
+ * direct calls.
+ */
+#define PATTERN_STRIDED		0
+#define PATTERN_BLOCKED		1
+#define PATTERN_IRREGULAR	2
+
+static const char *pattern_name[] = { "strided", "blocked", "irregular" };
+
+static int
+pattern_detect(int fd, size_t len)
+{
+    fdinfo	*info = FDINFO(fd);
+    long long	mine[2], *all;
+    long long	base, slen;
+    int		p, pattern = PATTERN_STRIDED;
+
+    all = malloc(sizeof(long long)*2*Nprocs);
+    IOMIDDLE_IFERROR((all == NULL), "%s", "Cannot allocate working memory\n");
+    mine[0] = info->filpos;
+    mine[1] = len;
+    MPI_CALL(MPI_Allgather(mine, 2, MPI_LONG_LONG, all, 2, MPI_LONG_LONG,
+			   info->comm));
+    base = all[0];
+    slen = all[1];
+    if (slen <= 0 || base % (slen*Nprocs) != 0
+	|| (info->rma && base != 0)) {
+	pattern = PATTERN_IRREGULAR;
+    }
+    for (p = 0; p < Nprocs && pattern == PATTERN_STRIDED; p++) {
+	if (all[2*p + 1] != slen || all[2*p] != base + p*slen) {
+	    pattern = PATTERN_IRREGULAR;
+	}
+    }
+    if (pattern != PATTERN_STRIDED) {
+	pattern = PATTERN_BLOCKED;
+	for (p = 1; p < Nprocs; p++) {
+	    if (all[2*(p - 1)] + all[2*(p - 1) + 1] > all[2*p]) {
+		pattern = PATTERN_IRREGULAR;
+		break;
+	    }
+	}
+    }
+    free(all);
+    DEBUG(DLEVEL_CONFIRM) {
+	if (Myrank == 0) {
+	    dbgprintf("%s: fd(%d) %s pattern (offset(%lld) length(%lld))\n",
+		      __func__, fd, pattern_name[pattern], base, slen);
+	}
+    }
+    if (pattern == PATTERN_STRIDED) {
+	if (_inf.adaptive) {
+	    adapt_decide(fd, 1, slen);
+	    if (info->bypass) {
+		info->notfirst = 1;
+		return pattern;
+	    }
+	}
+	buf_init(fd, slen);
+	if (!info->rma) {
+	    info->filcurb = base/(slen*Nprocs);
+	}
+    } else {
+	info->extmode = 1;
+	info->notfirst = 1;
+	if (info->server) {
+	    /* written by the processes themselves */
+	    srv_close(info);
+	}
+    }
+    return pattern;
+}
+
+/*
+ *  Stripe size is checked or determined
+ */
+static inline int
+stripe_check_init(int fd, size_t len, int lseek)
+{
+    int	rc = 0;
+    int	strsize;
+    int	fit = 1;
+    if (!FDINFO(fd)->notfirst) {
+	if (_inf.detect) {
+	    /* detected at the first read or write, see pattern_detect() */
+	    goto ext;
+	}
+	if (lseek) {
+	    if (Myrank == 0) {
+		/* len == 0 OK, strsize will be determined at the first read/write call  */
+		if (len == 0) goto ext;
+		IOMIDDLE_IFUNFIT(1, fit = 0, "%s",
+			 "lseek is issued before write/read on rank 0\n");
+		strsize = len;
+	    } else {
+		strsize = len/Myrank;
+	    }
+	} else {
+	    IOMIDDLE_IFUNFIT((Myrank != 0), fit = 0, /* unexpected usage ! */
+			     "write/read is issued before lseek offset(%ld)\n",
+			     len);
+	    strsize = len;
+	}
+	IOMIDDLE_IFUNFIT((strsize == 0
+		  || (Myrank != 0 && ((len/Myrank)*Myrank != len))), fit = 0,
+			 "lseek offset is expected multiple of rank, "
+			 "requested offset is %ld on rank %d\n",
+			 len, Myrank);
+	if (_inf.adaptive) {
+	    adapt_decide(fd, fit && !FDINFO(fd)->deviant, strsize);
+	    if (FDINFO(fd)->bypass) {
+		FDINFO(fd)->notfirst = 1;
+		goto ext;
+	    }
+	}
+	buf_init(fd, strsize);
+    } else {
+	if (lseek == 0 && len != FDINFO(fd)->strsize
+	    && !FDINFO(fd)->bypass && !is_tail_stripe(fd, len)) {
+	    if (_inf.adaptive) {
+		adapt_deviate(FDINFO(fd));
+	    } else {
+		dbgprintf("read/write size must be always stripe size: "
+			  "stripe size(%ld), requested size(%d)\n",
+			  len, FDINFO(fd)->strsize);
+		rc = -1;
+	    }
+	}
+    }
+ext:
+    return rc;
+}
+
+/*
+ * Writing a piece of block, which consists of n stripes.
+ * The stripe of the i-th process in the piece has cnts[i] bytes.
+ * Contiguous stripes are written at once.
+ */
+static int
+blk_write_runs(fdinfo *info, char *blk, int *cnts, int n, size_t strsize,
+	       off64_t filpos, int sparse)
+{
+    int		p, q;
+    size_t	len;
+    int		rc = 0;
+    uint64_t	t0 = mon_now();
+
+    for (p = 0; p < n; p = q) {
+	if (cnts[p] == 0) {
+	    q = p + 1;
+	    continue;
+	}
+	for (q = p + 1; q < n && cnts[q] > 0 && cnts[q - 1] == strsize; q++);
+	len = (q - p - 1)*strsize + cnts[q - 1];
+	if (sparse) {
+	    if (sparse_pwrite(info, blk + p*strsize, len,
+			      filpos + p*strsize) != len) {
+		rc = -1;
+	    }
+	    continue;
+	}
+	if (file_pwrite(info, blk + p*strsize, len, filpos + p*strsize) != len) {
+	    rc = -1;
+	}
+	MON_ADD(written, len);
+    }
+    MON_SINCE(write_nsec, t0);
+    return rc;
+}
+
+/*
+ * Counts of this process exchanged before flushing a round, and their
+ * summary reduced first.  Stripes of deviated processes have been
+ * written by themselves (adaptive mode).
+ */
+static void
+flush_mine(fdinfo *info, int last, int *mine, int *sum)
+{
+    mine[FV_CNT] = info->deviant ? 0 : info->bufcount;
+    mine[FV_DEV] = info->deviant;
+    mine[FV_TAIL] = (info->taillen && mine[FV_CNT] > 0) ? info->taillen : 0;
+    mine[FV_LAST] = last;
+    sum[FS_MAX] = mine[FV_CNT];
+    sum[FS_MIN] = -mine[FV_CNT];
+    sum[FS_ODD] = mine[FV_DEV] || mine[FV_TAIL];
+    sum[FS_NLAST] = -last;
+}
+
+/*
+ * Scanning the summary reduced over processes.  If every process
+ * exchanges the same number of full stripes, the number is returned
+ * without gathering the counts of all processes.  Otherwise -1 is
+ * returned, and the counts are gathered for flush_scan().
+ */
+static int
+flush_sum(fdinfo *info, int *sum)
+{
+    if (sum[FS_MAX] != -sum[FS_MIN] || sum[FS_ODD]) {
+	return -1;
+    }
+    info->lastall = -sum[FS_NLAST];
+    if (sum[FS_MAX] > 0) {
+	stat_invalidate(info);
+    }
+    return sum[FS_MAX];
+}
+
+/*
+ * Scanning the counts of all processes.  The number of stripes to be
+ * exchanged is returned.  *regular is set if every process exchanges
+ * the same number of full stripes, so that no count is needed.  The
+ * stat cache of rank 0 is dropped if the round writes the file.
+ */
+static int
+flush_scan(fdinfo *info, int *valid, int *regular, int *deviant)
+{
+    int	p, maxcnt = 0, lastall = 1;
+
+    *regular = 1;
+    *deviant = 0;
+    for (p = 0; p < Nprocs; p++) {
+	int	*v = valid + FV_NUM*p;
+	if (v[FV_CNT] > maxcnt) maxcnt = v[FV_CNT];
+	if (v[FV_CNT] != valid[FV_CNT] || v[FV_DEV] || v[FV_TAIL]) {
+	    *regular = 0;
+	}
+	*deviant |= v[FV_DEV];
+	lastall &= v[FV_LAST];
+    }
+    info->lastall = lastall;
+    if (maxcnt > 0 || *deviant) {
+	stat_invalidate(info);
+    }
+    return maxcnt;
+}
+
+/*
+ * Aggregator of block blk.  Blocks are handled by all processes in
+ * turn, or by naggr processes evenly spaced in rank order if hinted
+ * by iomiddle_open.
+ */
+static inline int
+blk_root(fdinfo *info, off64_t blk)
+{
+    if (info->naggr > 0 && info->naggr < Nprocs) {
+	return (int) (blk % info->naggr)*(Nprocs/info->naggr);
+    }
+    return (int) (blk % Nprocs);
+}
+
+/*
+ * Receive counts of the piece of stripe i, which consists of n stripes
+ * from rank q.  Only stripes written by processes are exchanged, and
+ * the short last stripe is exchanged for its length.  All-zero stripes
+ * are not exchanged with SPARSE_SEND.
+ */
+static void
+stripe_counts(fdinfo *info, int *valid, int i, int q, int n,
+	      int *rcnts, int *rdsps)
+{
+    int	p;
+
+    for (p = 0; p < Nprocs; p++) {
+	int	*v = valid ? valid + FV_NUM*p : NULL;
+	rcnts[p] = 0;
+	if (p >= q && p < q + n && (v == NULL || v[FV_CNT] > i)) {
+	    rcnts[p] = (v && v[FV_TAIL] && i == v[FV_CNT] - 1) ?
+		v[FV_TAIL] : info->strsize;
+	    if (info->zmap && ZBIT(info->zall + p*info->zwords, i)) {
+		/* all-zero stripe left as a hole */
+		rcnts[p] = 0;
+	    }
+	}
+	rdsps[p] = rcnts[p] ? (p - q)*info->strsize : 0;
+    }
+}
+
+/*
+ * Whether the i-th stripe of any process is all zero (SPARSE_SEND)
+ */
+static int
+zero_any(fdinfo *info, int i)
+{
+    int	p;
+
+    if (info->zmap == NULL) {
+	return 0;
+    }
+    for (p = 0; p < Nprocs; p++) {
+	if (ZBIT(info->zall + p*info->zwords, i)) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Flushing the stripes buffered in this round.  If endround is zero,
+ * the round is kept for the following stripes (sync).  last is set at
+ * close, where processes may have written different numbers of stripes.
+ */
+static size_t
+buf_flush(fdinfo *info, int endround, int last)
+{
+    size_t	cc = 0;
+    int	i, p, q, n;
+    size_t	off;
+    size_t	strsize = info->strsize;
+    size_t	blksize = info->filblklen;
+    int		ngrp = info->strgrp;
+    int		*valid, *rcnts, *rdsps;
+    int		mine[FV_NUM], sum[FS_NUM];
+    int		maxcnt, regular = 1, deviant = 0;
+    uint32_t	*recs;
+    uint64_t	t0;
+
+    MON_ADD(inflush, 1);
+    rcnts = malloc(sizeof(int)*Nprocs*(3 + FV_NUM));
+    IOMIDDLE_IFERROR((rcnts == NULL), "%s",
+		     "Cannot allocate working memory\n");
+    rdsps = rcnts + Nprocs;
+    valid = rdsps + Nprocs;
+    recs = (uint32_t*) (valid + FV_NUM*Nprocs);
+    flush_mine(info, last, mine, sum);
+    t0 = mon_now();
+    MPI_CALL(MPI_Allreduce(MPI_IN_PLACE, sum, FS_NUM, MPI_INT, MPI_MAX,
+			   info->comm));
+    if ((maxcnt = flush_sum(info, sum)) < 0) {
+	MPI_CALL(MPI_Allgather(mine, FV_NUM, MPI_INT, valid, FV_NUM, MPI_INT,
+			       info->comm));
+	maxcnt = flush_scan(info, valid, &regular, &deviant);
+    }
+    if (regular) {
+	valid = NULL;
+    }
+    if (info->crc && maxcnt > info->bufdone && info->crcsize == 0) {
+	crc_header(info, MODE_WRITE);
+    }
+    if (info->zmap && maxcnt > info->bufdone) {
+	/* all-zero stripes are not sent */
+	MPI_CALL(MPI_Allgather(info->zmap, info->zwords, MPI_UINT32_T,
+			       info->zall, info->zwords, MPI_UINT32_T,
+			       info->comm));
+    }
+    MON_SINCE(xchg_nsec, t0);
+    /*
+     * ubuf : user data buffer, contining stripe * bufcount
+     * sbuf : system data buffer, containing stripe * strgrp
+     * ubuf --> sbuf per stripe
+     *
+     * bufcount: # of strips has been written to the buffer
+     *   (mybufcount == bufcount): buffers are fulled over all processes
+     *   (mybufcount > bufcount):  the last round at closing or sync
+     *   bufcount may differ among processes at close.  Only the stripes
+     *   written are exchanged and written, see stripe_counts().
+     * bufdone: # of strips flushed by sync in this round
+     * Variables with prefix "fil" are file view
+     *   filpos:  pointer
+     *   filcurb: block number of the first stripe in this round
+     *		Each block is the maximum contiguous area in file view.
+     *		writing/reading to/from file is performed per block.
+     *		The i-th stripes of all processes are the block
+     *		filcurb + i, and is handled by rank (filcurb + i) % nprocs
+     *		unless the aggregators are hinted, see blk_root().
+     *		filcurb is advanced by mybufcount, not +1.
+     *   filblklen: block length (stripe size * nprocs)
+     *		stripe count is equal to nprocs
+     *  E.g.
+     *	         rank 0	  rank 1     rank 2     rank 3
+     *  ubuf   #0#1#2#3   #0#1#2#3   #0#1#2#3   #0#1#2#3
+     *         <------------- Exchange ---------------->
+     *	sbuf     blk#0	  blk#1	      blk#2	blk#3
+     *
+     * If the memory is bounded (IOMIDDLE_MEMLIMIT), mybufcount may be
+     * less than nprocs, and a block is exchanged and written in pieces
+     * of strgrp stripes.
+     */
+    off = info->bufdone*strsize;
+    for (i = info->bufdone; i < maxcnt; i++) {
+	off64_t	blk = info->filcurb + i;
+	int	root = blk_root(info, blk);
+	DEBUG(DLEVEL_BUFMGR) {
+	    data_show("ubuf", (int*) (info->ubuf + off), 5, off);
+	}
+	if (info->crc) {
+	    /* checksums of the block go to its aggregator only */
+	    MPI_CALL(MPI_Gather(&info->crcs[i], 1, MPI_UINT32_T,
+				recs, 1, MPI_UINT32_T, root, info->comm));
+	}
+	for (q = 0; q < Nprocs; q += ngrp) {
+	    n = (Nprocs - q < ngrp) ? Nprocs - q : ngrp;
+	    t0 = mon_now();
+	    if (valid == NULL && n == Nprocs && !zero_any(info, i)) {
+		MPI_CALL(
+		    MPI_Gather(info->ubuf + off, strsize, MPI_BYTE,
+			       info->sbuf, strsize, MPI_BYTE,
+			       root, info->comm));
+		for (p = 0; p < n; p++) rcnts[p] = strsize;
+	    } else {
+		int	scnt;
+		stripe_counts(info, valid, i, q, n, rcnts, rdsps);
+		scnt = rcnts[Myrank];
+		MPI_CALL(
+		    MPI_Gatherv(info->ubuf + off, scnt, MPI_BYTE,
+				info->sbuf, rcnts, rdsps, MPI_BYTE,
+				root, info->comm));
+	    }
+	    MON_SINCE(xchg_nsec, t0);
+	    if (Myrank == root) {
+		off64_t	filpos = (off64_t)blk*blksize + q*strsize;
+		DEBUG(DLEVEL_BUFMGR) {
+		    dbgprintf("writing size(%ld) filpos(%ld) blk#(%ld)\n",
+			      n*strsize, filpos, blk);
+		    /* showing the piece */
+		    for (p = 0; p < n*strsize; p += strsize) {
+			data_show("sbuf", (int*) (info->sbuf + p), 5, p);
+		    }
+		}
+		if (blk_write_runs(info, info->sbuf, rcnts + q, n,
+				   strsize, filpos, info->sparse) < 0) {
+		    cc = -1ULL;
+		}
+		if (info->crc
+		    && crc_write_runs(info, blk, rcnts + q, q, n, recs) < 0) {
+		    cc = -1ULL;
+		}
+		info->dirty = 1;
+	    }
+	}
+	off += strsize;
+    }
+    if (endround) {
+	info->filcurb += info->mybufcount;
+	info->bufcount = 0;
+	info->bufpos = 0;
+	info->bufdone = 0;
+    } else {
+	info->bufdone = info->bufcount;
+    }
+    if (deviant) {
+	/* all processes fall back to direct calls from now on */
+	DEBUG(DLEVEL_CONFIRM) {
+	    dbgprintf("%s: fd(%d) falls back to direct calls\n",
+		      __func__, info->iofd);
+	}
+	info->bypass = 1;
+    }
+    free(rcnts);
+    MON_ADD(inflush, -1);
+    MON_ADD(flushes, 1);
+    return cc;
+}
+
+/*
+ * Flushing the last round at close.  Processes having written fewer
+ * stripes keep taking part in flushes until every process comes here.
+ */
+static size_t
+buf_flush_last(fdinfo *info)
+{
+    size_t	cc = 0;
+
+    do {
+	if (buf_flush(info, 1, 1) == -1ULL) {
+	    cc = -1ULL;
+	}
+    } while (!info->lastall && !info->bypass);
+    return cc;
+}
+
+/*
+ * Reading the stripes of this round.  The i-th stripe is a part of block
+ * filcurb + i, which is read by rank (filcurb + i) % nprocs in pieces of
+ * strgrp stripes, and scattered to all processes.
+ */
+static void
+buf_fill(fdinfo *info)
+{
+    int	i, p, q, n;
+    size_t	strsize = info->strsize;
+    int		ngrp = info->strgrp;
+    int		*scnts, *sdsps;
+
+    scnts = malloc(sizeof(int)*Nprocs*2);
+    IOMIDDLE_IFERROR((scnts == NULL), "%s",
+		     "Cannot allocate working memory\n");
+    sdsps = scnts + Nprocs;
+    if (info->filsize < 0) {
+	/* the file size at the first read.  Other processes may be
+	 * still closing the file written by them. */
+	struct stat64	sb;
+	long long	fsz[2];
+	fsz[0] = (sys_fstat64(info->iofd, &sb) == 0) ? sb.st_size : -1;
+	fsz[1] = tier_pending(info, &fsz[0]);
+	MPI_CALL(MPI_Allreduce(MPI_IN_PLACE, fsz, 2, MPI_LONG_LONG, MPI_MAX,
+			       info->comm));
+	if (fsz[1]) {
+	    /* blocks not copied are read by other processes */
+	    tier_drain(info);
+	    fsz[0] = (sys_fstat64(info->iofd, &sb) == 0) ? sb.st_size : -1;
+	    MPI_CALL(MPI_Allreduce(MPI_IN_PLACE, fsz, 1, MPI_LONG_LONG,
+				   MPI_MAX, info->comm));
+	}
+	info->filsize = fsz[0];
+	if (info->pol->cache && _inf.cachemax > 0
+	    && sys_fstat64(info->iofd, &sb) == 0) {
+	    info->stdev = sb.st_dev;
+	    info->stino = sb.st_ino;
+	    info->stmtim = sb.st_mtim;
+	    info->cached = 1;
+	}
+    }
+    for (i = 0; i < info->mybufcount; i++) {
+	off64_t	blk = info->filcurb + i;
+	int	root = blk_root(info, blk);
+	for (q = 0; q < Nprocs; q += ngrp) {
+	    n = (Nprocs - q < ngrp) ? Nprocs - q : ngrp;
+	    if (Myrank == root) {
+		off64_t	filpos = (off64_t)blk*info->filblklen + q*strsize;
+		/* Though read opertaion returns error, other processes
+		 * may success. Thus error is checked by each process
+		 * using the file size */
+		ssize_t	cc = -1;
+		if (info->cached) {
+		    cc = cache_get(info, filpos, n*strsize, info->sbuf);
+		}
+		if (cc >= 0) {
+		    /* scattered from the cache */
+		} else if ((cc = file_pread(info, info->sbuf, n*strsize,
+					    filpos)) < 0) {
+		    dbgprintf("%s: read error\n", __func__);
+		} else {
+		    MON_ADD(read, cc);
+		    if (info->cached) {
+			cache_put(info, filpos, n*strsize, info->sbuf, cc);
+		    }
+		}
+	    }
+	    if (n == Nprocs) {
+		MPI_CALL(
+		    MPI_Scatter(info->sbuf, strsize, MPI_BYTE,
+				info->ubuf + i*strsize, strsize, MPI_BYTE,
+				root, info->comm));
+	    } else {
+		for (p = 0; p < Nprocs; p++) {
+		    scnts[p] = (p >= q && p < q + n) ? strsize : 0;
+		    sdsps[p] = scnts[p] ? (p - q)*strsize : 0;
+		}
+		MPI_CALL(
+		    MPI_Scatterv(info->sbuf, scnts, sdsps, MPI_BYTE,
+				 info->ubuf + i*strsize, scnts[Myrank],
+				 MPI_BYTE, root, info->comm));
+	    }
+	}
+    }
+    if (info->crc) {
+	crc_read_round(info);
+    }
+    free(scnts);
+}
+
+/*
+ * Progress thread:
+ *	A full user buffer of the stripe mode is queued as a job, and
+ *	the spare buffer is used by the application for the next round.
+ *	The thread drives all jobs by non-blocking collectives, and returns
+ *	the buffer as the spare one at completion.  The collectives are
+ *	posted on pcomm of the file, which no other thread uses, and
+ *	those of jobs sharing it are posted in the queued order.  While
+ *	requests are in flight, the thread polls them with a timed wait
+ *	for a new job, which gets longer while the application computes.
+ */
+static int
+prog_step(struct progjob *job)
+{
+    fdinfo	*info = job->info;
+    size_t	strsize = info->strsize;
+    int		ngrp = info->strgrp;
+    off64_t	blk;
+    int		root, n, p, q, flag;
+
+    while (!job->counted) {
+	int	regular, deviant, cnt;
+	if (!job->posted) {
+	    if (!job->summed) {
+		MON_ADD(inflush, 1);
+		MPI_CALL(
+		    MPI_Iallreduce(MPI_IN_PLACE, job->sum, FS_NUM, MPI_INT,
+				   MPI_MAX, info->pcomm, &job->req));
+	    } else {
+		MPI_CALL(
+		    MPI_Iallgather(job->mine, FV_NUM, MPI_INT,
+				   job->valid, FV_NUM, MPI_INT,
+				   info->pcomm, &job->req));
+	    }
+	    job->posted = 1;
+	}
+	MPI_CALL(MPI_Test(&job->req, &flag, MPI_STATUS_IGNORE));
+	if (!flag) {
+	    return 0;
+	}
+	job->posted = 0;
+	if (!job->summed) {
+	    /* the counts are gathered only if the round is irregular */
+	    job->summed = 1;
+	    if ((cnt = flush_sum(info, job->sum)) >= 0) {
+		job->bufcount = cnt;
+		job->valid = NULL;
+		job->counted = 1;
+	    }
+	    continue;
+	}
+	job->counted = 1;
+	job->bufcount = flush_scan(info, job->valid, &regular, &deviant);
+	if (regular) {
+	    job->valid = NULL;
+	}
+    }
+    while (job->stripe < job->bufcount) {
+	blk = job->filcurb + job->stripe;
+	root = blk_root(info, blk);
+	q = job->piece;
+	n = (Nprocs - q < ngrp) ? Nprocs - q : ngrp;
+	if (!job->posted) {
+	    char	*sp = job->ubuf + job->stripe*strsize;
+	    if (job->valid == NULL && n == Nprocs) {
+		MPI_CALL(
+		    MPI_Igather(sp, strsize, MPI_BYTE,
+				info->sbuf, strsize, MPI_BYTE,
+				root, info->pcomm, &job->req));
+		for (p = 0; p < n; p++) job->rcnts[p] = strsize;
+	    } else {
+		int	*rdsps = job->rcnts + Nprocs;
+		stripe_counts(info, job->valid, job->stripe, q, n,
+			      job->rcnts, rdsps);
+		MPI_CALL(
+		    MPI_Igatherv(sp, job->rcnts[Myrank], MPI_BYTE,
+				 info->sbuf, job->rcnts, rdsps, MPI_BYTE,
+				 root, info->pcomm, &job->req));
+	    }
+	    job->posted = 1;
+	}
+	MPI_CALL(MPI_Test(&job->req, &flag, MPI_STATUS_IGNORE));
+	if (!flag) {
+	    return 0;
+	}
+	job->posted = 0;
+	if (Myrank == root) {
+	    off64_t	filpos = (off64_t)blk*info->filblklen + q*strsize;
+	    int		*cnts = (n == Nprocs) ? job->rcnts : job->rcnts + q;
+	    if (blk_write_runs(info, info->sbuf, cnts, n,
+			       strsize, filpos, info->sparse) < 0) {
+		dbgprintf("%s: write error\n", __func__);
+		/* kept until close, and reported by syncs meanwhile */
+		info->wrerr = 1;
+	    }
+	    info->dirty = 1;
+	}
+	job->piece += ngrp;
+	if (job->piece >= Nprocs) {
+	    job->piece = 0;
+	    job->stripe++;
+	}
+    }
+    if (job->sync && !job->synced) {
+	if (!job->posted) {
+	    job->syncrc = info->wrerr ? -1 : 0;
+	    if (info->tier && tier_wait(info->tier) < 0) {
+		job->syncrc = -1;
+	    }
+	    if (info->dirty) {
+		job->syncrc |= (job->sync == 1) ?
+		    __real_fdatasync(info->iofd) : __real_fsync(info->iofd);
+		info->dirty = 0;
+	    }
+	    MPI_CALL(MPI_Iallreduce(MPI_IN_PLACE, &job->syncrc, 1, MPI_INT,
+				    MPI_MIN, info->pcomm, &job->req));
+	    job->posted = 1;
+	}
+	MPI_CALL(MPI_Test(&job->req, &flag, MPI_STATUS_IGNORE));
+	if (!flag) {
+	    return 0;
+	}
+	job->posted = 0;
+	job->synced = 1;
+    }
+    return 1;
+}
+
+static void *
+prog_main(void *arg)
+{
+    struct progjob	*job, *last, **jpp;
+    MPI_Comm	*busy = NULL;
+    int		nbusy, nbmax = 0, i, done;
+    long	poll = PROG_POLL_MIN;
+    struct timespec	ts;
+
+    pthread_mutex_lock(&_inf.progmtx);
+    for (;;) {
+	while (_inf.proghead == NULL) {
+	    pthread_cond_wait(&_inf.progcond, &_inf.progmtx);
+	}
+	/* jobs up to the tail are not modified by others */
+	last = _inf.progtail;
+	pthread_mutex_unlock(&_inf.progmtx);
+	done = 0; nbusy = 0;
+	for (job = _inf.proghead; ; job = job->next) {
+	    for (i = 0; i < nbusy && busy[i] != job->info->pcomm; i++);
+	    if (i == nbusy) {
+		/* no earlier job uses this communicator */
+		if (prog_step(job)) {
+		    done = 1;
+		} else {
+		    if (nbusy == nbmax) {
+			/* a communicator per file */
+			nbmax = nbmax ? nbmax*2 : 16;
+			busy = realloc(busy, sizeof(MPI_Comm)*nbmax);
+			IOMIDDLE_IFERROR((busy == NULL), "%s",
+					 "Cannot allocate working memory\n");
+		    }
+		    busy[nbusy++] = job->info->pcomm;
+		}
+	    }
+	    if (job == last) break;
+	}
+	if (!done) {
+	    pthread_mutex_lock(&_inf.progmtx);
+	    if (_inf.progtail == last) {
+		/* polled at once while the application waits */
+		poll = _inf.progwait ? PROG_POLL_MIN
+		    : (poll < PROG_POLL_MAX ? poll*2 : PROG_POLL_MAX);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += poll;
+		if (ts.tv_nsec >= 1000000000L) {
+		    ts.tv_sec++;
+		    ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&_inf.progcond, &_inf.progmtx, &ts);
+	    }
+	    continue;
+	}
+	poll = PROG_POLL_MIN;
+	pthread_mutex_lock(&_inf.progmtx);
+	_inf.progtail = NULL;
+	for (jpp = &_inf.proghead; (job = *jpp) != NULL; ) {
+	    if (job->counted && job->stripe == job->bufcount
+		&& job->synced == !!job->sync) {
+		if (job->ubuf) {
+		    job->info->spare = job->ubuf;
+		}
+		if (job->sync) {
+		    job->info->syncpend--;
+		    if (job->syncrc < 0) job->info->syncerr = 1;
+		}
+		job->info->njobs--;
+		MON_ADD(qdepth, -1);
+		MON_ADD(inflush, -1);
+		MON_ADD(flushes, 1);
+		*jpp = job->next;
+		free(job->rcnts);
+		free(job);
+	    } else {
+		_inf.progtail = job;
+		jpp = &job->next;
+	    }
+	}
+	pthread_cond_broadcast(&_inf.progdone);
+    }
+    return arg;
+}
+
+/*
+ * Waiting for a job to complete with progmtx held.  The thread is woken
+ * up so that it polls the requests at once.
+ */
+static void
+prog_wait(void)
+{
+    _inf.progwait++;
+    pthread_cond_signal(&_inf.progcond);
+    pthread_cond_wait(&_inf.progdone, &_inf.progmtx);
+    _inf.progwait--;
+}
+
+/*
+ * The user buffer is handed to the progress thread, and the spare
+ * one is used for the following stripes.  If sync is specified, the
+ * round is kept unless it is full, and the file is synced after the
+ * exchange.
+ */
+static void
+prog_enqueue(fdinfo *info, int sync, int last)
+{
+    struct progjob	*job;
+    int		xchg = info->bufcount > info->bufdone;
+    uint64_t	t0;
+
+    if (!xchg && !sync && !last) {
+	return;
+    }
+    job = malloc(sizeof(struct progjob));
+    IOMIDDLE_IFERROR((job == NULL), "%s", "Cannot allocate working memory\n");
+    memset(job, 0, sizeof(struct progjob));
+    job->rcnts = malloc(sizeof(int)*Nprocs*(2 + FV_NUM));
+    IOMIDDLE_IFERROR((job->rcnts == NULL), "%s",
+		     "Cannot allocate working memory\n");
+    job->valid = job->rcnts + 2*Nprocs;
+    flush_mine(info, last, job->mine, job->sum);
+    job->info = info;
+    job->ubuf = xchg ? info->ubuf : NULL;
+    job->stripe = info->bufdone;
+    job->bufcount = info->bufcount;
+    job->filcurb = info->filcurb;
+    job->sync = sync;
+    pthread_mutex_lock(&_inf.progmtx);
+    if (info->spare == NULL && info->njobs == 0) {
+	/* the first round of this file */
+	info->spare = stage_alloc(info->bufsize);
+	IOMIDDLE_IFERROR((info->spare == NULL), "%s",
+			 "Cannot allocate IO middleware buffer\n");
+    }
+    t0 = mon_now();
+    while (xchg && info->spare == NULL) {
+	prog_wait();
+    }
+    MON_SINCE(xchg_nsec, t0);
+    if (xchg) {
+	info->ubuf = info->spare;
+	info->spare = NULL;
+    }
+    if (sync) {
+	info->syncpend++;
+    }
+    info->njobs++;
+    MON_ADD(qdepth, 1);
+    if (_inf.progtail) {
+	_inf.progtail->next = job;
+    } else {
+	_inf.proghead = job;
+    }
+    _inf.progtail = job;
+    pthread_cond_signal(&_inf.progcond);
+    pthread_mutex_unlock(&_inf.progmtx);
+    if (sync && info->bufcount < info->mybufcount) {
+	info->bufdone = info->bufcount;
+    } else {
+	info->filcurb += info->mybufcount;
+	info->bufcount = 0;
+	info->bufpos = 0;
+	info->bufdone = 0;
+    }
+}
+
+/*
+ * Waiting for completion of all rounds of this file
+ */
+static void
+prog_drain(fdinfo *info)
+{
+    uint64_t	t0 = mon_now();
+
+    pthread_mutex_lock(&_inf.progmtx);
+    while (info->njobs > 0) {
+	prog_wait();
+    }
+    pthread_mutex_unlock(&_inf.progmtx);
+    MON_SINCE(xchg_nsec, t0);
+}
+
+/*
+ * The progress thread requires MPI_THREAD_MULTIPLE.
+ * Invoked in rank_init before Myrank is set.
+ */
+static void
+prog_init(int rank)
+{
+    IOMIDDLE_IFERROR(
+	(pthread_create(&_inf.progthr, NULL, prog_main, NULL) != 0),
+	"%s", "Cannot create the progress thread\n");
+    pthread_detach(_inf.progthr);
+}
+
+/*
+ * The progress thread is pinned to the cpu of IOMIDDLE_PROGRESS_CPU
+ * selected by the rank in the node.  Invoked in coll_init.
+ */
+static void
+prog_pin(MPI_Comm node)
+{
+    int		lrank, ncpu, i;
+    char	*cp;
+    cpu_set_t	cpus;
+
+    MPI_Comm_rank(node, &lrank);
+    for (cp = _inf.progcpu, ncpu = 1; *cp; cp++) {
+	if (*cp == ',') ncpu++;
+    }
+    for (cp = _inf.progcpu, i = lrank % ncpu; i > 0; cp++) {
+	if (*cp == ',') i--;
+    }
+    CPU_ZERO(&cpus);
+    CPU_SET(atoi(cp), &cpus);
+    if (pthread_setaffinity_np(_inf.progthr, sizeof(cpus), &cpus) != 0) {
+	fprintf(stderr, "[%d] %s: cannot pin the progress thread to cpu %d\n",
+		Myrank, __func__, atoi(cp));
+    }
+    DEBUG(DLEVEL_CONFIRM) {
+	fprintf(stderr, "[%d] %s: progress thread on cpu %d\n",
+		Myrank, __func__, atoi(cp));
+    }
+}
+
+/*
+ * I/O servers (IOMIDDLE_SERVERS):
+ *	Processes spawned at the first open of a care file written
+ *	through them (collective by contract) own the writes
+ *	of the stripe mode instead of aggregators among the processes.
+ *	Server s serves the group of ranks r where r*nservers/nprocs is s,
+ *	which are consecutive and usually in the same nodes.  A full round
+ *	is handed to the server by a non-blocking send, and the process
+ *	goes on with the spare user buffer.  It waits only if the send of
+ *	the previous round has not been received yet, i.e., the server is
+ *	out of its buffer capacity.  The server receives the stripes of
+ *	its group into the pieces of blocks as buf_flush() gathers them,
+ *	and writes the pieces of a round once every process of the group
+ *	has sent the round or closed the file.
+ *  E.g. 2 servers of 4 processes (p.i: the i-th stripe of rank p)
+ *	         rank 0	  rank 1     rank 2     rank 3
+ *  ubuf   #0#1#2#3   #0#1#2#3   #0#1#2#3   #0#1#2#3
+ *         <----- server 0 ---->   <----- server 1 ---->
+ *  round  0.0 1.0|0.1 1.1|...     2.0 3.0|2.1 3.1|...
+ */
+#define SRV_TAG_REQ	1
+#define SRV_TAG_DATA	2
+#define SRV_TAG_ACK	16	/* + file descriptor of the process */
+
+static const struct policy srvpol;	/* files are written directly */
+
+static inline int
+srv_of(int rank)
+{
+    return (int) ((long long) rank*_inf.nservers/Nprocs);
+}
+
+/*
+ * Replies of a server are told apart by the file descriptor, which is
+ * used by one thread at a time.  Files of larger descriptors than the
+ * tags allow are not written by the servers.
+ */
+static inline int
+srv_tag(fdinfo *info)
+{
+    return SRV_TAG_ACK + info->iofd;
+}
+
+/*
+ * Invoked by MPI_Finalize, which deletes the attributes of MPI_COMM_SELF
+ * first.  A server exits when all processes of its group come here.
+ */
+static int
+srv_exit(MPI_Comm comm, int keyval, void *val, void *extra)
+{
+    struct srvreq	req;
+
+    memset(&req, 0, sizeof(req));
+    req.op = SRV_EXIT;
+    MPI_Send(&req, sizeof(req), MPI_BYTE, srv_of(Myrank), SRV_TAG_REQ,
+	     _inf.srvcomm);
+    MPI_Comm_disconnect(&_inf.srvcomm);
+    return MPI_SUCCESS;
+}
+
+/*
+ * Invoked by info_init at the first open of a file written through the
+ * servers, which all processes issue.  The i-th server is placed on the
+ * (i % # of hosts)-th host of IOMIDDLE_SERVER_HOSTS if given.
+ */
+static void
+srv_spawn()
+{
+    int		i, nhost, keyval, flag, *ub;
+
+    if (__atomic_load_n(&_inf.srvup, __ATOMIC_ACQUIRE)) {
+	return;
+    }
+    pthread_mutex_lock(&_inf.initlock);
+    if (_inf.srvup) {
+	pthread_mutex_unlock(&_inf.initlock);
+	return;
+    }
+    if (_inf.nservers > Nprocs) {
+	_inf.nservers = Nprocs;
+    }
+    if (_inf.srvhosts == NULL) {
+	MPI_CALL(MPI_Comm_spawn(_inf.srvpath, MPI_ARGV_NULL, _inf.nservers,
+				MPI_INFO_NULL, 0, MPI_COMM_WORLD,
+				&_inf.srvcomm, MPI_ERRCODES_IGNORE));
+    } else {
+	char	*hosts, *cp, *save, **host, **cmds;
+	int	*np;
+	MPI_Info	*infos;
+
+	hosts = strdup(_inf.srvhosts);
+	for (nhost = 1, cp = _inf.srvhosts; *cp; cp++) {
+	    if (*cp == ',') nhost++;
+	}
+	host = malloc(sizeof(char*)*(nhost + _inf.nservers));
+	np = malloc(sizeof(int)*_inf.nservers);
+	infos = malloc(sizeof(MPI_Info)*_inf.nservers);
+	IOMIDDLE_IFERROR((hosts == NULL || host == NULL || np == NULL
+			  || infos == NULL),
+			 "%s", "Cannot allocate working memory\n");
+	cmds = host + nhost;
+	nhost = 0;
+	for (cp = strtok_r(hosts, ",", &save); cp;
+	     cp = strtok_r(NULL, ",", &save)) {
+	    host[nhost++] = cp;
+	}
+	IOMIDDLE_IFERROR((nhost == 0), "%s: no host in %s\n",
+			 __func__, _inf.srvhosts);
+	for (i = 0; i < _inf.nservers; i++) {
+	    cmds[i] = _inf.srvpath;
+	    np[i] = 1;
+	    MPI_CALL(MPI_Info_create(&infos[i]));
+	    MPI_CALL(MPI_Info_set(infos[i], "host", host[i % nhost]));
+	}
+	MPI_CALL(MPI_Comm_spawn_multiple(_inf.nservers, cmds, MPI_ARGVS_NULL,
+					 np, infos, 0, MPI_COMM_WORLD,
+					 &_inf.srvcomm, MPI_ERRCODES_IGNORE));
+	for (i = 0; i < _inf.nservers; i++) {
+	    MPI_Info_free(&infos[i]);
+	}
+	free(infos);
+	free(np);
+	free(host);
+	free(hosts);
+    }
+    MPI_CALL(MPI_Comm_get_attr(MPI_COMM_WORLD, MPI_TAG_UB, &ub, &flag));
+    _inf.srvfdmax = (flag ? *ub : COMM_TAG_MIN) - SRV_TAG_ACK;
+    MPI_CALL(MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, srv_exit,
+				    &keyval, NULL));
+    MPI_CALL(MPI_Comm_set_attr(MPI_COMM_SELF, keyval, NULL));
+    DEBUG(DLEVEL_CONFIRM) {
+	if (Myrank == 0) {
+	    fprintf(stderr, "[0] %s: %d servers of %s\n",
+		    __func__, _inf.nservers, _inf.srvpath);
+	}
+    }
+    __atomic_store_n(&_inf.srvup, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&_inf.initlock);
+}
+
+/*
+ * A request followed by its data, which are not interleaved with the
+ * ones of other threads.  The data are sent by a non-blocking send if
+ * rq is given.
+ */
+static void
+srv_request(struct srvreq *req, void *buf, int cnt, MPI_Datatype type,
+	    MPI_Request *rq)
+{
+    int	srv = srv_of(Myrank);
+
+    pthread_mutex_lock(&_inf.srvlock);
+    MPI_CALL(MPI_Send(req, sizeof(*req), MPI_BYTE, srv, SRV_TAG_REQ,
+		      _inf.srvcomm));
+    if (buf && rq) {
+	MPI_CALL(MPI_Isend(buf, cnt, type, srv, SRV_TAG_DATA,
+			   _inf.srvcomm, rq));
+    } else if (buf) {
+	MPI_CALL(MPI_Send(buf, cnt, type, srv, SRV_TAG_DATA, _inf.srvcomm));
+    }
+    pthread_mutex_unlock(&_inf.srvlock);
+}
+
+static int
+srv_reply(fdinfo *info)
+{
+    int	rc;
+    uint64_t	t0 = mon_now();
+
+    MPI_CALL(MPI_Recv(&rc, 1, MPI_INT, srv_of(Myrank), srv_tag(info),
+		      _inf.srvcomm, MPI_STATUS_IGNORE));
+    MON_SINCE(write_nsec, t0);
+    return rc;
+}
+
+/*
+ * Invoked in info_init.  Rank 0 has truncated the file before any
+ * server writes it.
+ */
+static void
+srv_open(fdinfo *info, const char *path)
+{
+    struct srvreq	req;
+    char	canon[PATH_MAX];
+
+    /* the server may run in another directory */
+    if (path_canon(path, canon) < 0) {
+	snprintf(canon, PATH_MAX, "%s", path);
+    }
+    info->srvreq = MPI_REQUEST_NULL;
+    info->srvtype = MPI_DATATYPE_NULL;
+    memset(&req, 0, sizeof(req));
+    req.op = SRV_OPEN;
+    req.fd = info->iofd;
+    req.cnt = strlen(canon);
+    req.sparse = info->sparse;
+    srv_request(&req, canon, req.cnt, MPI_CHAR, NULL);
+    if (info->trunc) {
+	MPI_CALL(MPI_Barrier(info->comm));
+    }
+}
+
+/*
+ * Sending the stripes of this round not sent yet.  At the end of the
+ * round, the user buffer is swapped with the spare one, whose send must
+ * have been received by the server.  Otherwise (sync), the round is
+ * kept for the following stripes.
+ */
+static void
+srv_flush(fdinfo *info, int end)
+{
+    struct srvreq	req;
+    MPI_Request	rq = MPI_REQUEST_NULL;
+    char	*buf = NULL;
+    uint64_t	t0;
+
+    if (info->srvtype == MPI_DATATYPE_NULL) {
+	MPI_CALL(MPI_Type_contiguous(info->strsize, MPI_BYTE,
+				     &info->srvtype));
+	MPI_CALL(MPI_Type_commit(&info->srvtype));
+    }
+    memset(&req, 0, sizeof(req));
+    req.op = SRV_DATA;
+    req.fd = info->iofd;
+    req.first = info->bufdone;
+    req.cnt = info->bufcount - info->bufdone;
+    req.tail = (info->taillen && req.cnt > 0) ? info->taillen : 0;
+    req.end = end;
+    req.strsize = info->strsize;
+    req.nbuf = info->mybufcount;
+    req.blk = info->filcurb;
+    if (req.cnt > 0) {
+	/* the short last stripe is sent in full, and cut by the server */
+	buf = info->ubuf + (size_t) info->bufdone*info->strsize;
+    }
+    MON_ADD(inflush, 1);
+    srv_request(&req, buf, req.cnt, info->srvtype, &rq);
+    t0 = mon_now();
+    if (end) {
+	MPI_CALL(MPI_Wait(&info->srvreq, MPI_STATUS_IGNORE));
+	info->srvreq = rq;
+	buf = info->ubuf;
+	info->ubuf = info->spare;
+	info->spare = buf;
+	info->filcurb += info->mybufcount;
+	info->bufcount = 0;
+	info->bufpos = 0;
+	info->bufdone = 0;
+    } else {
+	MPI_CALL(MPI_Wait(&rq, MPI_STATUS_IGNORE));
+	info->bufdone = info->bufcount;
+    }
+    MON_SINCE(xchg_nsec, t0);
+    MON_ADD(inflush, -1);
+    MON_ADD(flushes, 1);
+}
+
+/*
+ * The server writes the stripes sent so far and syncs the file once all
+ * processes of its group have come here.
+ */
+static int
+srv_sync(fdinfo *info, int datasync)
+{
+    struct srvreq	req;
+
+    if (info->ubuf && info->bufcount > info->bufdone) {
+	srv_flush(info, 0);
+    }
+    memset(&req, 0, sizeof(req));
+    req.op = SRV_SYNC;
+    req.fd = info->iofd;
+    req.cnt = datasync;
+    req.tag = srv_tag(info);
+    srv_request(&req, NULL, 0, MPI_BYTE, NULL);
+    return srv_reply(info);
+}
+
+/*
+ * The server replies once all processes of its group have closed the
+ * file and their stripes have been written.
+ */
+static int
+srv_close(fdinfo *info)
+{
+    struct srvreq	req;
+    int		rc;
+
+    if (info->ubuf && info->bufcount > info->bufdone) {
+	srv_flush(info, 1);
+    }
+    MPI_CALL(MPI_Wait(&info->srvreq, MPI_STATUS_IGNORE));
+    memset(&req, 0, sizeof(req));
+    req.op = SRV_CLOSE;
+    req.fd = info->iofd;
+    req.tag = srv_tag(info);
+    srv_request(&req, NULL, 0, MPI_BYTE, NULL);
+    rc = srv_reply(info);
+    if (info->srvtype != MPI_DATATYPE_NULL) {
+	MPI_Type_free(&info->srvtype);
+    }
+    info->server = 0;
+    return rc;
+}
+
+/*
+ * Server side.  The file of the m-th process of the group is found by
+ * the file descriptor of the process.
+ */
+static struct srvfile *
+srv_file(struct srvstate *st, int m, int fd)
+{
+    struct srvfile	*f;
+
+    for (f = st->files; f; f = f->next) {
+	if (f->fds[m] == fd && !f->closed[m]) {
+	    return f;
+	}
+    }
+    return NULL;
+}
+
+/*
+ * The process joins the file of the path opened by other processes of
+ * the group, or the server opens it
+ */
+static void
+srv_join(struct srvstate *st, int m, struct srvreq *req)
+{
+    struct srvfile	*f;
+    char	path[PATH_MAX];
+    int		i;
+
+    MPI_CALL(MPI_Recv(path, req->cnt, MPI_CHAR, st->q0 + m, SRV_TAG_DATA,
+		      st->parent, MPI_STATUS_IGNORE));
+    path[req->cnt] = 0;
+    for (f = st->files; f; f = f->next) {
+	if (f->fds[m] < 0 && !f->closed[m] && !strcmp(f->path, path)) {
+	    break;
+	}
+    }
+    if (f == NULL) {
+	f = calloc(1, sizeof(struct srvfile));
+	IOMIDDLE_IFERROR((f == NULL), "%s", "Cannot allocate working memory\n");
+	f->path = strdup(path);
+	f->fds = malloc(sizeof(int)*st->n*2);
+	f->nextblk = malloc(sizeof(off64_t)*st->n);
+	f->closed = calloc(st->n, 1);
+	IOMIDDLE_IFERROR((f->path == NULL || f->fds == NULL
+			  || f->nextblk == NULL || f->closed == NULL),
+			 "%s", "Cannot allocate working memory\n");
+	f->tags = f->fds + st->n;
+	for (i = 0; i < st->n; i++) {
+	    f->fds[i] = -1;
+	    f->nextblk[i] = -1;
+	}
+	f->stripe = MPI_DATATYPE_NULL;
+	f->info.pol = &srvpol;
+	f->info.sparse = req->sparse;
+	f->info.iofd = __real_open(path, O_WRONLY);
+	if (f->info.iofd < 0) {
+	    dbgprintf("%s: cannot open %s, errno(%d)\n", __func__, path, errno);
+	    f->rc = -1;
+	}
+	f->next = st->files;
+	st->files = f;
+    }
+    f->fds[m] = req->fd;
+}
+
+/*
+ * The round of block# blk.  A new round is allocated within the buffer
+ * capacity unless the file has no round, and NULL is returned if the
+ * capacity is exhausted.
+ */
+static struct srvround *
+srv_round(struct srvstate *st, struct srvfile *f, off64_t blk)
+{
+    struct srvround	*r, **rp;
+    size_t	size = (size_t) f->nbuf*st->n*f->strsize;
+
+    for (rp = &f->rounds; (r = *rp) != NULL && r->blk <= blk; rp = &r->next) {
+	if (r->blk == blk) {
+	    return r;
+	}
+    }
+    if (f->rounds && st->used + size > _inf.srvmem) {
+	return NULL;
+    }
+    r = malloc(sizeof(struct srvround));
+    IOMIDDLE_IFERROR((r == NULL), "%s", "Cannot allocate working memory\n");
+    r->got = calloc(st->n*3, sizeof(int));
+    r->buf = malloc(size);
+    IOMIDDLE_IFERROR((r->got == NULL || r->buf == NULL), "%s",
+		     "Cannot allocate IO middleware buffer\n");
+    r->done = r->got + st->n;
+    r->tail = r->done + st->n;
+    r->blk = blk;
+    r->next = *rp;
+    *rp = r;
+    st->used += size;
+    return r;
+}
+
+/*
+ * Writing the stripes of the round received but not written yet,
+ * in pieces of blocks as buf_flush() does
+ */
+static void
+srv_write(struct srvstate *st, struct srvfile *f, struct srvround *r)
+{
+    size_t	strsize = f->strsize;
+    off64_t	blksize = (off64_t) strsize*st->nprocs;
+    int		i, m, lo = f->nbuf, hi = 0;
+    int		*cnts;
+
+    cnts = malloc(sizeof(int)*st->n);
+    IOMIDDLE_IFERROR((cnts == NULL), "%s", "Cannot allocate working memory\n");
+    for (m = 0; m < st->n; m++) {
+	if (r->got[m] <= r->done[m]) continue;
+	if (r->done[m] < lo) lo = r->done[m];
+	if (r->got[m] > hi) hi = r->got[m];
+    }
+    DEBUG(DLEVEL_BUFMGR) {
+	if (lo < hi) {
+	    dbgprintf("%s: %s blk#(%ld) stripes %d..%d\n",
+		      __func__, f->path, r->blk, lo, hi - 1);
+	}
+    }
+    for (i = lo; i < hi; i++) {
+	for (m = 0; m < st->n; m++) {
+	    cnts[m] = 0;
+	    if (i >= r->done[m] && i < r->got[m]) {
+		cnts[m] = (r->tail[m] && i == r->got[m] - 1) ?
+		    r->tail[m] : strsize;
+	    }
+	}
+	if (f->info.iofd >= 0
+	    && blk_write_runs(&f->info, r->buf + (size_t) i*st->n*strsize,
+			      cnts, st->n, strsize,
+			      (r->blk + i)*blksize + (off64_t) st->q0*strsize,
+			      f->info.sparse) < 0) {
+	    f->rc = -1;
+	}
+    }
+    for (m = 0; m < st->n; m++) {
+	r->done[m] = r->got[m];
+    }
+    free(cnts);
+}
+
+/*
+ * Rounds which every process of the group has sent, or will not send
+ * since it has closed the file, are written and freed
+ */
+static void
+srv_complete(struct srvstate *st, struct srvfile *f)
+{
+    struct srvround	*r, **rp;
+    int		m;
+
+    for (rp = &f->rounds; (r = *rp) != NULL; ) {
+	for (m = 0; m < st->n; m++) {
+	    if (!f->closed[m] && f->nextblk[m] <= r->blk) break;
+	}
+	if (m < st->n) {
+	    rp = &r->next;
+	    continue;
+	}
+	srv_write(st, f, r);
+	*rp = r->next;
+	st->used -= (size_t) f->nbuf*st->n*f->strsize;
+	free(r->buf);
+	free(r->got);
+	free(r);
+    }
+}
+
+static void
+srv_ack(struct srvstate *st, struct srvfile *f, int rc)
+{
+    int	m;
+
+    for (m = 0; m < st->n; m++) {
+	MPI_CALL(MPI_Send(&rc, 1, MPI_INT, st->q0 + m, f->tags[m],
+			  st->parent));
+    }
+}
+
+static void
+srv_free(struct srvstate *st, struct srvfile *f)
+{
+    struct srvfile	**fp;
+
+    for (fp = &st->files; *fp != f; fp = &(*fp)->next);
+    *fp = f->next;
+    if (f->stripe != MPI_DATATYPE_NULL) {
+	MPI_Type_free(&f->stripe);
+    }
+    free(f->path);
+    free(f->fds);
+    free(f->nextblk);
+    free(f->closed);
+    free(f);
+}
+
+/*
+ * The request received from the m-th process of the group.  -1 is
+ * returned if it waits for the buffer capacity.
+ */
+static int
+srv_handle(struct srvstate *st, int m)
+{
+    struct srvreq	*req = &st->reqs[m];
+    struct srvfile	*f;
+    struct srvround	*r;
+    MPI_Datatype	vec;
+    int		rc;
+
+    if (req->op == SRV_OPEN) {
+	srv_join(st, m, req);
+	return 0;
+    } else if (req->op == SRV_EXIT) {
+	st->nexit++;
+	return 0;
+    }
+    f = srv_file(st, m, req->fd);
+    IOMIDDLE_IFERROR((f == NULL), "%s: request(%d) of unknown fd(%d) "
+		     "from rank %d\n", __func__, req->op, req->fd, st->q0 + m);
+    switch (req->op) {
+    case SRV_DATA:
+	if (req->cnt > 0) {
+	    if (f->stripe == MPI_DATATYPE_NULL) {
+		f->strsize = req->strsize;
+		f->nbuf = req->nbuf;
+		MPI_CALL(MPI_Type_contiguous(f->strsize, MPI_BYTE, &f->stripe));
+		MPI_CALL(MPI_Type_commit(&f->stripe));
+	    }
+	    if ((r = srv_round(st, f, req->blk)) == NULL) {
+		return -1;
+	    }
+	    /* the stripes are placed in the pieces of blocks */
+	    MPI_CALL(MPI_Type_create_hvector(req->cnt, 1,
+					     (MPI_Aint) st->n*f->strsize,
+					     f->stripe, &vec));
+	    MPI_CALL(MPI_Type_commit(&vec));
+	    MPI_CALL(MPI_Recv(r->buf + ((size_t) req->first*st->n + m)
+			      *f->strsize, 1, vec, st->q0 + m, SRV_TAG_DATA,
+			      st->parent, MPI_STATUS_IGNORE));
+	    MPI_Type_free(&vec);
+	    r->got[m] = req->first + req->cnt;
+	    if (req->tail) {
+		r->tail[m] = req->tail;
+	    }
+	}
+	if (req->end) {
+	    f->nextblk[m] = req->blk + req->nbuf;
+	    srv_complete(st, f);
+	}
+	break;
+    case SRV_SYNC:
+	f->tags[m] = req->tag;
+	f->datasync = (f->nsync == 0 || f->datasync) && req->cnt;
+	if (++f->nsync < st->n - f->nclosed) {
+	    break;
+	}
+	/* syncs are collective, and all processes of the group are here */
+	for (r = f->rounds; r; r = r->next) {
+	    srv_write(st, f, r);
+	}
+	rc = f->rc;
+	if (f->info.iofd >= 0
+	    && (f->datasync ? __real_fdatasync(f->info.iofd)
+		: __real_fsync(f->info.iofd)) < 0) {
+	    rc = -1;
+	}
+	srv_ack(st, f, rc);
+	f->nsync = 0;
+	break;
+    case SRV_CLOSE:
+	f->tags[m] = req->tag;
+	f->closed[m] = 1;
+	srv_complete(st, f);
+	if (++f->nclosed < st->n) {
+	    break;
+	}
+	if (f->info.iofd >= 0 && __real_close(f->info.iofd) < 0) {
+	    f->rc = -1;
+	}
+	srv_ack(st, f, f->rc);
+	srv_free(st, f);
+	break;
+    }
+    return 0;
+}
+
+static inline void
+srv_post(struct srvstate *st, int m)
+{
+    MPI_CALL(MPI_Irecv(&st->reqs[m], sizeof(struct srvreq), MPI_BYTE,
+		       st->q0 + m, SRV_TAG_REQ, st->parent, &st->rreqs[m]));
+}
+
+/*
+ * Main loop of a server, see iomiddle.h.  Requests of each process are
+ * handled in order.  A process whose round does not fit in the buffer
+ * capacity is not received from until other rounds are written.
+ */
+int
+iomiddle_server(void)
+{
+    struct srvstate	st;
+    struct srvfile	*f;
+    struct srvround	*r;
+    int		rank, nsrv, m, idx, again;
+
+    _hijack_ensure();
+    memset(&st, 0, sizeof(st));
+    MPI_Comm_get_parent(&st.parent);
+    if (st.parent == MPI_COMM_NULL) {
+	errno = EINVAL;
+	return -1;
+    }
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &nsrv);
+    MPI_Comm_remote_size(st.parent, &st.nprocs);
+    Myrank = rank;
+    /* ranks r where r*nsrv/nprocs is this server */
+    st.q0 = ((long long) rank*st.nprocs + nsrv - 1)/nsrv;
+    st.n = ((long long) (rank + 1)*st.nprocs + nsrv - 1)/nsrv - st.q0;
+    st.reqs = malloc(sizeof(struct srvreq)*st.n);
+    st.rreqs = malloc(sizeof(MPI_Request)*st.n);
+    st.blocked = calloc(st.n, 1);
+    IOMIDDLE_IFERROR((st.reqs == NULL || st.rreqs == NULL
+		      || st.blocked == NULL),
+		     "%s", "Cannot allocate working memory\n");
+    DEBUG(DLEVEL_CONFIRM) {
+	dbgprintf("%s: ranks %d..%d of %d, buffer capacity %ld\n",
+		  __func__, st.q0, st.q0 + st.n - 1, st.nprocs, _inf.srvmem);
+    }
+    for (m = 0; m < st.n; m++) {
+	srv_post(&st, m);
+    }
+    while (st.nexit < st.n) {
+	MPI_CALL(MPI_Waitany(st.n, st.rreqs, &idx, MPI_STATUS_IGNORE));
+	IOMIDDLE_IFERROR((idx == MPI_UNDEFINED), "%s: all processes wait "
+			 "for the buffer capacity\n", __func__);
+	if (srv_handle(&st, idx) < 0) {
+	    st.blocked[idx] = 1;
+	    continue;
+	}
+	if (st.reqs[idx].op != SRV_EXIT) {
+	    srv_post(&st, idx);
+	}
+	do {
+	    again = 0;
+	    for (m = 0; m < st.n; m++) {
+		if (st.blocked[m] && srv_handle(&st, m) == 0) {
+		    st.blocked[m] = 0;
+		    srv_post(&st, m);
+		    again = 1;
+		}
+	    }
+	} while (again);
+    }
+    /* files left open by the processes */
+    while ((f = st.files) != NULL) {
+	for (r = f->rounds; r; r = r->next) {
+	    srv_write(&st, f, r);
+	}
+	while ((r = f->rounds) != NULL) {
+	    f->rounds = r->next;
+	    free(r->buf);
+	    free(r->got);
+	    free(r);
+	}
+	if (f->info.iofd >= 0) {
+	    __real_close(f->info.iofd);
+	}
+	srv_free(&st, f);
+    }
+    MPI_Comm_disconnect(&st.parent);
+    free(st.reqs);
+    free(st.rreqs);
+    free(st.blocked);
+    return 0;
+}
+
+/*
+ * Extent mode:
+ *	Each process buffers data of any length at any offset in ubuf,
+ *	and records its (offset, length) pair in the extent list.
+ *	At flushing, the file range covered by all processes is divided
+ *	into Nprocs file domains, each of which is handled by an aggregator.
+ *	  1) lists and data are exchanged by MPI_Alltoallv
+ *	  2) each aggregator sorts received extents by offset
+ *	  3) contiguous extents are coalesced and written by one pwritev
+ *  E.g.
+ *	         rank 0	  rank 1     rank 2     rank 3
+ *  ubuf     a  d	  b  e	     c		f
+ *         <----------- Alltoallv ----------------->
+ *  domain   a b	  c d	     e f	(empty)
+ */
+struct extrecv {
+    off64_t	off;
+    off64_t	len;
+    char	*data;
+};
+
+static int ext_write(int fd, struct extrecv *er, int cnt);
+
+/*
+ * The staging buffer exceeds the memory budget.  Buffered extents are
+ * written by this process itself, but it still takes part in the round.
+ */
+static void
+ext_spill(fdinfo *info)
+{
+    struct extrecv	*er;
+    char	*dp = info->ubuf;
+    int		i;
+
+    er = malloc(sizeof(struct extrecv)*(info->extcnt + 1));
+    IOMIDDLE_IFERROR((er == NULL), "%s", "Cannot allocate working memory\n");
+    for (i = 0; i < info->extcnt; i++) {
+	er[i].off = info->ext[i].off;
+	er[i].len = info->ext[i].len;
+	er[i].data = dp;
+	dp += er[i].len;
+    }
+    DEBUG(DLEVEL_BUFMGR) {
+	dbgprintf("%s: #extents(%d) size(%ld)\n",
+		  __func__, info->extcnt, info->bufpos);
+    }
+    if (ext_write(info->iofd, er, info->extcnt) < 0) {
+	dbgprintf("%s: write error\n", __func__);
+	info->wrerr = 1;
+    }
+    info->dirty = 1;
+    info->wrote = 1;
+    free(er);
+    info->extcnt = 0;
+    info->bufpos = 0;
+}
+
+static void
+ext_add(fdinfo *info, const void *buf, size_t len)
+{
+    struct extent	*ep;
+    size_t		memlimit = info->pol->memlimit;
+    ssize_t		cc;
+    size_t		done;
+
+    /* the bytes of a round are also bounded by int counts of MPI */
+    if (memlimit == 0 || memlimit > EXT_ROUND_MAX) {
+	memlimit = EXT_ROUND_MAX;
+    }
+    if (info->filpos + (off64_t) len > info->wrend) {
+	/* the position may be moved back by lseek */
+	info->wrend = info->filpos + len;
+    }
+    if (info->bufpos + len > memlimit) {
+	ext_spill(info);
+	if (len > memlimit) {
+	    for (done = 0; done < len; done += cc) {
+		cc = pwrite(info->iofd, (const char*) buf + done, len - done,
+			    info->filpos + done);
+		if (cc <= 0) {
+		    dbgprintf("%s: write error\n", __func__);
+		    info->wrerr = 1;
+		    break;
+		}
+	    }
+	    info->dirty = 1;
+	    info->wrote = 1;
+	    info->bufcount++;
+	    info->filpos += len;
+	    return;
+	}
+    }
+    if (info->bufpos + len > info->bufsize) {
+	size_t	newsize = info->bufsize ? info->bufsize*2 : len*Nprocs;
+	if (newsize < info->bufpos + len) newsize = info->bufpos + len;
+	if (newsize > memlimit) {
+	    newsize = memlimit;
+	}
+	info->ubuf = realloc(info->ubuf, newsize);
+	IOMIDDLE_IFERROR((info->ubuf == NULL), "%s",
+			 "Cannot allocate IO middleware buffer\n");
+	info->bufsize = newsize;
+    }
+    if (info->extcnt == info->extmax) {
+	info->extmax = info->extmax ? info->extmax*2 : Nprocs;
+	info->ext = realloc(info->ext, sizeof(struct extent)*info->extmax);
+	IOMIDDLE_IFERROR((info->ext == NULL), "%s",
+			 "Cannot allocate IO middleware extent list\n");
+    }
+    /* the previous extent is extended if this write continues it */
+    if (info->extcnt > 0
+	&& info->ext[info->extcnt - 1].off
+	   + info->ext[info->extcnt - 1].len == info->filpos) {
+	info->ext[info->extcnt - 1].len += len;
+    } else {
+	ep = &info->ext[info->extcnt++];
+	ep->off = info->filpos;
+	ep->len = len;
+    }
+    stage_copy(info->ubuf + info->bufpos, buf, len, 1);
+    MON_ADD(staged, len);
+    info->bufpos += len; info->bufcount++;
+    info->filpos += len;
+}
+
+static int
+ext_compare(const void *p1, const void *p2)
+{
+    const struct extrecv *e1 = p1, *e2 = p2;
+    if (e1->off < e2->off) return -1;
+    if (e1->off > e2->off) return 1;
+    /* keeping the arrival order for overlapped extents */
+    return (e1->data < e2->data) ? -1 : (e1->data > e2->data);
+}
+
+/*
+ * Writing sorted extents.  Contiguous extents are merged into one pwritev.
+ */
+static int
+ext_write(int fd, struct extrecv *er, int cnt)
+{
+    struct iovec	iov[EXT_IOV_MAX];
+    int		i, niov;
+    off64_t	start, end;
+    ssize_t	sz;
+    int		rc = 0;
+    uint64_t	t0 = mon_now();
+
+    for (i = 0; i < cnt; ) {
+	start = end = er[i].off;
+	niov = 0;
+	while (i < cnt && er[i].off == end && niov < EXT_IOV_MAX) {
+	    iov[niov].iov_base = er[i].data;
+	    iov[niov].iov_len = er[i].len;
+	    end += er[i].len;
+	    niov++; i++;
+	}
+	DEBUG(DLEVEL_BUFMGR) {
+	    dbgprintf("%s: writing offset(%ld) size(%ld) #extents(%d)\n",
+		      __func__, start, end - start, niov);
+	}
+	sz = pwritev(fd, iov, niov, start);
+	if (sz < end - start) rc = -1;
+	if (sz > 0) MON_ADD(written, sz);
+    }
+    MON_SINCE(write_nsec, t0);
+    return rc;
+}
+
+/*
+ * Collective flush in the extent mode.
+ * Returns non-zero if any process had buffered data in this round.
+ *	A process buffers at most EXT_ROUND_MAX bytes, but an aggregator
+ *	may receive more than int counts of MPI_Alltoallv.  Then senders
+ *	are split into passes of consecutive ranks per aggregator, which
+ *	are written in the rank order as a single exchange.
+ */
+static int
+ext_flush(fdinfo *info)
+{
+    long long	range[4], grange[4], rbytes;
+    off64_t	lo, domsize;
+    int		*scnt, *sdsp, *rcnt, *rdsp;
+    int		*sext, *sextd, *rext, *rextd;
+    int		*spass, *rpass, *pscnt, *prcnt;
+    off64_t	*slist, *rlist;
+    char	*sdata;
+    struct extrecv	*er;
+    int		i, j, dst, nsend, nrecv, npass, pass, ner;
+    int		rc = 0;
+    uint64_t	t0 = mon_now();
+
+    /* global file range: min of offsets and max of tails, and
+     * whether any process has written directly since the last round */
+    range[0] = LLONG_MAX; range[1] = LLONG_MAX;
+    range[2] = -(long long) info->bufpos;
+    range[3] = -info->wrote;
+    info->wrote = 0;
+    for (i = 0; i < info->extcnt; i++) {
+	if (info->ext[i].off < range[0]) range[0] = info->ext[i].off;
+	if (-(info->ext[i].off + info->ext[i].len) < range[1]) {
+	    range[1] = -(info->ext[i].off + info->ext[i].len);
+	}
+    }
+    MPI_CALL(MPI_Allreduce(range, grange, 4, MPI_LONG_LONG, MPI_MIN,
+			   info->comm));
+    MON_SINCE(xchg_nsec, t0);
+    if (grange[0] != LLONG_MAX || grange[3] < 0) {
+	stat_invalidate(info);
+    }
+    if (grange[0] == LLONG_MAX) {
+	/* nobody has data */
+	return 0;
+    }
+    MON_ADD(inflush, 1);
+    lo = grange[0] & ~((off64_t)EXT_DOMAIN_ALIGN - 1);
+    domsize = (-grange[1] - lo + Nprocs - 1)/Nprocs;
+    domsize = (domsize + EXT_DOMAIN_ALIGN - 1) & ~((off64_t)EXT_DOMAIN_ALIGN - 1);
+    DEBUG(DLEVEL_BUFMGR) {
+	dbgprintf("%s: range(%ld, %ld) domain size(%ld) #extents(%d)\n",
+		  __func__, grange[0], -grange[1], domsize, info->extcnt);
+    }
+    /* counts of extents and bytes per aggregator,
+     * an extent is split at the domain boundary */
+    scnt = calloc(Nprocs*12, sizeof(int));
+    IOMIDDLE_IFERROR((scnt == NULL), "%s", "Cannot allocate working memory\n");
+    sdsp = scnt + Nprocs; rcnt = sdsp + Nprocs; rdsp = rcnt + Nprocs;
+    sext = rdsp + Nprocs; sextd = sext + Nprocs;
+    rext = sextd + Nprocs; rextd = rext + Nprocs;
+    spass = rextd + Nprocs; rpass = spass + Nprocs;
+    pscnt = rpass + Nprocs; prcnt = pscnt + Nprocs;
+    nsend = 0;
+    for (i = 0; i < info->extcnt; i++) {
+	off64_t	off = info->ext[i].off, end = off + info->ext[i].len;
+	while (off < end) {
+	    off64_t	dend;
+	    dst = (off - lo)/domsize;
+	    dend = lo + (dst + 1)*domsize;
+	    if (dend > end) dend = end;
+	    sext[dst]++; scnt[dst] += dend - off;
+	    nsend++;
+	    off = dend;
+	}
+    }
+    for (i = 0, j = 0, dst = 0; i < Nprocs; i++) {
+	sdsp[i] = j; j += scnt[i];
+	sextd[i] = dst; dst += sext[i];
+    }
+    /* extent lists and data are packed in the aggregator order */
+    slist = malloc(sizeof(off64_t)*2*nsend);
+    sdata = malloc(info->bufpos > 0 ? info->bufpos : 1);
+    IOMIDDLE_IFERROR((slist == NULL || sdata == NULL), "%s",
+		     "Cannot allocate working memory\n");
+    {
+	int	*sidx = calloc(Nprocs*2, sizeof(int)), *didx;
+	char	*src = info->ubuf;
+	IOMIDDLE_IFERROR((sidx == NULL), "%s",
+			 "Cannot allocate working memory\n");
+	didx = sidx + Nprocs;
+	for (i = 0; i < info->extcnt; i++) {
+	    off64_t	off = info->ext[i].off, end = off + info->ext[i].len;
+	    while (off < end) {
+		off64_t	dend;
+		dst = (off - lo)/domsize;
+		dend = lo + (dst + 1)*domsize;
+		if (dend > end) dend = end;
+		j = sextd[dst] + sidx[dst]++;
+		slist[2*j] = off; slist[2*j + 1] = dend - off;
+		memcpy(sdata + sdsp[dst] + didx[dst], src, dend - off);
+		didx[dst] += dend - off;
+		src += dend - off;
+		off = dend;
+	    }
+	}
+	free(sidx);
+    }
+    t0 = mon_now();
+    MPI_CALL(MPI_Alltoall(sext, 1, MPI_INT, rext, 1, MPI_INT, info->comm));
+    MPI_CALL(MPI_Alltoall(scnt, 1, MPI_INT, rcnt, 1, MPI_INT, info->comm));
+    for (i = 0, nrecv = 0, npass = 1, rbytes = 0; i < Nprocs; i++) {
+	if (rbytes + rcnt[i] > EXT_XCHG_MAX) {
+	    npass++;
+	    rbytes = 0;
+	}
+	rpass[i] = npass - 1;
+	rbytes += rcnt[i];
+	rextd[i] = nrecv*2; nrecv += rext[i];
+	sext[i] *= 2; sextd[i] *= 2; rext[i] *= 2;
+    }
+    if (-grange[2] > EXT_XCHG_MAX/Nprocs) {
+	/* the passes of this aggregator are told to the senders */
+	MPI_CALL(MPI_Alltoall(rpass, 1, MPI_INT, spass, 1, MPI_INT,
+			      info->comm));
+	MPI_CALL(MPI_Allreduce(MPI_IN_PLACE, &npass, 1, MPI_INT, MPI_MAX,
+			       info->comm));
+    }
+    rlist = malloc(sizeof(off64_t)*2*(nrecv + 1));
+    er = malloc(sizeof(struct extrecv)*(nrecv + 1));
+    IOMIDDLE_IFERROR((rlist == NULL || er == NULL),
+		     "%s", "Cannot allocate working memory\n");
+    MPI_CALL(MPI_Alltoallv(slist, sext, sextd, MPI_LONG_LONG,
+			   rlist, rext, rextd, MPI_LONG_LONG, info->comm));
+    for (pass = 0; pass < npass; pass++) {
+	for (i = 0, rbytes = 0; i < Nprocs; i++) {
+	    pscnt[i] = spass[i] == pass ? scnt[i] : 0;
+	    prcnt[i] = rpass[i] == pass ? rcnt[i] : 0;
+	    rdsp[i] = rbytes; rbytes += prcnt[i];
+	}
+	if (info->sbufsize < rbytes) {
+	    free(info->sbuf);
+	    info->sbuf = malloc(rbytes);
+	    info->sbufsize = rbytes;
+	    IOMIDDLE_IFERROR((info->sbuf == NULL), "%s",
+			     "Cannot allocate working memory\n");
+	}
+	t0 = mon_now();
+	MPI_CALL(MPI_Alltoallv(sdata, pscnt, sdsp, MPI_BYTE,
+			       info->sbuf, prcnt, rdsp, MPI_BYTE, info->comm));
+	MON_SINCE(xchg_nsec, t0);
+	/* Now this process is the aggregator of received extents */
+	for (i = 0, ner = 0; i < Nprocs; i++) {
+	    char	*dp = info->sbuf + rdsp[i];
+	    if (rpass[i] != pass) continue;
+	    for (j = rextd[i]/2; j < (rextd[i] + rext[i])/2; j++, ner++) {
+		er[ner].off = rlist[2*j];
+		er[ner].len = rlist[2*j + 1];
+		er[ner].data = dp;
+		dp += er[ner].len;
+	    }
+	}
+	if (ner > 0) {
+	    qsort(er, ner, sizeof(struct extrecv), ext_compare);
+	    if (ext_write(info->iofd, er, ner) < 0) {
+		rc = -1;
+	    }
+	    info->dirty = 1;
+	}
+    }
+    if (rc < 0) {
+	dbgprintf("%s: write error\n", __func__);
+	info->wrerr = 1;
+    }
+    free(slist); free(sdata);
+    free(er);
+    free(rlist);
+    free(scnt);
+    info->extcnt = 0;
+    info->bufcount = 0;
+    info->bufpos = 0;
+    MON_ADD(inflush, -1);
+    MON_ADD(flushes, 1);
+    return 1;
+}
+
+/*
+ * Collective append (O_APPEND):
+ *	The end of the file is a counter in the window of rank 0 of the
+ *	communicator.  A write reserves its range by MPI_Fetch_and_op on
+ *	the counter, and the record is buffered in the extent mode at the
+ *	range, so that records of all processes are written together by
+ *	aggregators at fsync, fdatasync and close.
+ */
+static void
+append_init(fdinfo *info)
+{
+    struct stat64	sb;
+    long long	end = 0;
+    int		rank;
+
+    /* only rank 0 has truncated the file */
+    if (!info->trunc && sys_fstat64(info->iofd, &sb) == 0) {
+	end = sb.st_size;
+    }
+    MPI_CALL(MPI_Allreduce(MPI_IN_PLACE, &end, 1, MPI_LONG_LONG, MPI_MAX,
+			   info->comm));
+    MPI_Comm_rank(info->comm, &rank);
+    MPI_CALL(MPI_Win_allocate(rank == 0 ? sizeof(long long) : 0, 1,
+			      MPI_INFO_NULL, info->comm,
+			      &info->wbase, &info->win));
+    if (rank == 0) {
+	*(long long*) info->wbase = end;
+    }
+    MPI_CALL(MPI_Win_lock_all(MPI_MODE_NOCHECK, info->win));
+    /* the counter is set before any reservation */
+    MPI_CALL(MPI_Barrier(info->comm));
+}
+
+/*
+ * Reserving len bytes at the end.  Returns the offset of the range.
+ */
+static off64_t
+append_reserve(fdinfo *info, size_t len)
+{
+    long long	n = len, off;
+    uint64_t	t0 = mon_now();
+
+    MPI_CALL(MPI_Fetch_and_op(&n, &off, MPI_LONG_LONG, 0, 0, MPI_SUM,
+			      info->win));
+    MPI_CALL(MPI_Win_flush(0, info->win));
+    MON_SINCE(xchg_nsec, t0);
+    return off;
+}
+
+/*
+ * The end including ranges reserved but not written yet
+ */
+static off64_t
+append_end(fdinfo *info)
+{
+    long long	end;
+
+    MPI_CALL(MPI_Fetch_and_op(NULL, &end, MPI_LONG_LONG, 0, 0, MPI_NO_OP,
+			      info->win));
+    MPI_CALL(MPI_Win_flush(0, info->win));
+    return end;
+}
+
+static void
+append_fin(fdinfo *info)
+{
+    MPI_CALL(MPI_Win_unlock_all(info->win));
+    MPI_CALL(MPI_Win_free(&info->win));
+    info->wbase = 0;
+}
+
+/*
+ * Replicated-read mode:
+ *	All processes read the same range by each read call.  The range is
+ *	read by rank 0 of the communicator, globally or in a node, and
+ *	broadcast to others.
+ */
+static ssize_t
+bcast_read(fdinfo *info, void *buf, size_t len)
+{
+    MPI_Comm	comm = _inf.bcast_node ? info->nodecomm : info->comm;
+    int		rank;
+    long long	rc = 0;
+    size_t	off, sz;
+
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0) {
+	rc = file_pread(info, buf, len, info->filpos);
+	if (rc < 0) rc = -errno;
+    }
+    MPI_CALL(MPI_Bcast(&rc, 1, MPI_LONG_LONG, 0, comm));
+    if (rc < 0) {
+	errno = -rc;
+	return -1;
+    }
+    for (off = 0; off < rc; off += sz) {
+	sz = (rc - off > BCAST_CHUNK) ? BCAST_CHUNK : rc - off;
+	MPI_CALL(MPI_Bcast((char*) buf + off, sz, MPI_BYTE, 0, comm));
+    }
+    info->filpos += rc;
+    return rc;
+}
+
+/*
+ * IOMIDDLE_BCAST_AUTO:
+ *	Checking if all processes issue the first read at the same offset
+ *	with the same length.  Otherwise, the lseek deferred is checked.
+ */
+static void
+bcast_detect(int fd, size_t len)
+{
+    fdinfo	*info = FDINFO(fd);
+    long long	val[4], gval[4];
+
+    info->rdfirst = 1;
+    val[0] = info->filpos; val[1] = -info->filpos;
+    val[2] = len; val[3] = -(long long) len;
+    MPI_CALL(MPI_Allreduce(val, gval, 4, MPI_LONG_LONG, MPI_MAX,
+			   info->comm));
+    if (gval[0] == -gval[1] && gval[2] == -gval[3] && Nprocs > 1) {
+	DEBUG(DLEVEL_CONFIRM) {
+	    if (Myrank == 0) {
+		dbgprintf("%s: fd(%d) replicated read offset(%lld) "
+			  "len(%lld)\n", __func__, fd, gval[0], gval[2]);
+	    }
+	}
+	info->bcast = 1;
+    } else if (!info->notfirst && info->filpos != 0) {
+	if (stripe_check_init(fd, info->filpos, 1)) {
+	    DEBUG(DLEVEL_HIJACKED) { info_show(fd, __func__); }
+	    abort();
+	}
+    }
+}
+
+/*
+ * Container mode:
+ *	Each process stages the data of its file in memory.  At close,
+ *	the files of all processes are placed one after another by the
+ *	extent mode aggregation, piece by piece, and rank 0 writes the
+ *	header and the index in front of them.
+ *	  +--------+-------+-----------+-----------+---
+ *	  | header | index | out.3 ... | out.0 ... | ...
+ *	  +--------+-------+-----------+-----------+---
+ *	    rank 0 opened out.3, rank 1 opened out.0, ...
+ */
+static int
+cont_key(const char *path, int *key)
+{
+    char	*pp = strstr(cont_pattern, "%d");
+    char	*ep;
+    size_t	plen;
+
+    if (cont_pattern[0] == 0 || pp == NULL) {
+	return 0;
+    }
+    plen = pp - cont_pattern;
+    if (strncmp(path, cont_pattern, plen)
+	|| path[plen] < '0' || path[plen] > '9') {
+	return 0;
+    }
+    *key = strtol(path + plen, &ep, 10);
+    return !strcmp(ep, pp + 2);
+}
+
+static void
+cont_setup(int fd, const char *path, int key, int rwmode,
+	   off64_t base, off64_t len)
+{
+    fdinfo	*info = FDINFO(fd);
+
+    pthread_mutex_lock(&info->lock);
+    info->notfirst = 1;
+    info->cont = 1;
+    info->extmode = 1;
+    info->rwmode = rwmode;
+    info->ckey = key;
+    info->cbase = base;
+    info->clen = len;
+    info->cpath = strdup(path);
+    IOMIDDLE_IFERROR((info->cpath == NULL), "%s",
+		     "Cannot allocate working memory\n");
+    pthread_mutex_unlock(&info->lock);
+}
+
+/*
+ * The index of the container, NULL if it is not a container
+ */
+static struct content *
+cont_index(int fd, struct conthdr *hdr)
+{
+    struct content	*ent;
+    size_t		sz;
+
+    if (pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr)
+	|| memcmp(hdr->magic, CONT_MAGIC, sizeof(hdr->magic))
+	|| hdr->nent <= 0 || hdr->idxoff < (int64_t) sizeof(*hdr)) {
+	return NULL;
+    }
+    sz = sizeof(struct content)*hdr->nent;
+    ent = malloc(sz);
+    IOMIDDLE_IFERROR((ent == NULL), "%s", "Cannot allocate working memory\n");
+    if (pread(fd, ent, sz, hdr->idxoff) != sz) {
+	free(ent);
+	return NULL;
+    }
+    return ent;
+}
+
+/*
+ * A file of the container is opened for read.  It is looked up in
+ * the index, where the last entry of the number is taken.
+ */
+static int
+cont_open_read(const char *path, int key, int flags)
+{
+    struct conthdr	hdr;
+    struct content	*ent;
+    int64_t		i;
+    int			fd;
+
+    if ((fd = __real_open(cont_file, O_RDONLY)) < 0) {
+	return -1;
+    }
+    if ((ent = cont_index(fd, &hdr)) == NULL) {
+	goto notfound;
+    }
+    for (i = hdr.nent - 1; i >= 0 && ent[i].key != key; i--);
+    if (i < 0) {
+	goto notfound;
+    }
+    if (ent[i].off < 0) {
+	/* written outside the container */
+	__real_close(fd);
+	free(ent);
+	if ((fd = __real_open(path, flags)) >= 0) {
+	    info_dontcare(fd);
+	}
+	return fd;
+    }
+    info_init(fd, cont_file, flags, 0, &_inf.defpol);
+    cont_setup(fd, path, key, MODE_READ, ent[i].off, ent[i].len);
+    free(ent);
+    return fd;
+notfound:
+    __real_close(fd);
+    free(ent);
+    errno = ENOENT;
+    return -1;
+}
+
+/*
+ * A file of the container is opened for write.  The container is
+ * created by rank 0 only.
+ */
+static int
+cont_open(const char *path, int key, int flags, int mode)
+{
+    int			fd = -1, res[2];
+    struct commslot	*cs;
+
+    rank_init();
+    if ((flags & O_ACCMODE) == O_RDONLY) {
+	return cont_open_read(path, key, flags);
+    }
+    coll_init();
+    cs = comm_get(cont_file);
+    pthread_mutex_lock(&cs->lock);
+    if (Myrank == 0) {
+	fd = __real_open(cont_file, O_CREAT|O_RDWR|(flags & O_TRUNC),
+			 mode ? mode : 0644);
+	res[0] = fd; res[1] = errno;
+    }
+    MPI_CALL(MPI_Bcast(res, 2, MPI_INT, 0, cs->comm));
+    if (Myrank != 0 && res[0] >= 0) {
+	fd = __real_open(cont_file, O_RDWR);
+	res[1] = errno;
+    }
+    pthread_mutex_unlock(&cs->lock);
+    /* taken again by info_init() */
+    comm_put(cs);
+    if (fd < 0) {
+	errno = res[1];
+	return -1;
+    }
+    DEBUG(DLEVEL_HIJACKED|DLEVEL_CONFIRM) {
+	dbgprintf("%s: path(%s) key(%d) fd(%d)\n", __func__, path, key, fd);
+    }
+    info_init(fd, cont_file, flags, mode, &_inf.defpol);
+    cont_setup(fd, path, key, MODE_WRITE, 0, 0);
+    return fd;
+}
+
+static ssize_t cont_write(fdinfo *info, const void *buf, size_t len);
+
+/*
+ * The staged data exceed the memory budget in the adaptive mode.
+ * The file is written outside the container by this process.
+ */
+static ssize_t
+cont_external(fdinfo *info, const void *buf, size_t len)
+{
+    info->cfd = __real_open(info->cpath, O_CREAT|O_WRONLY|O_TRUNC,
+			    info->mode ? info->mode : 0644);
+    IOMIDDLE_IFERROR((info->cfd < 0), "%s: cannot create %s\n",
+		     __func__, info->cpath);
+    if (info->clen > 0
+	&& pwrite(info->cfd, info->cbuf, info->clen, 0) != info->clen) {
+	dbgprintf("%s: write error\n", __func__);
+    }
+    DEBUG(DLEVEL_CONFIRM) {
+	dbgprintf("%s: %s is written outside\n", __func__, info->cpath);
+    }
+    free(info->cbuf);
+    info->cbuf = 0;
+    info->cbufsize = 0;
+    info->contout = 1;
+    return cont_write(info, buf, len);
+}
+
+static ssize_t
+cont_write(fdinfo *info, const void *buf, size_t len)
+{
+    off64_t	end = info->filpos + len;
+    ssize_t	rc;
+
+    if (info->contout) {
+	rc = pwrite(info->cfd, buf, len, info->filpos);
+	if (rc > 0) info->filpos += rc;
+	if (info->filpos > info->clen) info->clen = info->filpos;
+	return rc;
+    }
+    if (end > info->cbufsize) {
+	size_t	newsize = info->cbufsize ? info->cbufsize*2 : CONT_ALIGN;
+	while (newsize < end) newsize *= 2;
+	if (info->pol->memlimit > 0 && newsize > info->pol->memlimit) {
+	    newsize = info->pol->memlimit;
+	}
+	IOMIDDLE_IFUNFIT((end > newsize),
+			 return cont_external(info, buf, len),
+			 "%s", "container file exceeds memory limit\n");
+	info->cbuf = realloc(info->cbuf, newsize);
+	IOMIDDLE_IFERROR((info->cbuf == NULL), "%s",
+			 "Cannot allocate IO middleware buffer\n");
+	memset(info->cbuf + info->cbufsize, 0, newsize - info->cbufsize);
+	info->cbufsize = newsize;
+    }
+    stage_copy(info->cbuf + info->filpos, buf, len, 1);
+    MON_ADD(staged, len);
+    info->filpos = end;
+    if (end > info->clen) info->clen = end;
+    return len;
+}
+
+static ssize_t
+cont_read(fdinfo *info, void *buf, size_t len)
+{
+    ssize_t	rc;
+
+    if (info->filpos >= info->clen) {
+	return 0;
+    }
+    if (len > info->clen - info->filpos) {
+	len = info->clen - info->filpos;
+    }
+    rc = pread(info->iofd, buf, len, info->cbase + info->filpos);
+    if (rc > 0) info->filpos += rc;
+    return rc;
+}
+
+static off64_t
+cont_lseek(fdinfo *info, off64_t offset, int whence)
+{
+    off64_t	pos;
+
+    switch (whence) {
+    case SEEK_SET: pos = offset; break;
+    case SEEK_CUR: pos = info->filpos + offset; break;
+    case SEEK_END: pos = info->clen + offset; break;
+    default: pos = -1; break;
+    }
+    if (pos < 0) {
+	errno = EINVAL;
+	return -1;
+    }
+    info->filpos = pos;
+    return pos;
+}
+
+/*
+ * Collective close of files in the container opened for write.
+ * Unless the container is truncated, the files are placed after its
+ * end, whose offset rank 0 shares in the Allgather of the lengths, and
+ * rank 0 writes the index of the existing and the new entries after
+ * them.
+ */
+static void
+cont_pack(fdinfo *info)
+{
+    int64_t	mine[3], *all;
+    off64_t	base, start, hdrsize, done, n, chunk;
+    struct conthdr	old;
+    struct content	*oent = NULL;
+    int		i;
+
+    mine[0] = info->ckey;
+    mine[1] = info->contout ? -1 : info->clen;
+    mine[2] = 0;
+    if (Myrank == 0 && !info->trunc
+	&& (oent = cont_index(info->iofd, &old)) != NULL) {
+	struct stat64	sb;
+	IOMIDDLE_IFERROR((sys_fstat64(info->iofd, &sb) < 0), "%s",
+			 "Cannot stat the container\n");
+	mine[2] = (sb.st_size + CONT_ALIGN - 1) & ~((off64_t)CONT_ALIGN - 1);
+    }
+    all = malloc(sizeof(int64_t)*3*Nprocs);
+    IOMIDDLE_IFERROR((all == NULL), "%s", "Cannot allocate working memory\n");
+    MPI_CALL(MPI_Allgather(mine, 3, MPI_LONG_LONG, all, 3, MPI_LONG_LONG,
+			   info->comm));
+    hdrsize = sizeof(struct conthdr) + sizeof(struct content)*Nprocs;
+    hdrsize = (hdrsize + CONT_ALIGN - 1) & ~((off64_t)CONT_ALIGN - 1);
+    start = all[2] > 0 ? all[2] : hdrsize;
+    for (i = 0, base = start; i < Myrank; i++) {
+	if (all[3*i + 1] > 0) base += all[3*i + 1];
+    }
+    /* data are moved by the extent mode aggregation piece by piece */
+    chunk = info->pol->memlimit > 0 ? info->pol->memlimit/2 : CONT_CHUNK;
+    if (chunk < CONT_ALIGN) chunk = CONT_ALIGN;
+    if (mine[1] > 0) {
+	info->bufsize = mine[1] < chunk ? mine[1] : chunk;
+	info->ubuf = malloc(info->bufsize);
+	IOMIDDLE_IFERROR((info->ubuf == NULL), "%s",
+			 "Cannot allocate IO middleware buffer\n");
+    }
+    done = 0;
+    do {
+	n = (mine[1] > done) ? mine[1] - done : 0;
+	if (n > chunk) n = chunk;
+	if (n > 0) {
+	    info->filpos = base + done;
+	    ext_add(info, info->cbuf + done, n);
+	    done += n;
+	}
+    } while (ext_flush(info));
+    if (Myrank == 0) {
+	int64_t		nold = oent ? old.nent : 0;
+	struct conthdr	*hdr = calloc(1, hdrsize);
+	struct content	*ent = malloc(sizeof(struct content)*(nold + Nprocs));
+	size_t		sz = sizeof(struct content)*(nold + Nprocs);
+	IOMIDDLE_IFERROR((hdr == NULL || ent == NULL), "%s",
+			 "Cannot allocate working memory\n");
+	if (nold > 0) {
+	    memcpy(ent, oent, sizeof(struct content)*nold);
+	}
+	for (i = 0, base = start; i < Nprocs; i++) {
+	    ent[nold + i].key = all[3*i];
+	    ent[nold + i].off = all[3*i + 1] < 0 ? -1 : base;
+	    ent[nold + i].len = all[3*i + 1] < 0 ? 0 : all[3*i + 1];
+	    base += ent[nold + i].len;
+	}
+	memcpy(hdr->magic, CONT_MAGIC, sizeof(hdr->magic));
+	hdr->nent = nold + Nprocs;
+	if (nold > 0) {
+	    /* the index is written before the header refers to it */
+	    hdr->idxoff = base;
+	    if (pwrite(info->iofd, ent, sz, base) != sz
+		|| pwrite(info->iofd, hdr, sizeof(*hdr), 0) != sizeof(*hdr)) {
+		dbgprintf("%s: write error\n", __func__);
+	    }
+	} else {
+	    hdr->idxoff = sizeof(*hdr);
+	    memcpy(hdr + 1, ent, sz);
+	    if (pwrite(info->iofd, hdr, hdrsize, 0) != hdrsize) {
+		dbgprintf("%s: write error\n", __func__);
+	    }
+	}
+	free(ent);
+	free(hdr);
+    }
+    free(oent);
+    free(all);
+}
+
+static int
+cont_close(int fd)
+{
+    fdinfo	*info = FDINFO(fd);
+    int		rc;
+
+    if (info->rwmode == MODE_WRITE) {
+	cont_pack(info);
+    }
+    if (info->contout) {
+	__real_close(info->cfd);
+    }
+    rc = __real_close(fd);
+    info->attrall = 0;
+    info->iofd = 0;
+    free(info->ubuf);
+    free(info->sbuf);
+    free(info->ext);
+    free(info->cbuf);
+    free(info->cpath);
+    info->ubuf = 0;
+    info->sbuf = 0;
+    info->ext = 0;
+    info->cbuf = 0;
+    info->cpath = 0;
+    info->bufsize = info->sbufsize = info->cbufsize = 0;
+    info->extcnt = info->extmax = 0;
+    return rc;
+}
+
+/*
+ * creat system call
+ */
+int
+_iomiddle_creat(const char* path, mode_t mode)
+{
+    int	fd;
+    int	key;
+    const struct policy *pol;
+
+    if (cont_key(path, &key)) {
+	fd = cont_open(path, key, O_CREAT|O_WRONLY|O_TRUNC, mode);
+	goto ext;
+    }
+    if ((pol = path_policy(path)) == NULL) {
+	fd = __real_creat(path, mode);
+	return fd;
+    }
+    DEBUG(DLEVEL_HIJACKED|DLEVEL_CONFIRM) {
+	fprintf(stderr, "%s DO-CARE path=%s\n", __func__, path);
+    }
+    if (pol->tier) tier_open(path, O_WRONLY);
+    fd = __real_creat(path, mode);
+    if (fd >= 0) {
+	info_init(fd, path, O_CREAT|O_WRONLY|O_TRUNC, mode, pol);
+    }
+ext:
+    if (fd >= 0) {
+	TRACE(IOMIDDLE_TR_OPEN, fd, 0, O_CREAT|O_WRONLY|O_TRUNC,
+	      strlen(path), path);
+    }
+    return fd;
+}
+
+/*
+ * open system call
+ */
+int
+_iomiddle_open(const char *path, int flags, ...)
+{
+    int	fd, key;
+    int mode = 0;
+    const struct policy *pol = path_policy(path);
+    int dont_care = (pol == NULL);
+
+    DEBUG(DLEVEL_ALL) {
+	fprintf(stderr, "[%d] %s path=%s\n", Myrank, __func__, path);
+    }
+    if (flags & O_CREAT) {
+        va_list arg;
+        va_start(arg, flags);
+        mode = va_arg(arg, int);
+        va_end(arg);
+    }
+    if (cont_key(path, &key)) {
+	fd = cont_open(path, key, flags, mode);
+	if (fd >= 0) {
+	    TRACE(IOMIDDLE_TR_OPEN, fd, 0, flags, strlen(path), path);
+	}
+	return fd;
+    }
+    if (dont_care) {
+	fd = __real_open(path, flags, mode);
+    } else {
+	int umode  = info_flagcheck(mode);
+	/* appended records are written at the offsets reserved */
+	int uflags = info_flagcheck(flags) & ~O_APPEND;
+	coll_init();
+	if (pol->tier) tier_open(path, flags);
+	fd = __real_open(path, uflags, umode);
+    }
+    if (fd < 0) goto err;
+    if (dont_care) {
+	info_dontcare(fd);
+    } else {
+	DEBUG(DLEVEL_HIJACKED|DLEVEL_CONFIRM) {
+	    fprintf(stderr, "[%d] open() DO-CARE file fd(%d) path(%s)\n",
+		    Myrank, fd, path);
+	}
+	info_init(fd, path, flags, mode, pol);
+	TRACE(IOMIDDLE_TR_OPEN, fd, 0, flags, strlen(path), path);
+    }
+err:
+    return fd;
+}
+
+/*
+ * close system call
+ *	The fd lock is kept until the fdinfo is cleared,
+ *	because the fd number may be reused by another thread.
+ */
+static int
+care_close(int fd)
+{
+    int	rc;
+    fdinfo	*info;
+    
+    info =  FDINFO(fd);
+    DEBUG(DLEVEL_HIJACKED) { fprintf(stderr, "%s DO-CARE fd(%d)\n", __func__, fd); }
+    if (info->cont) {
+	return cont_close(fd);
+    }
+    if (info->extmode && (info->flags & O_ACCMODE) != O_RDONLY) {
+	/* Other processes may still have data to be flushed */
+	while (ext_flush(info));
+	if (info->append) append_fin(info);
+    } else if (info->rma) {
+	if (info->win) rma_fin(info);
+    } else if (info->server) {
+	/* the status of the writes by the I/O server */
+	if (srv_close(info) < 0) info->wrerr = 1;
+    } else if (_inf.adaptive) {
+	/* flushing is always collective unless falling back */
+	if (info->ubuf && !info->bypass && info->rwmode == MODE_WRITE) {
+	    if (buf_flush_last(info) == (size_t) -1) info->wrerr = 1;
+	} else if (info->ubuf && !info->bypass
+		   && info->rwmode == MODE_READ) {
+	    /* matching the check of a process which has deviated */
+	    adapt_check(info);
+	}
+    } else if (_inf.progress && info->rwmode == MODE_WRITE) {
+	/* the last round is also handed to the progress thread */
+	do {
+	    prog_enqueue(info, 0, 1);
+	    prog_drain(info);
+	} while (!info->lastall);
+    } else if (info->ubuf && info->rwmode == MODE_WRITE) {
+	/* processes having no stripe in the last round also take part */
+	DEBUG(DLEVEL_BUFMGR) {
+	    dbgprintf("%s: bufcount(%d)\n", __func__, FDINFO(fd)->bufcount);
+	}
+	if (buf_flush_last(info) == (size_t) -1) info->wrerr = 1;
+    }
+    if (info->pol->trunc && info->trunc) {
+	off64_t	filpos = info->wrend;
+	/*
+	 * The file size is the largest end of writes over processes.
+	 * Every process has written its stripes when the reduction
+	 * completes, so that rank 0 sets the size by one ftruncate.
+	 */
+	MPI_CALL(MPI_Reduce(&info->wrend, &filpos, 1, MPI_LONG_LONG,
+			    MPI_MAX, 0, info->comm));
+	if (Myrank == 0 && ftruncate64(info->iofd, filpos) < 0) {
+	    dbgprintf("%s: ftruncate(%ld) failed, errno(%d)\n",
+		      __func__, (long) filpos, errno);
+	}
+    } else if (info->sparse) {
+	/* the file may end with a hole */
+	off64_t	filpos = info->wrend;
+	struct stat64	sb;
+	MPI_CALL(MPI_Reduce(&info->wrend, &filpos, 1, MPI_LONG_LONG,
+			    MPI_MAX, 0, info->comm));
+	if (Myrank == 0 && sys_fstat64(info->iofd, &sb) == 0
+	    && sb.st_size < filpos && ftruncate64(info->iofd, filpos) < 0) {
+	    dbgprintf("%s: ftruncate(%ld) failed, errno(%d)\n",
+		      __func__, (long) filpos, errno);
+	}
+    }
+    if ((info->flags & O_ACCMODE) != O_RDONLY) {
+	/* blocks read meanwhile through other file descriptors */
+	cache_invalidate(info);
+    }
+    tier_close(info);
+    rc = __real_close(fd);
+    if (info->wrerr && rc == 0) {
+	errno = EIO;
+	rc = -1;
+    }
+    info->wrerr = 0;
+    info->taillen = 0;
+    crc_close(info);
+    info->attrall = 0;
+    info->iofd = 0;
+    free(info->ubuf);
+    free(info->sbuf);
+    free(info->ext);
+    free(info->spare);
+    free(info->zmap);
+    info->spare = 0;
+    info->zmap = info->zall = 0;
+    info->ubuf = 0;
+    info->sbuf = 0;
+    info->ext = 0;
+    info->bufsize = info->sbufsize = 0;
+    info->extcnt = info->extmax = 0;
+    return rc;
+}
+
+int
+_iomiddle_close(int fd)
+{
+    int	rc;
+    fdinfo	*info;
+    struct commslot	*cs;
+
+    if ((info = care_lock(fd)) == NULL) {
+	rc = __real_close(fd);
+	return rc;
+    }
+    TRACE(IOMIDDLE_TR_CLOSE, fd, 0, 0, 0, NULL);
+    stat_invalidate(info);
+    rc = care_close(fd);
+    fd_setcare(fd, 0);
+    cs = info->cslot;
+    care_unlock(info);
+    /* the fd may be reused once unlocked, but cs is of this file */
+    comm_put(cs);
+    return rc;
+}
+
+/*
+ * write system call
+ *	DO not call printf/fprintf stuffs inside this function for debugging.
+ */
+static ssize_t
+care_write(int fd, const void *buf, size_t len)
+{
+    size_t	rc = len;
+    fdinfo	*info;
+    if (FDINFO(fd)->cont) {
+	return cont_write(FDINFO(fd), buf, len);
+    }
+    if (dontcare_mode_check(fd, MODE_WRITE)) {
+	rc = __real_write(fd, buf, len);
+	return rc;
+    }
+    DEBUG(DLEVEL_HIJACKED) {
+	DEBUGWRITE("[%d] %s DO-CARE fd(%d) len(%ld)\n",
+		   Myrank, __func__, fd, len);
+    }
+    info = FDINFO(fd);
+    if (_inf.detect && !info->notfirst && !info->extmode) {
+	pattern_detect(fd, len);
+    }
+    if (info->append) {
+	/* processes may append any number of records */
+	info->filpos = append_reserve(info, len);
+	ext_add(info, buf, len);
+	return len;
+    }
+    if (info->extmode) {
+	ext_add(info, buf, len);
+	if (info->bufcount == Nprocs) {
+	    ext_flush(info);
+	}
+	return len;
+    }
+    if (stripe_check_init(fd, len, 0)) {
+	DEBUG(DLEVEL_HIJACKED) { info_show(fd, __func__); }
+	abort();
+    }
+    if (info->bypass || info->deviant) {
+	rc = pwrite(info->iofd, buf, len, info->filpos);
+	if ((ssize_t) rc > 0) {
+	    info->filpos += rc;
+	    if (info->filpos > info->wrend) info->wrend = info->filpos;
+	    MON_ADD(written, rc);
+	}
+	info->dirty = 1;
+	if (!info->bypass) {
+	    adapt_join(info);
+	}
+	return rc;
+    }
+    IOMIDDLE_IFERROR((len > info->strsize || info->taillen),
+		     "write length must be the stripe size except the last. "
+		     "len(%ld) stripe size(%d)\n", len, info->strsize);
+    if (info->rma) {
+	if (len < info->strsize) {
+	    info->taillen = len;
+	}
+	rma_put(info, buf, len);
+	MON_ADD(staged, len);
+	info->filpos += len;
+	if (info->filpos > info->wrend) info->wrend = info->filpos;
+	return len;
+    }
+    if (info->crc) {
+	info->crcs[info->bufcount] = crc_copy(info->ubuf + info->bufpos,
+					      buf, len);
+    } else {
+	stage_copy(info->ubuf + info->bufpos, buf, len, 1);
+    }
+    MON_ADD(staged, len);
+    if (info->zmap) {
+	uint32_t	bit = 1U << (info->bufcount%32);
+	if (is_zero(buf, len)) {
+	    info->zmap[info->bufcount/32] |= bit;
+	} else {
+	    info->zmap[info->bufcount/32] &= ~bit;
+	}
+    }
+    if (len < info->strsize) {
+	info->taillen = len;
+    }
+    info->bufpos += info->strsize; info->bufcount++;
+    info->filpos += len;
+    /* written by the aggregator in buf_flush() or its variants */
+    if (info->filpos > info->wrend) info->wrend = info->filpos;
+    DEBUG(DLEVEL_BUFMGR) {
+	dbgprintf("bufcount(%d) mybufcount(%d) len(%ld) "
+		  "info->strsize(%d)\n",
+		  info->bufcount, info->mybufcount, len, info->strsize);
+    }
+    if (info->bufcount == info->mybufcount) {
+	if (info->server) {
+	    srv_flush(info, 1);
+	} else if (_inf.progress && !_inf.adaptive) {
+	    prog_enqueue(info, 0, 0);
+	} else if (buf_flush(info, 1, 0) == -1) {
+	    rc = -1;
+	}
+    }
+    return rc;
+}
+
+ssize_t
+_iomiddle_write(int fd, const void *buf, size_t len)
+{
+    ssize_t	rc;
+    fdinfo	*info;
+
+    if ((info = care_lock(fd)) == NULL) {
+	rc = __real_write(fd, buf, len);
+	return rc;
+    }
+    TRACE(IOMIDDLE_TR_WRITE, fd, 0, info->filpos, len, NULL);
+    stat_invalidate(info);
+    rc = care_write(fd, buf, len);
+    care_unlock(info);
+    return rc;
+}
+
+/*
+ * read system call
+ */
+static ssize_t
+care_read(int fd, void *buf, size_t len)
+{
+    size_t	rc = len;
+    fdinfo *info;
+    int		crcerr = 0;
+
+    if (FDINFO(fd)->cont) {
+	return cont_read(FDINFO(fd), buf, len);
+    }
+    if (dontcare_mode_check(fd, MODE_READ)) {
+	rc = __real_read(fd, buf, len);
+	return rc;
+    }
+    DEBUG(DLEVEL_HIJACKED) {
+	fprintf(stderr, "%s DO-CARE fd(%d) len(%ld)\n", __func__, fd, len);
+    }
+    info = FDINFO(fd);
+    if (_inf.bcast_auto && !info->rdfirst && !info->bcast && !info->extmode
+	&& (info->flags & O_ACCMODE) == O_RDONLY) {
+	bcast_detect(fd, len);
+    }
+    if (info->bcast) {
+	return bcast_read(info, buf, len);
+    }
+    if (_inf.detect && !info->notfirst && !info->extmode) {
+	pattern_detect(fd, len);
+    }
+    if (FDINFO(fd)->extmode) {
+	info = FDINFO(fd);
+	rc = file_pread(info, buf, len, info->filpos);
+	if ((ssize_t) rc > 0) {
+	    info->filpos += rc;
+	    MON_ADD(read, rc);
+	}
+	return rc;
     }
-    info = &_inf.fdinfo[fd];
     if (stripe_check_init(fd, len, 0)) {
 	DEBUG(DLEVEL_HIJACKED) { info_show(fd, __func__); }
 	abort();
     }
-    IOMIDDLE_IFERROR((len != info->strsize),
-		     "write length must be the stripe size. "
-		     "len(%ld) stripe size(%d)\n", len, info->strsize);
-    memcpy(info->ubuf + info->bufpos, buf, len);
-    info->bufpos += len; info->bufcount++;
-    info->filpos += len;
-    DEBUG(DLEVEL_BUFMGR) {
-	dbgprintf("bufcount(%d) mybufcount(%d) len(%ld) "
-		  "info->strsize(%d)\n",
-		  info->bufcount, _inf.mybufcount, len, info->strsize);
+    info = FDINFO(fd);
+    if (_inf.adaptive && !info->bypass && info->rwmode == MODE_READ
+	&& info->bufcount == 0) {
+	/* checking deviation at the beginning of each round */
+	adapt_check(info);
+    }
+    if (info->bypass || info->deviant) {
+	if (!info->bypass) {
+	    adapt_join(info);
+	}
+	rc = file_pread(info, buf, len, info->filpos);
+	if ((ssize_t) rc > 0) {
+	    info->filpos += rc;
+	    MON_ADD(read, rc);
+	}
+	return rc;
+    }
+    if (info->bufpos == 0) {
+	buf_fill(info);
+    }
+    /* the stripe may be truncated at the end of file */
+    if (info->filsize >= 0 && info->filpos + len > info->filsize) {
+	rc = (info->filpos < info->filsize) ? info->filsize - info->filpos : 0;
+    }
+    if (info->crc && (ssize_t) rc > 0) {
+	/* the copy-out verifies the stripe */
+	int		k = info->bufcount*Nprocs + Myrank;
+	uint32_t	crc = crc_copy(buf, info->ubuf + info->bufpos, rc);
+	if (k < info->crcrecs && info->crcall[k] != 0
+	    && info->crcall[k] != crc) {
+	    dbgprintf("%s: checksum error at offset %ld, "
+		      "crc(%08x) record(%08x)\n", __func__,
+		      (long) info->filpos, crc, info->crcall[k]);
+	    crcerr = 1;
+	}
+    } else {
+	stage_copy(buf, info->ubuf + info->bufpos, rc, 0);
+    }
+    info->bufpos += len; info->bufcount++;
+    info->filpos += rc;
+    if (info->bufcount == info->mybufcount) {
+	info->filcurb += info->mybufcount;
+	info->bufcount = 0;
+	info->bufpos = 0;
+    }
+    if (crcerr) {
+	errno = EIO;
+	return -1;
+    }
+    return rc;
+}
+
+ssize_t
+_iomiddle_read(int fd, void *buf, size_t len)
+{
+    ssize_t	rc;
+    fdinfo	*info;
+
+    if ((info = care_lock(fd)) == NULL) {
+	rc = __real_read(fd, buf, len);
+	return rc;
+    }
+    TRACE(IOMIDDLE_TR_READ, fd, 0, info->filpos, len, NULL);
+    rc = care_read(fd, buf, len);
+    care_unlock(info);
+    return rc;
+}
+
+/*
+ * lseek64 system call
+ */
+static off64_t
+care_lseek64(int fd, off64_t offset, int whence)
+{
+    off64_t	rc = 0;
+    off64_t	reqfilpos;
+    fdinfo	*info = FDINFO(fd);
+
+    DEBUG(DLEVEL_HIJACKED) {
+	dbgprintf("%s DO-CARE fd(%d) offset(%ld) whence(%d)\n",
+		  __func__, fd, offset, whence);
+    }
+    if (info->cont) {
+	return cont_lseek(info, offset, whence);
+    }
+    if (info->append) {
+	/* writes go to the end reserved anyway */
+	switch (whence) {
+	case SEEK_SET: rc = offset; break;
+	case SEEK_CUR: rc = info->filpos + offset; break;
+	case SEEK_END: rc = append_end(info) + offset; break;
+	default: errno = EINVAL; return -1;
+	}
+	if (rc < 0) {
+	    errno = EINVAL;
+	    return -1;
+	}
+	info->filpos = rc;
+	return rc;
+    }
+    if (info->bcast
+	|| (_inf.bcast_auto && !info->rdfirst && !info->extmode
+	    && (info->flags & O_ACCMODE) == O_RDONLY)) {
+	/* any offset is allowed in the replicated-read mode,
+	 * and lseek before the first read is checked at the read */
+	switch (whence) {
+	case SEEK_SET: rc = offset; break;
+	case SEEK_CUR: rc = info->filpos + offset; break;
+	default: rc = __real_lseek64(fd, offset, whence); break;
+	}
+	if (rc >= 0) info->filpos = rc;
+	return rc;
+    }
+    switch (whence) {
+    case SEEK_SET:
+	reqfilpos = offset;
+	break;
+    case SEEK_CUR:
+	reqfilpos = FDINFO(fd)->filpos + offset;
+	break;
+    case SEEK_END:
+	IOMIDDLE_IFUNFIT(1, adapt_deviate(FDINFO(fd)),
+			 "lseek64: whence(%d) is not allowed\n", whence);
+	reqfilpos = __real_lseek64(fd, offset, SEEK_END);
+	break;
+    default:
+	fprintf(stderr, "lseek64: unknown whence value %d\n", whence);
+	abort();
+    }
+    if (FDINFO(fd)->extmode) {
+	/* any offset is allowed in the extent mode */
+	rc = FDINFO(fd)->filpos = reqfilpos;
+	return rc;
+    }
+    /* if this call is issued prior to read/write.
+     * rqfilpos must be equal to stripe size. */
+    if (stripe_check_init(fd, reqfilpos, 1)) {
+	DEBUG(DLEVEL_HIJACKED) { info_show(fd, __func__); }
+	abort();
+    }
+    /* file position is now reqfilpos */
+    rc = FDINFO(fd)->filpos = reqfilpos;
+    if (FDINFO(fd)->bypass || FDINFO(fd)->deviant
+	|| !FDINFO(fd)->notfirst) {
+	/* the pattern is not determined yet */
+	return rc;
+    }
+    /* lseek with 0 offset may be issued by rank 0.
+     *  In this case, this request is ignored. */
+    /* FIXME:
+     * Must check if Rank 0 issues lseek offset = 0 after the first lseek issue */
+    if (!(Myrank == 0 && reqfilpos == 0)) {
+	int	strsize  = FDINFO(fd)->strsize;
+	int	strcnt   = FDINFO(fd)->strcnt;
+	off64_t	strnum   = reqfilpos/strsize;
+	int	expct_rank = strnum % strcnt;
+	off64_t	blks     = strnum/strcnt;
+	off64_t	tailblk  = FDINFO(fd)->filcurb + FDINFO(fd)->bufcount;
+
+	DEBUG(DLEVEL_BUFMGR) {
+	    dbgprintf("%s: strnum(%ld) blks(%ld) strsize(%d)\n",
+		      __func__, strnum, blks, strsize);
+	}
+	/* checking if the file position is algined to this rank */
+	IOMIDDLE_IFUNFIT((expct_rank != Myrank),
+			 adapt_deviate(FDINFO(fd)),
+			 "lseek64: offset is not expected in this rank. "
+			 "response rank=%d offset=%lx\n",
+			 expct_rank, reqfilpos);
+	/* checking if this file position is the next */
+	IOMIDDLE_IFUNFIT((blks != tailblk),
+			 adapt_deviate(FDINFO(fd)),
+			 "[%d] lseek64: offset is out of block area: %ld "
+			 " (blks(%ld) tailblks(%ld))\n",
+			 Myrank, reqfilpos, blks, tailblk);
+    }
+    return rc;
+}
+
+off64_t
+_iomiddle_lseek64(int fd, off64_t offset, int whence)
+{
+    off64_t	rc;
+    fdinfo	*info;
+
+    if ((info = care_lock(fd)) == NULL) {
+	rc = __real_lseek64(fd, offset, whence);
+	return rc;
+    }
+    TRACE(IOMIDDLE_TR_LSEEK, fd, whence, offset, 0, NULL);
+    rc = care_lseek64(fd, offset, whence);
+    care_unlock(info);
+    return rc;
+}
+
+/*
+ * fsync and fdatasync system calls
+ *	Collective on a care file descriptor opened for write.
+ *	datasync is 1 for fdatasync, and 0 for fsync.
+ */
+static int
+care_sync(int fd, int datasync)
+{
+    fdinfo	*info = FDINFO(fd);
+    int		rc = 0, grc;
+
+    DEBUG(DLEVEL_HIJACKED) {
+	dbgprintf("%s DO-CARE fd(%d) bufcount(%d) bufdone(%d)\n",
+		  __func__, fd, info->bufcount, info->bufdone);
+    }
+    if (info->cont) {
+	/* the container is written at close */
+	return 0;
+    }
+    if ((info->flags & O_ACCMODE) == O_RDONLY) {
+	rc = datasync ? __real_fdatasync(fd) : __real_fsync(fd);
+	return rc;
+    }
+    if (info->extmode) {
+	ext_flush(info);
+    } else if (_inf.progress && !_inf.adaptive) {
+	/* the progress thread flushes and syncs after queued rounds */
+	prog_enqueue(info, datasync ? 1 : 2, 0);
+	if (_inf.async_sync) {
+	    return 0;
+	}
+	prog_drain(info);
+	if (info->syncerr) {
+	    info->syncerr = 0;
+	    errno = EIO;
+	    return -1;
+	}
+	return 0;
+    } else if (info->server) {
+	rc = srv_sync(info, datasync);
+    } else if (info->rma) {
+	if (info->win) rma_drain(info, 0);
+    } else if (info->ubuf && !info->bypass) {
+	if (buf_flush(info, 0, 0) == (size_t) -1) {
+	    /* a block of this aggregator is lost */
+	    rc = -1;
+	}
+    }
+    if (info->wrerr) {
+	/* including writes of the earlier rounds */
+	info->wrerr = 0;
+	rc = -1;
+    }
+    if (info->tier && tier_wait(info->tier) < 0) {
+	rc = -1;
+    }
+    if (info->dirty) {
+	rc |= datasync ? __real_fdatasync(fd) : __real_fsync(fd);
+	info->dirty = 0;
+    }
+    MPI_CALL(MPI_Allreduce(&rc, &grc, 1, MPI_INT, MPI_MIN, info->comm));
+    if (grc < 0) {
+	errno = EIO;
+	return -1;
+    }
+    return 0;
+}
+
+int
+_iomiddle_fsync(int fd)
+{
+    int		rc;
+    fdinfo	*info;
+
+    if ((info = care_lock(fd)) == NULL) {
+	rc = __real_fsync(fd);
+	return rc;
+    }
+    TRACE(IOMIDDLE_TR_FSYNC, fd, 0, 0, 0, NULL);
+    rc = care_sync(fd, 0);
+    care_unlock(info);
+    return rc;
+}
+
+int
+_iomiddle_fdatasync(int fd)
+{
+    int		rc;
+    fdinfo	*info;
+
+    if ((info = care_lock(fd)) == NULL) {
+	rc = __real_fdatasync(fd);
+	return rc;
+    }
+    TRACE(IOMIDDLE_TR_FSYNC, fd, 1, 0, 0, NULL);
+    rc = care_sync(fd, 1);
+    care_unlock(info);
+    return rc;
+}
+
+/*
+ * Completion of asynchronous syncs, see iomiddle.h
+ */
+int
+iomiddle_sync_test(int fd)
+{
+    fdinfo	*info;
+    int		rc;
+
+    if (is_dontcare_fd(fd)) {
+	return 1;
+    }
+    info = FDINFO(fd);
+    pthread_mutex_lock(&_inf.progmtx);
+    rc = info->syncerr ? -1 : (info->syncpend == 0);
+    if (info->syncpend == 0) {
+	info->syncerr = 0;
+    }
+    pthread_mutex_unlock(&_inf.progmtx);
+    return rc;
+}
+
+int
+iomiddle_sync_wait(int fd)
+{
+    fdinfo	*info;
+    int		rc;
+
+    if (is_dontcare_fd(fd)) {
+	return 0;
+    }
+    info = FDINFO(fd);
+    pthread_mutex_lock(&_inf.progmtx);
+    while (info->syncpend > 0) {
+	prog_wait();
+    }
+    rc = info->syncerr ? -1 : 0;
+    info->syncerr = 0;
+    pthread_mutex_unlock(&_inf.progmtx);
+    return rc;
+}
+
+/*
+ * Native collective interface, see iomiddle.h
+ *	The hints are applied before the first access, which otherwise
+ *	infers the stripe size.
+ */
+int
+iomiddle_open(const char *path, int flags, mode_t mode,
+	      const struct iomiddle_hints *hints)
+{
+    const struct policy *pol;
+    fdinfo	*info;
+    int		fd;
+
+    _hijack_ensure();
+    if (_inf.fdcare == NULL) {
+	/* IOMIDDLE_DISABLE */
+	return __real_open(path, flags, mode);
+    }
+    if (hints && (hints->strsize < 0 || hints->strsize > INT_MAX
+		  || hints->naggr < 0 || hints->depth < 0)) {
+	errno = EINVAL;
+	return -1;
+    }
+    if ((pol = path_policy(path)) == NULL) {
+	pol = &_inf.defpol;
+    }
+    coll_init();
+    if (pol->tier) tier_open(path, flags);
+    fd = __real_open(path, info_flagcheck(flags) & ~O_APPEND, mode);
+    if (fd < 0) {
+	return fd;
+    }
+    DEBUG(DLEVEL_HIJACKED|DLEVEL_CONFIRM) {
+	fprintf(stderr, "[%d] %s fd(%d) path(%s)\n", Myrank, __func__, fd, path);
+    }
+    info_init(fd, path, flags, mode, pol);
+    TRACE(IOMIDDLE_TR_OPEN, fd, 0, flags, strlen(path), path);
+    if (hints == NULL || hints->strsize == 0) {
+	return fd;
+    }
+    if ((info = care_lock(fd)) == NULL) {
+	return fd;
+    }
+    info->naggr = hints->naggr;
+    info->depth = hints->depth;
+    if (!info->extmode && !info->bcast) {
+	if (_inf.adaptive) {
+	    adapt_decide(fd, 1, hints->strsize);
+	}
+	if (info->bypass) {
+	    info->notfirst = 1;
+	} else {
+	    buf_init(fd, hints->strsize);
+	}
+    }
+    care_unlock(info);
+    return fd;
+}
+
+ssize_t
+iomiddle_write_all(int fd, const void *buf, size_t len, int64_t off)
+{
+    ssize_t	rc;
+    fdinfo	*info;
+
+    if ((info = care_lock(fd)) == NULL) {
+	return pwrite(fd, buf, len, off);
+    }
+    TRACE(IOMIDDLE_TR_LSEEK, fd, SEEK_SET, off, 0, NULL);
+    TRACE(IOMIDDLE_TR_WRITE, fd, 0, off, len, NULL);
+    stat_invalidate(info);
+    rc = care_lseek64(fd, off, SEEK_SET);
+    if (rc >= 0) {
+	rc = care_write(fd, buf, len);
+    }
+    care_unlock(info);
+    return rc;
+}
+
+ssize_t
+iomiddle_read_all(int fd, void *buf, size_t len, int64_t off)
+{
+    ssize_t	rc;
+    fdinfo	*info;
+
+    if ((info = care_lock(fd)) == NULL) {
+	return pread(fd, buf, len, off);
+    }
+    TRACE(IOMIDDLE_TR_LSEEK, fd, SEEK_SET, off, 0, NULL);
+    TRACE(IOMIDDLE_TR_READ, fd, 0, off, len, NULL);
+    rc = care_lseek64(fd, off, SEEK_SET);
+    if (rc >= 0) {
+	rc = care_read(fd, buf, len);
+    }
+    care_unlock(info);
+    return rc;
+}
+
+int
+iomiddle_close(int fd)
+{
+    return _iomiddle_close(fd);
+}
+
+/*
+ * Stat caching:
+ *	The length of a care file known to this process, including data
+ *	buffered in this middleware but not written yet.
+ */
+static off64_t
+stat_buffered(fdinfo *info)
+{
+    off64_t	len = 0;
+    int		i;
+
+    if (info->extmode) {
+	for (i = 0; i < info->extcnt; i++) {
+	    if (info->ext[i].off + info->ext[i].len > len) {
+		len = info->ext[i].off + info->ext[i].len;
+	    }
+	}
+    } else if (info->rma) {
+	/* all processes have written as many stripes */
+	len = (off64_t) info->filcurb*info->filblklen;
+    } else if (info->rwmode == MODE_WRITE && !info->bypass
+	       && (info->bufcount > 0 || info->njobs > 0 || info->server)) {
+	/*
+	 * all processes have the same # of stripes in this round, and
+	 * rounds before it may be still in the server
+	 */
+	len = (off64_t)(info->filcurb + info->bufcount)*info->filblklen;
+    }
+    return len;
+}
+
+/*
+ * st_size of a care file descriptor
+ */
+static off64_t
+stat_size(fdinfo *info, off64_t size)
+{
+    off64_t	len;
+
+    if (info->cont) {
+	return info->clen;
+    }
+    len = stat_buffered(info);
+    return len > size ? len : size;
+}
+
+/*
+ * The largest buffered length of care files opened by this process
+ * whose device and inode are the given ones
+ */
+static off64_t
+stat_buffered_path(dev_t dev, ino_t ino)
+{
+    off64_t	len = 0, l;
+    int		fd, fdhigh;
+
+    fdhigh = __atomic_load_n(&_inf.fdhigh, __ATOMIC_ACQUIRE);
+    for (fd = 3; fd < fdhigh; fd++) {
+	fdinfo	*info;
+	if (is_dontcare_fd(fd)) continue;
+	info = FDINFO(fd);
+	pthread_mutex_lock(&info->lock);
+	if (!is_dontcare_fd(fd) && info->stdev == dev && info->stino == ino) {
+	    l = stat_buffered(info);
+	    if (l > len) len = l;
+	}
+	pthread_mutex_unlock(&info->lock);
+    }
+    return len;
+}
+
+static inline double
+stat_now()
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/*
+ * Looking up the cache of rank 0.  Stale entries are dropped.
+ */
+static int
+stat_cache_get(const char *path, int nofollow, struct stat64 *sb)
+{
+    int		i, found = 0;
+    double	now = stat_now();
+
+    pthread_mutex_lock(&_inf.statlock);
+    for (i = 0; i < _inf.statcnt; i++) {
+	struct statent	*ent = &_inf.statcache[i];
+	if (now - ent->time > _inf.statttl) {
+	    free(ent->path);
+	    *ent = _inf.statcache[--_inf.statcnt];
+	    i--;
+	} else if (ent->nofollow == nofollow && !strcmp(ent->path, path)) {
+	    *sb = ent->st;
+	    found = 1;
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&_inf.statlock);
+    return found;
+}
+
+static void
+stat_cache_put(const char *path, int nofollow, struct stat64 *sb)
+{
+    struct statent	*ent;
+    char		*cp;
+    int			i, old = 0;
+
+    if (_inf.statttl <= 0 || (cp = strdup(path)) == NULL) {
+	return;
+    }
+    pthread_mutex_lock(&_inf.statlock);
+    if (_inf.statcnt < STAT_CACHE_MAX) {
+	ent = &_inf.statcache[_inf.statcnt++];
+    } else {
+	/* replacing the oldest one */
+	for (i = 1; i < _inf.statcnt; i++) {
+	    if (_inf.statcache[i].time < _inf.statcache[old].time) old = i;
+	}
+	ent = &_inf.statcache[old];
+	free(ent->path);
     }
-    if (info->bufcount == _inf.mybufcount) {
-	rc = buf_flush(info);
-	if (rc == -1) goto ext;
+    ent->path = cp;
+    ent->nofollow = nofollow;
+    ent->time = stat_now();
+    ent->st = *sb;
+    pthread_mutex_unlock(&_inf.statlock);
+}
+
+/*
+ * Dropping entries of the file, which is written, truncated or closed
+ * by this process.  The cache is only kept by rank 0.
+ */
+static void
+stat_invalidate(fdinfo *info)
+{
+    int	i;
+
+    if (__atomic_load_n(&_inf.statcnt, __ATOMIC_RELAXED) == 0) {
+	return;
     }
- ext:
-    if (rc == info->filblklen) {
-	rc = len;
+    pthread_mutex_lock(&_inf.statlock);
+    for (i = 0; i < _inf.statcnt; i++) {
+	struct statent	*ent = &_inf.statcache[i];
+	if (ent->st.st_dev == info->stdev && ent->st.st_ino == info->stino) {
+	    free(ent->path);
+	    *ent = _inf.statcache[--_inf.statcnt];
+	    i--;
+	}
     }
-    return rc;
+    pthread_mutex_unlock(&_inf.statlock);
 }
 
 /*
- * read system call
+ * stat and lstat of a care path in the collective stat mode
+ *	Rank 0 stats the path, or finds it in the cache, and broadcasts
+ *	the result.  st_size is extended by the buffered length.
  */
-ssize_t
-_iomiddle_read(int fd, void *buf, size_t len)
+static int
+stat_collective(const char *path, int nofollow, struct stat64 *sb)
 {
-    size_t	rc = len;
-    fdinfo *info;
+    struct {
+	int		rc;
+	int		err;
+	struct stat64	st;
+    } res;
+    long long		len;
+    struct commslot	*cs;
 
-    if (dontcare_mode_check(fd, MODE_READ)) {
-	rc = __real_read(fd, buf, len);
-	return rc;
+    coll_init();
+    cs = comm_get(path);
+    memset(&res, 0, sizeof(res));
+    if (Myrank == 0 && !stat_cache_get(path, nofollow, &res.st)) {
+	res.rc = fstatat64(AT_FDCWD, path, &res.st,
+			   nofollow ? AT_SYMLINK_NOFOLLOW : 0);
+	res.err = errno;
+	if (res.rc == 0) {
+	    stat_cache_put(path, nofollow, &res.st);
+	}
     }
+    pthread_mutex_lock(&cs->lock);
+    MPI_CALL(MPI_Bcast(&res, sizeof(res), MPI_BYTE, 0, cs->comm));
+    pthread_mutex_unlock(&cs->lock);
+    /* fd locks are not taken while holding the communicator lock */
+    len = (res.rc == 0) ? stat_buffered_path(res.st.st_dev, res.st.st_ino) : 0;
+    pthread_mutex_lock(&cs->lock);
+    MPI_CALL(MPI_Allreduce(MPI_IN_PLACE, &len, 1, MPI_LONG_LONG, MPI_MAX,
+			   cs->comm));
+    pthread_mutex_unlock(&cs->lock);
+    comm_put(cs);
     DEBUG(DLEVEL_HIJACKED) {
-	fprintf(stderr, "%s DO-CARE fd(%d) len(%ld)\n", __func__, fd, len);
+	dbgprintf("%s: path(%s) rc(%d) size(%lld) buffered(%lld)\n", __func__,
+		  path, res.rc, (long long) res.st.st_size, len);
     }
-    if (stripe_check_init(fd, len, 0)) {
-	DEBUG(DLEVEL_HIJACKED) { info_show(fd, __func__); }
-	abort();
+    if (res.rc < 0) {
+	errno = res.err;
+	return -1;
     }
-    info = &_inf.fdinfo[fd];
-    if (info->bufpos == 0) {
-	int	i, off = 0;
-	size_t	cc;
-
-	cc = __real_read(info->iofd, info->sbuf, info->bufsize);
-	/* Though read opertaion returns error, other processes may success.
-	 * Thus error is checked after Scatter */
-	for (i = 0; i < Nprocs; i++) {
-	    MPI_CALL(
-		MPI_Scatter(info->sbuf, info->strsize, MPI_BYTE,
-			    info->ubuf + off, info->strsize, MPI_BYTE,
-			    i, MPI_COMM_WORLD));
-	    off += info->strsize;
-	}
-	if ((int64_t) cc < 0) {
-	    rc = cc;
-	    goto ext;
-	} else if (cc < _inf.fdinfo[fd].bufsize) {
-	    /* truncated ? */
-	    rc = cc/Nprocs;
-	    goto ext;
-	}
+    if (len > res.st.st_size) {
+	res.st.st_size = len;
     }
-    memcpy(buf, info->ubuf + info->bufpos, len);
-    info->bufpos += len; info->bufcount++;
-    info->filpos += len;
-    if (info->bufcount == _inf.mybufcount) {
-	info->bufcount = 0;
-	info->bufpos = 0;
+    *sb = res.st;
+    return 0;
+}
+
+static void
+stat_from64(struct stat *sb, const struct stat64 *sb64)
+{
+    memset(sb, 0, sizeof(*sb));
+    sb->st_dev = sb64->st_dev;
+    sb->st_ino = sb64->st_ino;
+    sb->st_mode = sb64->st_mode;
+    sb->st_nlink = sb64->st_nlink;
+    sb->st_uid = sb64->st_uid;
+    sb->st_gid = sb64->st_gid;
+    sb->st_rdev = sb64->st_rdev;
+    sb->st_size = sb64->st_size;
+    sb->st_blksize = sb64->st_blksize;
+    sb->st_blocks = sb64->st_blocks;
+    sb->st_atim = sb64->st_atim;
+    sb->st_mtim = sb64->st_mtim;
+    sb->st_ctim = sb64->st_ctim;
+}
+
+/*
+ * Whether stat of the path is collective.  MPI must be active.
+ */
+static int
+is_stat_collective(const char *path)
+{
+    int	flag;
+
+    if (!_inf.statcoll || path_policy(path) == NULL) {
+	return 0;
     }
-ext:
-    return rc;
+    MPI_Initialized(&flag);
+    if (!flag) return 0;
+    MPI_Finalized(&flag);
+    return !flag;
 }
 
 /*
- * lseek64 system call
+ * stat system calls
  */
-off64_t
-_iomiddle_lseek64(int fd, off64_t offset, int whence)
+int
+_iomiddle_stat(const char *path, struct stat *sb)
 {
-    off64_t	rc = 0;
-    off64_t	reqfilpos;
+    struct stat64	st;
 
-    if (_inf.fdinfo[fd].dntcare || _inf.fdinfo[fd].iofd == 0) {
-	rc = __real_lseek64(fd, offset, whence);
-	return rc;
+    if (!is_stat_collective(path)) {
+	return __real_stat(path, sb);
     }
-    DEBUG(DLEVEL_HIJACKED) {
-	dbgprintf("%s DO-CARE fd(%d) offset(%ld) whence(%d)\n",
-		  __func__, fd, offset, whence);
+    if (stat_collective(path, 0, &st) < 0) {
+	return -1;
     }
-    switch (whence) {
-    case SEEK_SET:
-	reqfilpos = offset;
-	break;
-    case SEEK_CUR:
-	reqfilpos = _inf.fdinfo[fd].filpos + offset;
-	break;
-    case SEEK_END:
-	fprintf(stderr, "lseek64: whence(%d) is not allowed\n", whence);
-	abort();
-    default:
-	fprintf(stderr, "lseek64: unknown whence value %d\n", whence);
-	abort();
+    stat_from64(sb, &st);
+    return 0;
+}
+
+int
+_iomiddle_stat64(const char *path, struct stat64 *sb)
+{
+    if (!is_stat_collective(path)) {
+	return __real_stat64(path, sb);
     }
-    /* if this call is issued prior to read/write.
-     * rqfilpos must be equal to stripe size. */
-    if (stripe_check_init(fd, reqfilpos, 1)) {
-	DEBUG(DLEVEL_HIJACKED) { info_show(fd, __func__); }
-	abort();
+    return stat_collective(path, 0, sb);
+}
+
+int
+_iomiddle_lstat(const char *path, struct stat *sb)
+{
+    struct stat64	st;
+
+    if (!is_stat_collective(path)) {
+	return __real_lstat(path, sb);
     }
-    /* file position is now reqfilpos */
-    rc = _inf.fdinfo[fd].filpos = reqfilpos;
-    /* lseek with 0 offset may be issued by rank 0.
-     *  In this case, this request is ignored. */
-    /* FIXME:
-     * Must check if Rank 0 issues lseek offset = 0 after the first lseek issue */
-    if (!(Myrank == 0 && reqfilpos == 0)) {
-	int	strsize  = _inf.fdinfo[fd].strsize;
-	int	strcnt   = _inf.fdinfo[fd].strcnt;
-	int	strnum   = reqfilpos/strsize;
-	int	expct_rank = strnum % strcnt;
-	int	blks     = (strnum/(strcnt*Nprocs))*Nprocs + Myrank;
+    if (stat_collective(path, 1, &st) < 0) {
+	return -1;
+    }
+    stat_from64(sb, &st);
+    return 0;
+}
 
-	DEBUG(DLEVEL_BUFMGR) {
-	    dbgprintf("%s: strnum(%d) blks(%d) strsize(%d)\n",
-		      __func__, strnum, blks, strsize);
-	}
-	/* checking if the file position is algined to this rank */
-	IOMIDDLE_IFERROR((expct_rank != Myrank),
-			 "lseek64: offset is not expected in this rank. "
-			 "response rank=%d offset=%lx\n",
-			 expct_rank, reqfilpos);
-	/* checking if this file position is the next */
-	IOMIDDLE_IFERROR((blks != _inf.fdinfo[fd].filtail),
-			 "[%d] lseek64: offset is out of block area: %ld "
-			 " (blks(%d) tailblks(%d))\n",
-			 Myrank, reqfilpos, blks, _inf.fdinfo[fd].filtail);
+int
+_iomiddle_lstat64(const char *path, struct stat64 *sb)
+{
+    if (!is_stat_collective(path)) {
+	return __real_lstat64(path, sb);
+    }
+    return stat_collective(path, 1, sb);
+}
+
+int
+_iomiddle___xstat(int vers, const char *path, struct stat *sb)
+{
+    struct stat64	st;
+
+    if (!is_stat_collective(path)) {
+	return __real___xstat(vers, path, sb);
+    }
+    if (stat_collective(path, 0, &st) < 0) {
+	return -1;
+    }
+    stat_from64(sb, &st);
+    return 0;
+}
+
+int
+_iomiddle___xstat64(int vers, const char *path, struct stat64 *sb)
+{
+    if (!is_stat_collective(path)) {
+	return __real___xstat64(vers, path, sb);
+    }
+    return stat_collective(path, 0, sb);
+}
+
+int
+_iomiddle___lxstat(int vers, const char *path, struct stat *sb)
+{
+    struct stat64	st;
+
+    if (!is_stat_collective(path)) {
+	return __real___lxstat(vers, path, sb);
+    }
+    if (stat_collective(path, 1, &st) < 0) {
+	return -1;
+    }
+    stat_from64(sb, &st);
+    return 0;
+}
+
+int
+_iomiddle___lxstat64(int vers, const char *path, struct stat64 *sb)
+{
+    if (!is_stat_collective(path)) {
+	return __real___lxstat64(vers, path, sb);
+    }
+    return stat_collective(path, 1, sb);
+}
+
+/*
+ * fstat system calls
+ *	Not collective.  st_size of a care file descriptor is extended by
+ *	the buffered length.
+ */
+int
+_iomiddle_fstat(int fd, struct stat *sb)
+{
+    int		rc;
+    fdinfo	*info;
+
+    if ((info = care_lock(fd)) == NULL) {
+	return __real_fstat(fd, sb);
+    }
+    rc = __real_fstat(fd, sb);
+    if (rc == 0) {
+	sb->st_size = stat_size(info, sb->st_size);
+    }
+    care_unlock(info);
+    return rc;
+}
+
+int
+_iomiddle_fstat64(int fd, struct stat64 *sb)
+{
+    int		rc;
+    fdinfo	*info;
+
+    if ((info = care_lock(fd)) == NULL) {
+	return __real_fstat64(fd, sb);
+    }
+    rc = __real_fstat64(fd, sb);
+    if (rc == 0) {
+	sb->st_size = stat_size(info, sb->st_size);
+    }
+    care_unlock(info);
+    return rc;
+}
+
+int
+_iomiddle___fxstat(int vers, int fd, struct stat *sb)
+{
+    int		rc;
+    fdinfo	*info;
+
+    if ((info = care_lock(fd)) == NULL) {
+	return __real___fxstat(vers, fd, sb);
+    }
+    rc = __real___fxstat(vers, fd, sb);
+    if (rc == 0) {
+	sb->st_size = stat_size(info, sb->st_size);
+    }
+    care_unlock(info);
+    return rc;
+}
+
+int
+_iomiddle___fxstat64(int vers, int fd, struct stat64 *sb)
+{
+    int		rc;
+    fdinfo	*info;
+
+    if ((info = care_lock(fd)) == NULL) {
+	return __real___fxstat64(vers, fd, sb);
+    }
+    rc = __real___fxstat64(vers, fd, sb);
+    if (rc == 0) {
+	sb->st_size = stat_size(info, sb->st_size);
     }
+    care_unlock(info);
     return rc;
 }
 
@@ -607,7 +6462,6 @@ _myhijack_init()
     int	i;
     char	*cp;
     struct rlimit rlim;
-    size_t	sz;
 
     cp = getenv("IOMIDDLE_DISABLE");
     if (cp && atoi(cp) == 1) {
@@ -618,19 +6472,185 @@ _myhijack_init()
     if (cp && atoi(cp) > 0) {
 	_inf.debug = atoi(cp);
     }
-    cp = getenv("IOMIDDLE_CARE_PATH");
-    if (cp) {
-	strcpy(care_path, cp);
-    } else {
+#ifndef IOMIDDLE_WRAP
+    /* the program linked with libiomiddle.a may only use iomiddle_open */
+    if (!getenv("IOMIDDLE_CARE_PATH") && !getenv("IOMIDDLE_CONFIG")) {
 	printf("IOMIDDLE_CARE_PATH must be specified\n");
 	exit(-1);
     }
+#endif
     cp = getenv("IOMIDDLE_TRUNC");
     if (cp && atoi(cp) > 0) {
 	_inf.reqtrunc = 1;
     }
-    DEBUG(DLEVEL_CONFIRM) {
-	printf("IOMIDDLE_CARE_PATH = %s\n", care_path);
+    cp = getenv("IOMIDDLE_ADAPTIVE");
+    if (cp && atoi(cp) > 0) {
+	_inf.adaptive = 1;
+    }
+    cp = getenv("IOMIDDLE_DETECT");
+    if (cp && atoi(cp) > 0) {
+	_inf.detect = 1;
+    }
+    _inf.bypass_size = BYPASS_SIZE_DEFAULT;
+    cp = getenv("IOMIDDLE_SPARSE");
+    if (cp && atoi(cp) > 0) {
+	_inf.sparse = atoi(cp) >= SPARSE_SEND ? SPARSE_SEND : SPARSE_WRITE;
+    }
+    cp = getenv("IOMIDDLE_TIER");
+    if (cp && *cp) {
+	_inf.tierdir = cp;
+	pthread_mutex_init(&_inf.tierlock, NULL);
+	pthread_cond_init(&_inf.tiercond, NULL);
+	pthread_cond_init(&_inf.tierdone, NULL);
+    }
+    cp = getenv("IOMIDDLE_CACHE");
+    if (cp && size_parse(cp) > 0) {
+	_inf.cachemax = size_parse(cp);
+	_inf.cachehash = calloc(CACHE_HASH, sizeof(struct blkent*));
+	IOMIDDLE_IFERROR((_inf.cachehash == 0), "%s",
+			 "Cannot allocate working memory\n");
+	pthread_mutex_init(&_inf.cachelock, NULL);
+    }
+    cp = getenv("IOMIDDLE_BYPASS_SIZE");
+    if (cp && atol(cp) > 0) {
+	_inf.bypass_size = atol(cp);
+    }
+    cp = getenv("IOMIDDLE_MEMLIMIT");
+    if (cp) {
+	_inf.memlimit = size_parse(cp);
+    }
+    cp = getenv("IOMIDDLE_BCAST_AUTO");
+    if (cp && atoi(cp) > 0) {
+	_inf.bcast_auto = 1;
+    }
+    cp = getenv("IOMIDDLE_BCAST_SCOPE");
+    if (cp && !strcmp(cp, "node")) {
+	_inf.bcast_node = 1;
+    }
+    cp = getenv("IOMIDDLE_CONTAINER");
+    if (cp && strstr(cp, "%d")) {
+	strcpy(cont_pattern, cp);
+	cp = getenv("IOMIDDLE_CONTAINER_FILE");
+	if (cp) {
+	    strcpy(cont_file, cp);
+	} else {
+	    char	*pp = strstr(cont_pattern, "%d");
+	    snprintf(cont_file, PATH_MAX, "%.*scontainer%s",
+		     (int)(pp - cont_pattern), cont_pattern, pp + 2);
+	}
+    } else if (cp) {
+	fprintf(stderr, "%s: IOMIDDLE_CONTAINER must contain %%d\n", __func__);
+    }
+    cp = getenv("IOMIDDLE_EXTENT");
+    if (cp && atoi(cp) > 0) {
+	_inf.extmode = 1;
+    }
+    cp = getenv("IOMIDDLE_RMA");
+    if (cp && atoi(cp) > 0) {
+	_inf.rma = 1;
+    }
+    _inf.rmadepth = RMA_DEPTH_DEFAULT;
+    cp = getenv("IOMIDDLE_RMA_DEPTH");
+    if (cp && atoi(cp) > 0) {
+	_inf.rmadepth = atoi(cp);
+    }
+    cp = getenv("IOMIDDLE_SERVERS");
+    if (cp && atoi(cp) > 0) {
+	_inf.nservers = atoi(cp);
+    }
+    _inf.srvpath = getenv("IOMIDDLE_SERVER_PATH");
+    if (_inf.srvpath == NULL || *_inf.srvpath == 0) {
+	_inf.srvpath = SRV_PATH_DEFAULT;
+    }
+    _inf.srvhosts = getenv("IOMIDDLE_SERVER_HOSTS");
+    if (_inf.srvhosts && *_inf.srvhosts == 0) {
+	_inf.srvhosts = NULL;
+    }
+    _inf.srvmem = SRV_MEM_DEFAULT;
+    cp = getenv("IOMIDDLE_SERVER_MEMLIMIT");
+    if (cp && size_parse(cp) > 0) {
+	_inf.srvmem = size_parse(cp);
+    }
+    pthread_mutex_init(&_inf.srvlock, NULL);
+    _inf.trace = getenv("IOMIDDLE_TRACE");
+    _inf.monitor = getenv("IOMIDDLE_MONITOR");
+    if (_inf.monitor && *_inf.monitor == 0) {
+	_inf.monitor = NULL;
+    }
+    _inf.trfd = -1;
+    pthread_mutex_init(&_inf.trlock, NULL);
+    _inf.copynt = COPY_NT_DEFAULT;
+    cp = getenv("IOMIDDLE_COPY_NT");
+    if (cp) {
+	_inf.copynt = size_parse(cp);
+    }
+    cp = getenv("IOMIDDLE_COPY_THREADS");
+    if (cp && atoi(cp) > 0) {
+	_inf.copy.nthr = atoi(cp);
+    }
+    pthread_mutex_init(&_inf.copy.busy, NULL);
+    pthread_mutex_init(&_inf.copy.lock, NULL);
+    pthread_cond_init(&_inf.copy.cond, NULL);
+    pthread_cond_init(&_inf.copy.done, NULL);
+    cp = getenv("IOMIDDLE_CHECKSUM");
+    if (cp && atoi(cp) > 0) {
+	_inf.checksum = 1;
+	crc_init();
+    }
+    cp = getenv("IOMIDDLE_PROGRESS");
+    if (cp && atoi(cp) > 0) {
+	_inf.progress = 1;
+	_inf.progcpu = getenv("IOMIDDLE_PROGRESS_CPU");
+	cp = getenv("IOMIDDLE_ASYNC_SYNC");
+	if (cp && atoi(cp) > 0) {
+	    _inf.async_sync = 1;
+	}
+    }
+    cp = getenv("IOMIDDLE_STAT_COLLECTIVE");
+    if (cp && atoi(cp) > 0) {
+	_inf.statcoll = 1;
+	_inf.statttl = STAT_TTL_DEFAULT/1000.0;
+	cp = getenv("IOMIDDLE_STAT_TTL");
+	if (cp) {
+	    _inf.statttl = atof(cp)/1000.0;
+	}
+	_inf.statcache = malloc(sizeof(struct statent)*STAT_CACHE_MAX);
+	IOMIDDLE_IFERROR((_inf.statcache == 0), "%s",
+			 "Cannot allocate working memory\n");
+    }
+    _inf.ncomm = NCOMM_DEFAULT;
+    cp = getenv("IOMIDDLE_NCOMM");
+    if (cp) {
+	_inf.ncomm = atoi(cp);
+    }
+    /* path rules, whose default policy is given above */
+    _inf.defpol.mode = _inf.extmode ? POLICY_EXTENT
+		       : _inf.rma ? POLICY_RMA : POLICY_STRIPE;
+    _inf.defpol.trunc = _inf.reqtrunc;
+    _inf.defpol.sparse = _inf.sparse;
+    _inf.defpol.tier = (_inf.tierdir != NULL);
+    _inf.defpol.cache = 1;
+    _inf.defpol.server = 1;
+    _inf.defpol.memlimit = _inf.memlimit;
+    _inf.defpol.bypass_size = _inf.bypass_size;
+    _inf.phash = malloc(sizeof(int)*PATH_HASH);
+    IOMIDDLE_IFERROR((_inf.phash == 0), "%s",
+		     "Cannot allocate working memory\n");
+    for (i = 0; i < PATH_HASH; i++) {
+	_inf.phash[i] = -1;
+    }
+    path_newnode(-1, "", 0);	/* root */
+    cp = getenv("IOMIDDLE_CONFIG");
+    if (cp) {
+	rule_list(cp, 0, -1);
+    }
+    cp = getenv("IOMIDDLE_CARE_PATH");
+    if (cp) {
+	rule_list(cp, ':', -1);
+    }
+    cp = getenv("IOMIDDLE_BCAST_PATH");
+    if (cp) {
+	rule_list(cp, ':', POLICY_BCAST);
     }
     DEBUG(DLEVEL_ALL) {
 	printf("%s: init is called. debug(%d)\n", __func__, _inf.debug);
@@ -638,16 +6658,23 @@ _myhijack_init()
     getrlimit(RLIMIT_NOFILE, &rlim);
     Myrank = -1;
     _inf.fdlimit = rlim.rlim_cur;
-    sz = sizeof(fdinfo)*_inf.fdlimit;
-    _inf.fdinfo = malloc(sz);
-    IOMIDDLE_IFERROR((_inf.fdinfo == 0), "%s",
+    /* only pointers to pages and bits, see fd_page() */
+    _inf.fdpages = calloc((_inf.fdlimit + FD_PAGE - 1)/FD_PAGE,
+			  sizeof(fdinfo*));
+    _inf.fdcare = calloc((_inf.fdlimit + 63)/64, sizeof(uint64_t));
+    IOMIDDLE_IFERROR((_inf.fdpages == 0 || _inf.fdcare == 0), "%s",
 		     "Cannot allocate working memory\n");
-    memset(_inf.fdinfo, 0, sz);
-    /* Checking don't care fd's */
-    for (i = 0; i < 3; i++) {
-	_inf.fdinfo[i].notfirst = 1;
-	_inf.fdinfo[i].dntcare = 1;
-    }
+    pthread_mutex_init(&_inf.fdlock, NULL);
+    _inf.world.comm = MPI_COMM_WORLD;
+    _inf.world.nodecomm = MPI_COMM_NULL;
+    _inf.world.pcomm = MPI_COMM_NULL;
+    pthread_mutex_init(&_inf.world.lock, NULL);
+    pthread_mutex_init(&_inf.cfreelock, NULL);
+    pthread_mutex_init(&_inf.initlock, NULL);
+    pthread_mutex_init(&_inf.progmtx, NULL);
+    pthread_mutex_init(&_inf.statlock, NULL);
+    pthread_cond_init(&_inf.progcond, NULL);
+    pthread_cond_init(&_inf.progdone, NULL);
     /* here are hijacked system call regisration */
     _hijacked_creat = _iomiddle_creat;
     _hijacked_open = _iomiddle_open;
@@ -655,5 +6682,19 @@ _myhijack_init()
     _hijacked_read = _iomiddle_read;
     _hijacked_lseek64 = _iomiddle_lseek64;
     _hijacked_write = _iomiddle_write;
+    _hijacked_fsync = _iomiddle_fsync;
+    _hijacked_fdatasync = _iomiddle_fdatasync;
+    _hijacked_stat = _iomiddle_stat;
+    _hijacked_stat64 = _iomiddle_stat64;
+    _hijacked_lstat = _iomiddle_lstat;
+    _hijacked_lstat64 = _iomiddle_lstat64;
+    _hijacked___xstat = _iomiddle___xstat;
+    _hijacked___xstat64 = _iomiddle___xstat64;
+    _hijacked___lxstat = _iomiddle___lxstat;
+    _hijacked___lxstat64 = _iomiddle___lxstat64;
+    _hijacked_fstat = _iomiddle_fstat;
+    _hijacked_fstat64 = _iomiddle_fstat64;
+    _hijacked___fxstat = _iomiddle___fxstat;
+    _hijacked___fxstat64 = _iomiddle___fxstat64;
 }
 
@@ -1,4 +1,4 @@
-#define _LARGEFILE64_SOURCE
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
@@ -9,8 +9,11 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdint.h>
+#ifndef __USE_GNU
 #define __USE_GNU
+#endif
 #include <dlfcn.h>
+#include <pthread.h>
 #include <mpi.h>
 #include "hooklib.h"
 
@@ -23,13 +26,80 @@
 #define MODE_READ	1
 #define MODE_WRITE	2
 
+/* counts of a process exchanged before flushing a round */
+#define FV_CNT		0	/* # of stripes to be exchanged */
+#define FV_DEV		1	/* deviated from the stripe pattern */
+#define FV_TAIL		2	/* length of the short last stripe */
+#define FV_LAST		3	/* flushing at close */
+#define FV_NUM		4
+
+/* summary of the counts reduced by MPI_MAX, see flush_sum() */
+#define FS_MAX		0	/* largest FV_CNT */
+#define FS_MIN		1	/* negated smallest FV_CNT */
+#define FS_ODD		2	/* any FV_DEV or FV_TAIL */
+#define FS_NLAST	3	/* negated smallest FV_LAST */
+#define FS_NUM		4
+
+#define POLICY_STRIPE	0
+#define POLICY_EXTENT	1
+#define POLICY_BCAST	2	/* replicated read, written as others */
+#define POLICY_BYPASS	3	/* not taken care */
+#define POLICY_RMA	4	/* stripe mode by one-sided communication */
+
+#define SPARSE_OFF	0
+#define SPARSE_WRITE	1	/* aggregators skip zero pieces of blocks */
+#define SPARSE_SEND	2	/* also all-zero stripes are not exchanged */
+
+/*
+ * Policy of files under a path rule
+ */
+struct policy {
+    int		mode;	   /* POLICY_* */
+    int		trunc;	   /* global file truncation at close */
+    size_t	memlimit;  /* memory budget per file descriptor */
+    size_t	bypass_size; /* stripe size for direct calls (adaptive) */
+    int		sparse;	   /* SPARSE_* */
+    int		tier;	   /* blocks are staged in IOMIDDLE_TIER */
+    int		cache;	   /* blocks read are kept in IOMIDDLE_CACHE */
+    int		server;	   /* rounds are written by IOMIDDLE_SERVERS */
+};
+
+struct tierfile;
+
+/*
+ * A communicator of a file, see comm_get().  It is kept for reuse by
+ * the same path after close.
+ */
+struct commslot {
+    struct commslot *next;
+    char	*path;
+    MPI_Comm	comm;
+    MPI_Comm	nodecomm; /* processes of comm in this node */
+    MPI_Comm	pcomm;	  /* duplicate used only by the progress thread */
+    pthread_mutex_t lock; /* serializing collectives on comm */
+};
+
 typedef struct fdinfo {
     union {
 	struct {
 	    unsigned int notfirst:1,
-			 dntcare: 1,
 			 trunc: 1,	/* flag of open with O_TRUNC */
-			 rwmode: 2;	/* read or write mode */
+			 rwmode: 2,	/* read or write mode */
+			 extmode: 1,	/* arbitrary-offset aggregation */
+			 bypass: 1,	/* direct POSIX calls (adaptive mode) */
+			 deviant: 1,	/* pattern deviated in this process */
+			 dirty: 1,	/* written by this process since sync */
+			 bcast: 1,	/* replicated-read mode */
+			 rdfirst: 1,	/* the first read has been issued */
+			 cont: 1,	/* a file packed in the container */
+			 contout: 1,	/* written outside the container */
+			 rma: 1,	/* stripes are put to aggregators */
+			 lastall: 1,	/* all processes flushed at close */
+			 crc: 1,	/* stripes have CRC32C records */
+			 notier: 1,	/* the staging file is not available */
+			 cached: 1,	/* blocks read are kept in the cache */
+			 append: 1,	/* opened with O_APPEND for write */
+			 server: 1;	/* rounds are sent to the I/O server */
 	};
 	int	attrall;
     };
@@ -37,27 +107,367 @@ typedef struct fdinfo {
     int		mode;	   /* mode specified by open/creat */
     int		strsize;  /* stripe size */
     int		strcnt;	  /* stripe count */
+    int		strgrp;	  /* stripe count exchanged at once */
     int		bufcount; /* block count */
+    int		mybufcount; /* # of stripes buffered per round */
+    int		naggr;	  /* # of aggregators hinted, 0 if all processes */
+    int		depth;	  /* # of stripes per round hinted, 0 if default */
+    int		bufdone;  /* # of stripes flushed by sync in this round */
+    int		taillen;  /* length of the short last stripe, 0 if none */
     size_t	bufsize;  /* */
     int		iofd;	  /* file descriptor */
-    int		filoff;   /* offset of file */
-    int		filcurb;  /* start block# must be written */
-    int		filtail;  /* tail block# must be written */
+    off64_t	filoff;   /* offset of file */
+    off64_t	filcurb;  /* block# of the first stripe in this round */
     off64_t	filblklen;/* block length = stripsize*nprocs */
     off64_t	filpos;   /* file position in byte */
+    off64_t	wrend;	  /* largest end of writes of this process */
     off64_t	bufpos;   /* buffer position in byte */
+    off64_t	filsize;  /* file size at the first read */
     char	*ubuf;
     char	*sbuf;
+    size_t	sbufsize; /* size of sbuf if it differs from bufsize */
+    int		extcnt;	  /* # of extents buffered in ubuf */
+    int		extmax;	  /* # of entries allocated in ext */
+    struct extent *ext;
+    char	*spare;	  /* user buffer returned by the progress thread,
+			     or being sent to the I/O server */
+    MPI_Request	srvreq;	  /* send of spare to the I/O server */
+    MPI_Datatype srvtype; /* a stripe sent to the I/O server */
+    int		njobs;	  /* # of rounds queued to the progress thread */
+    int		syncpend; /* # of asynchronous syncs in progress */
+    int		syncerr;  /* an asynchronous sync failed */
+    int		wrerr;	  /* a write failed, reported at sync or close */
+    int		wrote;	  /* written directly since the last flush round */
+    int		ckey;	  /* the number in the file name of the container */
+    int		cfd;	  /* the file written outside the container */
+    off64_t	cbase;	  /* offset of the file in the container */
+    off64_t	clen;	  /* length of the file in the container */
+    char	*cbuf;	  /* data staged until close */
+    size_t	cbufsize;
+    char	*cpath;	  /* path name of the file in the container */
+    const struct policy *pol;
+    MPI_Win	win;	  /* slots of blocks in the RMA mode,
+			     or the end of the file being appended */
+    char	*wbase;
+    int		rmadepth; /* # of block slots in win */
+    long long	rmanext;  /* # of blocks written as the aggregator */
+    long long	*rmadone; /* rmanext of aggregators known to this process */
+    int		*rmacnts; /* stripe lengths of a partial block */
+    int		rmaend;	  /* the end has been published to aggregators */
+    int		crcfd;	  /* checksum file, see crc_open() */
+    int		crcsize;  /* stripe size of the checksum file */
+    uint32_t	*crcs;	  /* CRC32C of stripes buffered in this round */
+    uint32_t	*crcall;  /* records of all processes read in this round */
+    int		crcrecs;  /* # of records read in crcall */
+    int		sparse;	  /* SPARSE_* of this file */
+    int		zwords;	  /* # of words of zmap */
+    uint32_t	*zmap;	  /* bitmap of all-zero stripes in this round */
+    uint32_t	*zall;	  /* bitmaps of all processes */
+    struct tierfile *tier; /* staging file of blocks, see tier_create() */
+    dev_t	stdev;	  /* identifying the file in the caches */
+    ino_t	stino;
+    struct timespec stmtim; /* st_mtim at the first read */
+    struct commslot *cslot; /* of comm, nodecomm and commlock */
+    MPI_Comm	comm;	  /* communicator for collectives on this file */
+    MPI_Comm	nodecomm; /* processes of comm in this node */
+    MPI_Comm	pcomm;	  /* rounds of the progress thread */
+    pthread_mutex_t *commlock; /* serializing collectives on comm */
+    pthread_mutex_t lock; /* one thread at a time per file descriptor */
 } fdinfo;
 
+/*
+ * A flush round handed to the progress thread.  The exchange of the
+ * round proceeds piece by piece with non-blocking collectives.
+ */
+struct progjob {
+    struct progjob *next;
+    fdinfo	*info;
+    char	*ubuf;	  /* user buffer of this round */
+    int		bufcount; /* # of stripes in this round */
+    off64_t	filcurb;  /* block# of the first stripe */
+    int		stripe;	  /* stripe being exchanged */
+    int		piece;	  /* first rank of the piece being exchanged */
+    int		posted;	  /* req is in flight */
+    int		sync;	  /* 1: fdatasync, 2: fsync after the exchange */
+    int		synced;	  /* the sync is globally completed */
+    int		syncrc;
+    int		counted;  /* stripes are counted over processes */
+    int		summed;	  /* the summary is reduced, counts follow */
+    int		mine[FV_NUM]; /* counts of this process */
+    int		sum[FS_NUM];  /* summary of counts of all processes */
+    int		*valid;	  /* counts of all processes, NULL if regular */
+    int		*rcnts;
+    MPI_Request	req;
+};
+
+/*
+ * Path rules are kept in a trie of path components.  The child of a
+ * node is found by the hash of the node and the component name.
+ */
+struct pnode {
+    int		parent;
+    int		next;	  /* hash chain */
+    int		rule;	  /* rule of this path, -1 if none */
+    int		wild;	  /* rules of name prefixes in this directory */
+    char	*name;
+};
+
+struct pathrule {
+    char	*prefix;  /* name prefix if the rule ends with '*' */
+    int		next;	  /* next name prefix rule of the directory */
+    struct policy pol;
+};
+
+/*
+ * The container file begins with the header followed by the index,
+ * an entry per process.  The index merged at a reopen without O_TRUNC
+ * is placed after the data.
+ */
+struct conthdr {
+    char	magic[8];
+    int64_t	nent;	  /* # of entries */
+    int64_t	idxoff;	  /* offset of the index */
+};
+
+struct content {
+    int64_t	key;	  /* the number in the file name */
+    int64_t	off;	  /* -1 if the file is written outside */
+    int64_t	len;
+};
+
+/*
+ * Helper threads of staging copies.  A copy is split into slices, which
+ * are taken by the helpers and the caller.
+ */
+struct copypool {
+    int		nthr;
+    pthread_t	*thr;
+    pthread_mutex_t busy; /* one split copy at a time */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;  /* a new copy is posted */
+    pthread_cond_t done;  /* all slices are copied */
+    unsigned	gen;	  /* incremented per copy */
+    char	*dst;
+    const char	*src;
+    size_t	len;
+    size_t	slice;
+    int		nt;	  /* non-temporal stores */
+    int		nslice;
+    int		next;	  /* the next slice to be taken */
+    int		ndone;
+};
+
+/*
+ * A stat result kept by rank 0 in the collective stat mode
+ */
+struct statent {
+    char	*path;
+    int		nofollow; /* lstat */
+    double	time;	  /* when the file was stat-ed */
+    struct stat64 st;
+};
+
+/*
+ * An extent is a (file offset, length) pair buffered in ubuf.
+ * The data of the i-th extent is placed right after the (i-1)-th one.
+ */
+struct extent {
+    off64_t	off;
+    off64_t	len;
+};
+
+/*
+ * Staging file of a file in the burst-buffer tier.  Extents written to
+ * it are copied to the file in order by the drainer thread.
+ */
+struct tierfile {
+    struct tierfile *next;
+    dev_t	dev;	  /* identifying the file */
+    ino_t	ino;
+    int		rfd;	  /* duplicated file descriptor of the file */
+    int		sfd;	  /* staging file, which is unlinked */
+    int		strsize;  /* stripe size and aggregators of the writes */
+    int		naggr;
+    int		head;	  /* ext[head] .. ext[cnt - 1] are not copied yet */
+    int		cnt;
+    int		max;
+    int		busy;	  /* ext[head] is being copied */
+    int		closed;	  /* the file has been closed */
+    int		err;	  /* errno of a failed copy */
+    off64_t	end;	  /* the largest end of extents not copied */
+    struct extent *ext;
+};
+
+/*
+ * A block read by an aggregator, kept in the block cache
+ */
+struct blkent {
+    struct blkent *prev, *next; /* LRU list, the most recent first */
+    struct blkent *hnext; /* hash chain */
+    dev_t	dev;	  /* identifying the file */
+    ino_t	ino;
+    struct timespec mtime; /* st_mtim of the file at its first read */
+    off64_t	off;
+    size_t	len;	  /* length requested */
+    ssize_t	cc;	  /* length read, which is kept in data */
+    char	data[];
+};
+
+/*
+ * Request of a process to its I/O server, see iomiddle_server().
+ * SRV_OPEN is followed by the path name, and SRV_DATA by the stripes.
+ */
+#define SRV_OPEN	1
+#define SRV_DATA	2
+#define SRV_SYNC	3
+#define SRV_CLOSE	4
+#define SRV_EXIT	5
+
+struct srvreq {
+    int		op;	  /* SRV_* */
+    int		fd;	  /* file descriptor of the process */
+    int		cnt;	  /* # of stripes, length of the path name (open),
+			     or 1 for fdatasync (sync) */
+    int		first;	  /* index of the first stripe in the round */
+    int		tail;	  /* length of the short last stripe, 0 if none */
+    int		end;	  /* the last stripes of the round */
+    int		strsize;
+    int		nbuf;	  /* # of stripes per round */
+    int		sparse;	  /* SPARSE_* of the file (open) */
+    int		tag;	  /* tag of the reply (sync and close) */
+    off64_t	blk;	  /* block# of the first stripe of the round */
+};
+
+/*
+ * A round being assembled by an I/O server.  The i-th stripe of the
+ * m-th process of the group is placed at (i*n + m)*strsize of buf, so
+ * that the i-th piece of n stripes is contiguous in the file.
+ */
+struct srvround {
+    struct srvround *next;
+    off64_t	blk;	  /* block# of the first stripe */
+    int		*got;	  /* # of stripes received from each process */
+    int		*done;	  /* # of stripes written */
+    int		*tail;	  /* length of the short last stripe */
+    char	*buf;
+};
+
+/*
+ * A file written by an I/O server for the processes of its group
+ */
+struct srvfile {
+    struct srvfile *next;
+    char	*path;
+    int		*fds;	  /* file descriptor of each process, -1 if none */
+    int		*tags;	  /* tag of the reply to each process */
+    off64_t	*nextblk; /* the first block of the next round sent */
+    char	*closed;
+    int		nclosed;
+    int		nsync;	  /* # of processes waiting for the sync */
+    int		datasync;
+    int		strsize;
+    int		nbuf;
+    int		rc;	  /* -1 if any write has failed */
+    MPI_Datatype stripe;
+    struct srvround *rounds; /* in the order of block# */
+    fdinfo	info;	  /* the file opened by the server */
+};
+
+struct srvstate {
+    MPI_Comm	parent;
+    int		nprocs;	  /* # of processes of the job */
+    int		q0;	  /* the first rank of the group */
+    int		n;	  /* # of processes of the group */
+    int		nexit;
+    size_t	used;	  /* bytes of rounds being assembled */
+    struct srvfile *files;
+    struct srvreq *reqs;  /* the request received from each process */
+    MPI_Request	*rreqs;
+    char	*blocked; /* requests waiting for the buffer capacity */
+};
+
 struct ioinfo {
     int		debug;
     int		nprocs;
     int		rank;
-    int		mybufcount;
     int		reqtrunc;
+    int		extmode;
+    int		rma;
+    int		rmadepth;
+    int		checksum; /* CRC32C of stripes is recorded and verified */
+    char	*trace;	  /* path prefix of trace files */
+    int		trfd;	  /* trace file of this process */
+    char	*trbuf;	  /* records not yet written */
+    size_t	trpos;
+    struct timespec trt0; /* the beginning of the trace */
+    pthread_mutex_t trlock;
+    size_t	copynt;	  /* copies of this size or more are non-temporal */
+    struct copypool copy;
+    char	*monitor; /* name of the shared memory segment of counters */
+    struct iomiddle_mon *mon; /* counters of this process, or NULL */
+    int		adaptive;
+    int		detect;	  /* access pattern is detected at first access */
+    int		sparse;	  /* IOMIDDLE_SPARSE */
+    size_t	bypass_size;
+    size_t	memlimit;
     uint64_t	fdlimit;
-    fdinfo	*fdinfo;
+    fdinfo	**fdpages; /* pages of fdinfo allocated on demand */
+    uint64_t	*fdcare;  /* bitmap of care fds */
+    pthread_mutex_t fdlock; /* allocating a page */
+    int		thrlevel; /* MPI thread support level */
+    int		ncomm;	  /* # of communicators kept for reuse */
+    int		ncfree;	  /* # of communicators in cfree */
+    struct commslot *cfree; /* kept after close in MPI_THREAD_MULTIPLE */
+    struct commslot world; /* MPI_COMM_WORLD, serializing MPI calls
+			      unless MPI_THREAD_MULTIPLE */
+    MPI_Group	worldgrp;
+    int		tagub;	  /* MPI_TAG_UB */
+    pthread_mutex_t cfreelock;
+    int		bcast_auto; /* replicated read is detected at first read */
+    int		bcast_node; /* one reader per node in replicated read */
+    pthread_mutex_t initlock;
+    int		collinit; /* collectives of coll_init are done */
+    int		progress; /* progress thread is running */
+    int		async_sync; /* fsync/fdatasync return before completion */
+    char	*progcpu; /* cpu list the progress thread is pinned to */
+    pthread_t	progthr;
+    pthread_mutex_t progmtx;
+    pthread_cond_t progcond; /* new job is queued or waited for */
+    pthread_cond_t progdone; /* job is completed */
+    int		progwait; /* # of threads waiting for jobs */
+    struct progjob *proghead, *progtail;
+    int		statcoll; /* stat of a care path is collective */
+    double	statttl;  /* lifetime of a stat cache entry in seconds */
+    int		statcnt;  /* # of entries in statcache */
+    struct statent *statcache;
+    pthread_mutex_t statlock;
+    int		fdhigh;	  /* care fds are less than this */
+    char	*tierdir; /* node-local directory of staging files */
+    struct tierfile *tiers; /* staging files in the order of creation */
+    int		tierseq;
+    int		tierthr;  /* the drainer thread has been started */
+    pthread_mutex_t tierlock;
+    pthread_cond_t tiercond; /* extents are queued */
+    pthread_cond_t tierdone; /* an extent has been copied */
+    size_t	cachemax; /* budget of the block cache, 0 if disabled */
+    size_t	cacheused;
+    struct blkent *cachehead, *cachetail; /* LRU list */
+    struct blkent **cachehash;
+    pthread_mutex_t cachelock;
+    int		nservers; /* # of I/O servers, 0 if none */
+    char	*srvpath; /* program of the I/O servers */
+    char	*srvhosts; /* hosts the I/O servers are placed on */
+    size_t	srvmem;	  /* buffer capacity of an I/O server */
+    MPI_Comm	srvcomm;  /* intercommunicator to the I/O servers */
+    int		srvup;	  /* the I/O servers have been spawned */
+    int		srvfdmax; /* the largest fd whose replies are tagged */
+    pthread_mutex_t srvlock; /* a request is followed by its data */
+    struct policy defpol; /* given by the environment variables */
+    int		nrules;
+    struct pathrule *rules;
+    int		npnodes, maxpnodes;
+    struct pnode *pnodes;
+    int		*phash;
 };
 
 #define DEBUG(level)	if (_inf.debug&(level))
@@ -69,10 +479,24 @@ struct ioinfo {
     }						\
 } while(0);
 
+/*
+ * In the adaptive mode, an access pattern which does not fit this
+ * middleware does not abort, but the action is taken instead.
+ */
+#define IOMIDDLE_IFUNFIT(cond, action, format, ...) do { \
+    if (cond) {					\
+	if (!_inf.adaptive) {			\
+	    dbgprintf(format, __VA_ARGS__);	\
+	    abort();				\
+	}					\
+	action;					\
+    }						\
+} while(0);
+
 #define MPI_CALL(mpicall) do {			\
-    int	rc;					\
-    rc = mpicall;				\
-    if (rc != 0) {				\
+    int	_mpirc;					\
+    _mpirc = mpicall;				\
+    if (_mpirc != 0) {				\
 	fprintf(stderr, "%s MPI error\n", __func__);\
 	abort();				\
     }						\
@@ -0,0 +1,128 @@
+/*
+ * Interface of the IO middleware for applications
+ *	The functions are defined only if io_middle.so is preloaded, or
+ *	libiomiddle.a is linked with -Wl,@iomiddle.wrap (see src/Makefile).
+ *	They are weak symbols, and the application may check if they are
+ *	available, e.g., if (iomiddle_sync_wait) iomiddle_sync_wait(fd);
+ */
+#ifndef _IOMIDDLE_H
+#define _IOMIDDLE_H
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+ * Completion of collective fsync/fdatasync issued with IOMIDDLE_ASYNC_SYNC.
+ *	iomiddle_sync_test returns 1 if all of them on the file descriptor
+ *	have been completed, 0 if not yet, and -1 if any of them failed.
+ *	iomiddle_sync_wait waits for the completion, and returns 0 or -1.
+ *	They are local operations.
+ */
+extern int iomiddle_sync_test(int fd) __attribute__((weak));
+extern int iomiddle_sync_wait(int fd) __attribute__((weak));
+
+/*
+ * Collective I/O without interception of system calls.
+ *	iomiddle_open opens the file for all processes of the job, which
+ *	call it with the same arguments.  The file is taken care even if
+ *	its path is not under IOMIDDLE_CARE_PATH, where the policy of the
+ *	matching rule, or the default one, is applied.  Members of hints
+ *	are 0 for the defaults, and hints may be NULL:
+ *	  strsize: stripe size, which is otherwise inferred at the first
+ *		   access.  It must be given to use naggr and depth.
+ *	  naggr:   # of processes writing and reading blocks of the file,
+ *		   all processes by default.  Not used in the RMA mode.
+ *	  depth:   # of stripes of a process buffered per round, the # of
+ *		   processes by default.  The # of slots in the RMA mode.
+ *	iomiddle_write_all and iomiddle_read_all transfer the stripe at
+ *	off, and return as write and read.  Every process calls them the
+ *	same number of times, where off of the k-th call of rank p is
+ *	(k*nprocs + p)*strsize.  iomiddle_close closes the file.
+ *	They return -1 with errno on errors.
+ */
+struct iomiddle_hints {
+    int64_t	strsize;
+    int32_t	naggr;
+    int32_t	depth;
+};
+
+extern int iomiddle_open(const char *path, int flags, mode_t mode,
+			 const struct iomiddle_hints *hints)
+    __attribute__((weak));
+extern ssize_t iomiddle_write_all(int fd, const void *buf, size_t len,
+				  int64_t off) __attribute__((weak));
+extern ssize_t iomiddle_read_all(int fd, void *buf, size_t len,
+				 int64_t off) __attribute__((weak));
+extern int iomiddle_close(int fd) __attribute__((weak));
+
+/*
+ * Main loop of an I/O server spawned with IOMIDDLE_SERVERS, which is
+ *	called by tools/iomiddle-server after MPI_Init.  It serves the
+ *	group of processes of the parent job until they call
+ *	MPI_Finalize, and returns 0.  It returns -1 with errno if the
+ *	process is not spawned.
+ */
+extern int iomiddle_server(void) __attribute__((weak));
+
+/*
+ * Trace files recorded with IOMIDDLE_TRACE, one per process, which are
+ * read by tools/iomiddle-replay.  A file begins with the header, which
+ * is followed by records.  The record of open is followed by the path
+ * name of len bytes without the terminating null.
+ */
+
+#define IOMIDDLE_TRACE_MAGIC	"IOMTRC1"
+
+#define IOMIDDLE_TR_OPEN	1	/* off: flags, len: path length */
+#define IOMIDDLE_TR_CLOSE	2
+#define IOMIDDLE_TR_WRITE	3	/* off: file position, len: size */
+#define IOMIDDLE_TR_READ	4	/* off: file position, len: size */
+#define IOMIDDLE_TR_LSEEK	5	/* off: offset, whence */
+#define IOMIDDLE_TR_FSYNC	6	/* whence: 1 for fdatasync */
+
+struct iomiddle_trace_hdr {
+    char	magic[8];
+    int32_t	rank;
+    int32_t	nprocs;
+};
+
+struct iomiddle_trace {
+    uint8_t	op;	  /* IOMIDDLE_TR_* */
+    uint8_t	whence;
+    uint16_t	pad;
+    int32_t	fd;
+    int64_t	off;
+    int64_t	len;
+    uint64_t	nsec;	  /* from the beginning of the trace */
+};
+
+/*
+ * Counters published with IOMIDDLE_MONITOR, which are read by
+ * tools/iomiddle-top.  The shared memory segment of a node begins with
+ * the header, which is followed by one record per process in the node.
+ * Records are updated by relaxed atomic operations, and read without
+ * any lock.  Times are in nanoseconds.
+ */
+#define IOMIDDLE_MON_MAGIC	"IOMMON1"
+
+struct iomiddle_mon_hdr {
+    char	magic[8];
+    int32_t	nprocs;	  /* # of processes of the job */
+    int32_t	nlocal;	  /* # of records */
+    int32_t	recsize;  /* size of a record */
+    int32_t	pad;
+};
+
+struct iomiddle_mon {
+    int32_t	rank;
+    int32_t	pid;
+    uint64_t	staged;	    /* bytes copied to the buffers */
+    uint64_t	written;    /* bytes written to files by this process */
+    uint64_t	read;	    /* bytes read from files by this process */
+    uint64_t	flushes;    /* flush rounds completed */
+    int32_t	inflush;    /* flush rounds in progress */
+    int32_t	qdepth;	    /* rounds queued to the progress thread */
+    uint64_t	xchg_nsec;  /* time blocked in exchanges */
+    uint64_t	write_nsec; /* time blocked in writes to files */
+};
+
+#endif /* _IOMIDDLE_H */
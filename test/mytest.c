@@ -1,15 +1,20 @@
 #include "testlib.h"
 #include "utf_tsc.h"
+#include "../src/iomiddle.h"
 #include <mpi.h>
 #include <limits.h>
+#include <pthread.h>
+#include <errno.h>
 
 extern void redirect();
 
 static int	errors = 0;
 static void	*bufp;
+static void	*zbufp;	/* stripes of ZERO_STRIPE */
+static int	fillval; /* values of a rewrite with -E are shifted by it */
 
 static uint64_t	timer_hz;
-static uint64_t	timer_st[2], timer_et[2];
+static uint64_t	timer_st[3], timer_et[3];
 #define TIMER_SECOND(t)	((double)(t)/(double)(timer_hz))
 
 static void
@@ -22,10 +27,40 @@ timer_init()
     }
 }
 
+/*
+ * With -N, files are accessed by the collective interface of iomiddle.h
+ */
+static int
+open_file(char *fnm, int flags)
+{
+    struct iomiddle_hints	hints;
+
+    if (!nativeflag) {
+	return open(fnm, flags, 0644);
+    }
+    if (!iomiddle_open) {
+	fprintf(stderr, "-N requires the IO middleware\n");
+	exit(-1);
+    }
+    hints.strsize = strsize;
+    hints.naggr = naggr;
+    hints.depth = depth;
+    return iomiddle_open(fnm, flags, 0644, &hints);
+}
+
+static int
+close_file(int fd)
+{
+    return nativeflag ? iomiddle_close(fd) : close(fd);
+}
+
 static int
 write_stripe(int fd, void *buf, size_t size, off64_t pos)
 {
     size_t	rc;
+    if (nativeflag) {
+	return iomiddle_write_all(fd, buf, size, pos);
+    }
     rc = lseek64(fd, pos, SEEK_SET);
     if (rc != pos) {
 	printf("Lseek error: rc(%ld) pos(%ld)\n", rc, pos);
@@ -40,6 +75,9 @@ static int
 read_stripe(int fd, void *buf, size_t size, off64_t pos)
 {
     size_t	rc;
+    if (nativeflag) {
+	return iomiddle_read_all(fd, buf, size, pos);
+    }
     rc = lseek64(fd, pos, SEEK_SET);
     if (rc != pos) {
 	printf("Lseek error: rc(%ld) pos(%ld)\n", rc, pos);
@@ -55,7 +93,7 @@ verify(void *bufp, size_t busiz, int val)
 {
     off64_t	pos;
     int	errs = 0;
-    for (pos = 0; pos < bufsiz/sizeof(unsigned int); pos++) {
+    for (pos = 0; pos < busiz/sizeof(unsigned int); pos++) {
 	if (((unsigned *)bufp)[pos] != pos + myrank + val) {
 	    printf("\t ERROR pos(%ld) value(%d) expect(%ld)\n",
 		   pos, ((unsigned *)bufp)[pos], pos + myrank + val);
@@ -74,6 +112,22 @@ fillin(void *bufp, size_t busiz, int val)
     }
 }
 
+/*
+ * Collective stat while writing: the file includes stripes written so
+ * far, which are not hidden by the result cached before a flush.
+ */
+static void
+stat_check(char *fnm, int iter, off64_t end)
+{
+    struct stat	sb;
+
+    if (stat(fnm, &sb) < 0 || sb.st_size < end) {
+	printf("[%d] iter=%d stat size = %ld, not >= %ld\n",
+	       myrank, iter, (long) sb.st_size, (long) end);
+	errors++;
+    }
+}
+
 static void
 do_write(char *fnm, off64_t offset, void *bufp, size_t bufsiz)
 {
@@ -86,24 +140,102 @@ do_write(char *fnm, off64_t offset, void *bufp, size_t bufsiz)
     if (tflag) {
 	flags |= O_TRUNC;
     }
-    if ((fd = open(fnm, flags, 0644)) < 0) {
+    if ((fd = open_file(fnm, flags)) < 0) {
 	fprintf(stderr, "Cannot open file %s\n", fnm);
 	exit(-1);
     }
-    fillin(bufp, bufsiz, 0);
+    fillin(bufp, bufsiz, fillval);
     pos = offset;
     for (iter = 0; iter < len; iter++) {
+	void	*src = ZERO_STRIPE(pos/strsize) ? zbufp : bufp;
 	VERBOSE {
 	    printf("[%d] iter=%d pos=%ld strsize(%ld)\n",
 		   myrank, iter, pos, strsize);
 	}
-	sz = write_stripe(fd, bufp, strsize, pos);
+	if (tailsize > 0 && iter == len - 1) {
+	    /* the last block is cut at tailsize bytes */
+	    off64_t	rest = tailsize - myrank*strsize;
+	    size_t	tlen = (rest <= 0) ? 0 : (rest < strsize) ? rest : strsize;
+	    if (tlen > 0 && write_stripe(fd, src, tlen, pos) != tlen) {
+		printf("Write size is not %ld\n", tlen);
+		errors++;
+	    }
+	    break;
+	}
+	if (deviter >= 0 && iter > deviter && myrank == nprocs - 1
+	    && devfew) {
+	    /* not hooked, fewer calls than the other processes */
+	    sz = pwrite(fd, src, strsize, pos);
+	} else if (deviter >= 0 && iter >= deviter && myrank == nprocs - 1) {
+	    /* deviating from the stripe pattern, same file image */
+	    sz = write_stripe(fd, src, strsize/2, pos);
+	    sz += write(fd, (char*) src + strsize/2, strsize - strsize/2);
+	} else {
+	    sz = write_stripe(fd, src, strsize, pos);
+	}
 	if (sz != strsize) {
 	    printf("Write size = %ld, not %ld\n", sz, strsize);
 	}
+	if (statflag) {
+	    stat_check(fnm, iter, pos + strsize);
+	}
+	if (syncint > 0 && (iter + 1) % syncint == 0) {
+	    if (fsync(fd) < 0) {
+		printf("fsync error\n");
+		errors++;
+	    }
+	    if (statflag) {
+		/* stripes flushed by other processes */
+		stat_check(fnm, iter, pos + strsize);
+	    }
+	}
 	pos += strsize*nprocs;
     }
-    close(fd);
+    if (syncint > 0 && iomiddle_sync_wait && iomiddle_sync_wait(fd) < 0) {
+	printf("fsync error\n");
+	errors++;
+    }
+    if (statflag) {
+	/* the file size includes stripes still buffered by processes */
+	struct stat	sb;
+	if (fstat(fd, &sb) < 0 || sb.st_size < strsize*nprocs*len) {
+	    printf("[%d] fstat size = %ld, not %ld\n",
+		   myrank, (long) sb.st_size, strsize*nprocs*len);
+	    errors++;
+	}
+    }
+    if (devfew) {
+	/* a collective of the application before close */
+	MPI_Barrier(MPI_COMM_WORLD);
+    }
+    close_file(fd);
+}
+
+/*
+ * Collective stat:
+ *	Every process stats the file written by do_write, twice for the
+ *	cached result, and a file which does not exist.
+ */
+static void
+do_stat(char *fnm)
+{
+    struct stat	sb;
+    char	path[1100];
+    int		i;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (i = 0; i < 2; i++) {
+	if (stat(fnm, &sb) < 0 || sb.st_size != strsize*nprocs*len) {
+	    printf("[%d] stat size = %ld, not %ld\n",
+		   myrank, (long) sb.st_size, strsize*nprocs*len);
+	    errors++;
+	}
+    }
+    snprintf(path, sizeof(path), "%s.none", fnm);
+    if (stat(path, &sb) == 0 || errno != ENOENT) {
+	printf("[%d] stat of %s must fail with ENOENT\n", myrank, path);
+	errors++;
+    }
 }
 
 static void
@@ -113,7 +245,7 @@ do_read(char *fnm, off64_t offset, void *bufp, size_t busiz)
     size_t	sz;
     off64_t	pos;
     
-    if ((fd = open(fnm, O_RDONLY)) < 0) {
+    if ((fd = open_file(fnm, O_RDONLY)) < 0) {
 	fprintf(stderr, "Cannot open file %s\n", fnm);
 	exit(-1);
     }
@@ -127,28 +259,374 @@ do_read(char *fnm, off64_t offset, void *bufp, size_t busiz)
 	    fillin(bufp, bufsiz, -1);
 	}
 	sz = read_stripe(fd, bufp, strsize, pos);
+	if ((ssize_t) sz < 0) {
+	    printf("[%d] read error at %ld: %s\n",
+		   myrank, pos, strerror(errno));
+	    errors++;
+	    pos += strsize*nprocs;
+	    continue;
+	}
 	if (sz != strsize) {
 	    printf("Write size = %ld, not %ld\n", sz, strsize);
 	}
-	if (vflag) {
-	    errors += verify(bufp, bufsiz, 0);
+	if (vflag && ZERO_STRIPE(pos/strsize)) {
+	    if (memcmp(bufp, zbufp, strsize)) {
+		printf("\t ERROR stripe at %ld must be zero\n", pos);
+		errors++;
+	    }
+	} else if (vflag) {
+	    errors += verify(bufp, strsize, fillval);
 	}
 	pos += strsize*nprocs;
     }
+    close_file(fd);
+}
+
+/*
+ * Replicated read:
+ *	Every process reads the whole file written by do_write stripe by
+ *	stripe.  The k-th stripe has been written by rank k % nprocs.
+ */
+static void
+do_read_replicated(char *fnm, void *bufp)
+{
+    int		fd;
+    ssize_t	sz;
+    off64_t	k, tot = 0;
+
+    if ((fd = open(fnm, O_RDONLY)) < 0) {
+	fprintf(stderr, "Cannot open file %s\n", fnm);
+	exit(-1);
+    }
+    for (k = 0; ; k++) {
+	fillin(bufp, strsize, -1);
+	sz = read(fd, bufp, strsize);
+	if (sz <= 0) break;
+	if (sz != strsize) {
+	    printf("Read size = %ld, not %ld\n", sz, strsize);
+	    errors++;
+	    break;
+	}
+	errors += verify(bufp, strsize, (k % nprocs) - myrank);
+	tot += sz;
+    }
+    if (tot != strsize*nprocs*len) {
+	printf("[%d] Read total size = %ld, not %ld\n",
+	       myrank, tot, strsize*nprocs*len);
+	errors++;
+    }
+    close(fd);
+}
+
+/*
+ * File per process:
+ *	Each process writes the file numbered by the next rank, whose
+ *	length differs over files, and reads the file numbered by the
+ *	rank after next.  Each word of the n-th file keeps its own word
+ *	position plus n.  The file is truncated with -t, and only read
+ *	with -r.
+ */
+static off64_t
+fpp_length(int n)
+{
+    return strsize*len + n*3*sizeof(unsigned);
+}
+
+static void
+do_fpp(char *fnm)
+{
+    char	path[PATH_MAX];
+    unsigned	*data = malloc(strsize);
+    off64_t	pos, flen;
+    ssize_t	sz, i;
+    struct stat	sb;
+    int		fd, n;
+
+    n = (myrank + 1) % nprocs;
+    flen = fpp_length(n);
+    snprintf(path, PATH_MAX, "%s.%d", fnm, n);
+    if (rwflag == DO_READ) {
+	goto read;
+    }
+    if ((fd = open(path, O_CREAT|O_WRONLY|(tflag ? O_TRUNC : 0), 0644)) < 0) {
+	fprintf(stderr, "Cannot open file %s\n", path);
+	exit(-1);
+    }
+    for (pos = 0; pos < flen; pos += sz) {
+	sz = (flen - pos < strsize) ? flen - pos : strsize;
+	for (i = 0; i < sz/sizeof(unsigned); i++) {
+	    data[i] = pos/sizeof(unsigned) + i + n;
+	}
+	if (write(fd, data, sz) != sz) {
+	    printf("[%d] write error %s\n", myrank, path);
+	    errors++;
+	}
+    }
+    close(fd);
+read:
+    MPI_Barrier(MPI_COMM_WORLD);
+    n = (myrank + 2) % nprocs;
+    flen = fpp_length(n);
+    snprintf(path, PATH_MAX, "%s.%d", fnm, n);
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	fprintf(stderr, "Cannot open file %s\n", path);
+	exit(-1);
+    }
+    if (fstat(fd, &sb) < 0 || sb.st_size != flen) {
+	printf("[%d] %s size = %ld, not %ld\n",
+	       myrank, path, (long) sb.st_size, flen);
+	errors++;
+    }
+    for (pos = 0; (sz = read(fd, data, strsize)) > 0; pos += sz) {
+	for (i = 0; i < sz/sizeof(unsigned); i++) {
+	    if (data[i] != pos/sizeof(unsigned) + i + n) {
+		printf("\t ERROR %s pos(%ld) value(%d)\n",
+		       path, pos + i*sizeof(unsigned), data[i]);
+		errors++;
+		break;
+	    }
+	}
+    }
+    if (pos != flen) {
+	printf("[%d] %s read size = %ld, not %ld\n", myrank, path, pos, flen);
+	errors++;
+    }
+    close(fd);
+    snprintf(path, PATH_MAX, "%s.%d", fnm, nprocs + 1);
+    if (open(path, O_RDONLY) >= 0 || errno != ENOENT) {
+	printf("[%d] open of %s must fail with ENOENT\n", myrank, path);
+	errors++;
+    }
+    free(data);
+}
+
+/*
+ * Irregular pattern:
+ *	The length of a record differs over processes and iterations,
+ *	and records are written in the reverse order of iterations.
+ *	Each word in the file keeps its own word position.
+ */
+static size_t
+irr_reclen(int rank, int iter)
+{
+    return (strsize/2 + ((rank + iter) % 4)*64) & ~(sizeof(unsigned) - 1);
+}
+
+static off64_t
+irr_offset(int rank, int iter)
+{
+    off64_t	pos = 0;
+    int		i, r;
+    for (i = 0; i < iter; i++) {
+	for (r = 0; r < nprocs; r++) pos += irr_reclen(r, i);
+    }
+    for (r = 0; r < rank; r++) pos += irr_reclen(r, iter);
+    return pos;
+}
+
+static void
+do_write_irregular(char *fnm, void *bufp)
+{
+    int		fd, iter;
+    size_t	sz, reclen, i;
+    off64_t	pos;
+    int		flags;
+
+    flags = O_CREAT|O_WRONLY;
+    if (tflag) {
+	flags |= O_TRUNC;
+    }
+    if ((fd = open(fnm, flags, 0644)) < 0) {
+	fprintf(stderr, "Cannot open file %s\n", fnm);
+	exit(-1);
+    }
+    for (iter = len - 1; iter >= 0; iter--) {
+	pos = irr_offset(myrank, iter);
+	reclen = irr_reclen(myrank, iter);
+	for (i = 0; i < reclen/sizeof(unsigned); i++) {
+	    ((unsigned *)bufp)[i] = pos/sizeof(unsigned) + i;
+	}
+	VERBOSE {
+	    printf("[%d] iter=%d pos=%ld reclen(%ld)\n",
+		   myrank, iter, pos, reclen);
+	}
+	sz = write_stripe(fd, bufp, reclen, pos);
+	if (sz != reclen) {
+	    printf("Write size = %ld, not %ld\n", sz, reclen);
+	    errors++;
+	}
+    }
+    close(fd);
+}
+
+/*
+ * The file is checked by rank 0 using pread, which is not hooked
+ */
+static void
+verify_irregular(char *fnm)
+{
+    int		fd;
+    off64_t	pos, fsize;
+    size_t	sz, i;
+    unsigned	*data = malloc(strsize);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (myrank != 0) return;
+    fsize = irr_offset(0, len);
+    if ((fd = open(fnm, O_RDONLY)) < 0) {
+	fprintf(stderr, "Cannot open file %s\n", fnm);
+	exit(-1);
+    }
+    for (pos = 0; pos < fsize; pos += sz) {
+	sz = pread(fd, data, strsize, pos);
+	if (sz <= 0) {
+	    printf("\t ERROR file size(%ld) expect(%ld)\n", pos, fsize);
+	    errors++;
+	    break;
+	}
+	for (i = 0; i < sz/sizeof(unsigned); i++) {
+	    if (data[i] != pos/sizeof(unsigned) + i) {
+		printf("\t ERROR pos(%ld) value(%d) expect(%ld)\n",
+		       pos + i*sizeof(unsigned), data[i],
+		       pos/sizeof(unsigned) + i);
+		if (errors++ > 4) goto ext;
+	    }
+	}
+    }
+ext:
+    close(fd);
+    free(data);
+}
+
+/*
+ * Shared-file append:
+ *	Every process appends its records to the file opened with O_APPEND,
+ *	and fsyncs every syncint records while all processes have records.
+ *	After a barrier, the end of the file is the total of all records.
+ *	The records are checked by myverify -A.
+ */
+static void
+do_append(char *fnm)
+{
+    unsigned	rec[APPEND_MAXWORDS];
+    int		fd, flags, i, j, r;
+    size_t	sz;
+    off64_t	end, tot = 0;
+
+    flags = O_CREAT|O_WRONLY|O_APPEND;
+    if (tflag) {
+	flags |= O_TRUNC;
+    }
+    if ((fd = open(fnm, flags, 0644)) < 0) {
+	fprintf(stderr, "Cannot open file %s\n", fnm);
+	exit(-1);
+    }
+    for (i = 0; i < len + myrank; i++) {
+	rec[0] = APPEND_WORDS(myrank, i);
+	rec[1] = myrank;
+	rec[2] = i;
+	for (j = 3; j < rec[0]; j++) {
+	    rec[j] = myrank*1000 + i + j;
+	}
+	sz = rec[0]*sizeof(unsigned);
+	if (write(fd, rec, sz) != sz) {
+	    printf("[%d] append error\n", myrank);
+	    errors++;
+	}
+	if (syncint > 0 && (i + 1) % syncint == 0 && i < len && fsync(fd) < 0) {
+	    printf("fsync error\n");
+	    errors++;
+	}
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (r = 0; r < nprocs; r++) {
+	for (i = 0; i < len + r; i++) {
+	    tot += APPEND_WORDS(r, i)*sizeof(unsigned);
+	}
+    }
+    if (tflag && (end = lseek64(fd, 0, SEEK_END)) != tot) {
+	printf("[%d] end of file = %ld, not %ld\n", myrank, end, tot);
+	errors++;
+    }
     close(fd);
 }
 
+/*
+ * Multi-threaded test: the t-th thread writes and/or reads file "fnm.t"
+ */
+struct thrarg {
+    char	fnm[PATH_MAX];
+    off64_t	offset;
+    void	*bufp;
+};
+
+static void *
+thr_main(void *arg)
+{
+    struct thrarg	*ta = arg;
+
+    if (rwflag & DO_WRITE) {
+	do_write(ta->fnm, ta->offset, ta->bufp, bufsiz);
+    }
+    if (rwflag & DO_READ) {
+	do_read(ta->fnm, ta->offset, ta->bufp, bufsiz);
+    }
+    return NULL;
+}
+
+static void
+do_threads(char *fnm, off64_t offset)
+{
+    pthread_t		*thr;
+    struct thrarg	*ta;
+    int			i;
+
+    thr = malloc(sizeof(pthread_t)*nthreads);
+    ta = malloc(sizeof(struct thrarg)*nthreads);
+    if (thr == NULL || ta == NULL) {
+	fprintf(stderr, "Cannot allocate thread memory\n");
+	exit(-1);
+    }
+    for (i = 0; i < nthreads; i++) {
+	snprintf(ta[i].fnm, PATH_MAX, "%s.%d", fnm, i);
+	ta[i].offset = offset;
+	ta[i].bufp = malloc(bufsiz);
+	if (ta[i].bufp == NULL) {
+	    fprintf(stderr, "Cannot allocate buffer memory\n");
+	    exit(-1);
+	}
+	pthread_create(&thr[i], NULL, thr_main, &ta[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+	pthread_join(thr[i], NULL);
+	free(ta[i].bufp);
+    }
+    free(ta);
+    free(thr);
+}
+
 int
 main(int argc, char **argv)
 {
     char	*fnm;
     off64_t	offset;
     double	tot_fsize;
+    int		epoch;
 
     if (dflag) {
 	printf("MAIN STARTS\n");
     }
-    MPI_Init(&argc, &argv);
+    test_parse_args(argc, argv);
+    if (nthreads > 0) {
+	int	provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+	if (provided < MPI_THREAD_MULTIPLE) {
+	    printf("MPI_THREAD_MULTIPLE is not supported, "
+		   "I/O middleware serializes MPI calls\n");
+	}
+    } else {
+	MPI_Init(&argc, &argv);
+    }
     MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
     MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
     VERBOSE {
@@ -156,14 +634,14 @@ main(int argc, char **argv)
 	    printf("nprocs(%d) myrank(%d)\n", nprocs, myrank);
 	}
     }
-    test_parse_args(argc, argv);
 
     fnm = "tdata";
     if (fname[0]) fnm = fname;
-    offset = strsize * myrank;
+    offset = strsize * myrank + (off64_t) skipblk*strsize*nprocs;
     bufsiz = strsize*len;
     bufp = malloc(bufsiz);
-    if (bufp == NULL) {
+    zbufp = calloc(1, strsize);
+    if (bufp == NULL || zbufp == NULL) {
 	fprintf(stderr, "Cannot allocate buffer memory "
 		"(size = %lf MiB, stripe size = %lf KiB, length = %ld)\n",
 		(float)bufsiz/(1024.0*1024.0), (float)strsize/1024.0, len);
@@ -184,15 +662,61 @@ main(int argc, char **argv)
 	       (float)bufsiz/1024.0,
 	       tot_fsize, fnm, tflag, timer_hz, dflag);
     }
-    if (rwflag & DO_WRITE) {
+    if (nthreads > 0) {
+	/* write and read time are measured together */
+	timer_st[0] = tick_time();
+	do_threads(fnm, offset);
+	timer_et[0] = tick_time();
+	tot_fsize *= nthreads;
+	rwflag = DO_WRITE;
+    } else if (appflag) {
+	timer_st[0] = tick_time();
+	do_append(fnm);
+	timer_et[0] = tick_time();
+	rwflag = DO_WRITE;
+    } else if (fppflag) {
+	timer_st[0] = tick_time();
+	do_fpp(fnm);
+	timer_et[0] = tick_time();
+	rwflag = DO_WRITE;
+    } else if (repflag) {
+	timer_st[1] = tick_time();
+	do_read_replicated(fnm, bufp);
+	timer_et[1] = tick_time();
+	rwflag = DO_READ;
+    } else if (iflag) {
+	timer_st[0] = tick_time();
+	do_write_irregular(fnm, bufp);
+	timer_et[0] = tick_time();
+	verify_irregular(fnm);
+	rwflag = DO_WRITE;
+    } else if (rwflag & DO_WRITE) {
 	timer_st[0] = tick_time();
 	do_write(fnm, offset, bufp, bufsiz);
 	timer_et[0] = tick_time();
+	if (statflag) {
+	    do_stat(fnm);
+	}
+	/* rewritten at once with -w, ending with the values of the first */
+	for (epoch = 1; rwflag == DO_WRITE && epoch < nepoch; epoch++) {
+	    fillval = nepoch - 1 - epoch;
+	    do_write(fnm, offset, bufp, bufsiz);
+	}
     }
-    if (rwflag & DO_READ) {
+    if ((rwflag & DO_READ) && !repflag) {
 	timer_st[1] = tick_time();
 	do_read(fnm, offset, bufp, bufsiz);
 	timer_et[1] = tick_time();
+	/* repeated passes, each of which rewrites the file with -W */
+	timer_st[2] = tick_time();
+	for (epoch = 1; epoch < nepoch; epoch++) {
+	    if (rwflag & DO_WRITE) {
+		fillval = epoch;
+		do_write(fnm, offset, bufp, bufsiz);
+	    }
+	    do_read(fnm, offset, bufp, bufsiz);
+	}
+	timer_et[2] = tick_time();
     }
     if (myrank == 0) {
 	double	bw, eltime;
@@ -216,10 +740,18 @@ main(int argc, char **argv)
 		       "\t     BW: %12.9f MiB/sec\n",
 		       (float) eltime, (float) bw);
 	    }
+	    if ((rwflag & DO_READ) && nepoch > 1) {
+		eltime = TIMER_SECOND(timer_et[2] - timer_st[2]);
+		bw = tot_fsize*(nepoch - 1)/eltime;
+		printf("\tRepeated %d times: \n"
+		       "\t   Time: %12.9f second\n"
+		       "\t     BW: %12.9f MiB/sec\n",
+		       nepoch - 1, (float) eltime, (float) bw);
+	    }
 	}
     }
     MPI_Finalize();
-    return 0;
+    return errors ? 1 : 0;
 }
 
 static FILE	*logfp;
@@ -1,5 +1,63 @@
 #include "testlib.h"
 
+/*
+ * Records appended by mytest -A, each of which must be found once
+ */
+static int
+verify_append(char *fnm)
+{
+    unsigned	rec[APPEND_MAXWORDS];
+    char	*seen;
+    FILE	*fp;
+    off64_t	fpos = 0;
+    int		r, i, j, nrec = 0, total = 0, errs = 0;
+
+    for (r = 0; r < strcnt; r++) total += len + r;
+    seen = calloc(strcnt, len + strcnt);
+    if (seen == NULL || (fp = fopen(fnm, "r")) == NULL) {
+	fprintf(stderr, "Cannot open file %s\n", fnm);
+	exit(-1);
+    }
+    while (fread(rec, sizeof(unsigned), 3, fp) == 3) {
+	r = rec[1]; i = rec[2];
+	if (r >= strcnt || i >= len + r || rec[0] != APPEND_WORDS(r, i)
+	    || seen[r*(len + strcnt) + i]) {
+	    fprintf(stderr, "broken record on position(%ld): "
+		    "words(%u) rank(%u) seq(%u)\n", fpos, rec[0], r, i);
+	    errs++;
+	    break;
+	}
+	seen[r*(len + strcnt) + i] = 1;
+	if (fread(rec + 3, sizeof(unsigned), rec[0] - 3, fp) != rec[0] - 3) {
+	    fprintf(stderr, "File truncated in record on position(%ld)\n",
+		    fpos);
+	    errs++;
+	    break;
+	}
+	for (j = 3; j < rec[0]; j++) {
+	    if (rec[j] != r*1000 + i + j) {
+		fprintf(stderr, "data on position(%ld) must be %d, but %d\n",
+			fpos + j*sizeof(unsigned), r*1000 + i + j, rec[j]);
+		errs++;
+		break;
+	    }
+	}
+	fpos += rec[0]*sizeof(unsigned);
+	nrec++;
+    }
+    if (errs == 0 && nrec != total) {
+	fprintf(stderr, "# of records = %d, not %d\n", nrec, total);
+	errs++;
+    }
+    fclose(fp);
+    free(seen);
+    printf("total read size = %ld, # of records = %d\n", fpos, nrec);
+    if (errs == 0) {
+	printf("Success\n");
+    }
+    return errs;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -33,16 +91,31 @@ main(int argc, char **argv)
 
     fnm = "tdata";
     if (fname[0]) fnm = fname;
+    if (appflag) {
+	return verify_append(fnm) ? 1 : 0;
+    }
     if ((fp = fopen(fnm, "r")) == NULL) {
 	fprintf(stderr, "Cannot open file %s\n", fname);
 	exit(-1);
     }
-    fpos = 0;
+    /* the file is sparse before the first block written with -b */
+    fpos = (off64_t) skipblk*strsize*strcnt;
+    if (fseeko(fp, fpos, SEEK_SET) != 0) {
+	fprintf(stderr, "Cannot seek file %s to %ld\n", fnm, fpos);
+	goto err;
+    }
     for(lc = 0; lc < len; lc++) {
 	for (sc = 0; sc < strcnt; sc++) {
-	    sz = fread(data, 1, strsize, fp);
+	    size_t	expect = strsize;
+	    if (tailsize > 0 && lc == len - 1) {
+		/* the last block is cut at tailsize bytes */
+		off64_t	rest = tailsize - (off64_t)sc*strsize;
+		expect = (rest <= 0) ? 0 : (rest < strsize) ? rest : strsize;
+		if (expect == 0) break;
+	    }
+	    sz = fread(data, 1, expect, fp);
 	    tot += sz;
-	    if (sz != strsize) {
+	    if (sz != expect) {
 		fprintf(stderr,
 			"File truncated: sz(%ld), "
 			"must be %ld = len(%ld) strsize(%ld) * count(%d)\n",
@@ -50,17 +123,23 @@ main(int argc, char **argv)
 		goto err;
 	    }
 	    marker = sc;
-	    for (i = 0; i < strsize/sizeof(unsigned int); i++) {
-		if (data[i] != marker + i) {
+	    for (i = 0; i < expect/sizeof(unsigned int); i++) {
+		unsigned int	val = ZERO_STRIPE((skipblk + lc)*strcnt + sc) ?
+		    0 : marker + i;
+		if (data[i] != val) {
 		    fprintf(stderr, "data on position(%ld) must be %d, but %d\n",
-			    fpos + i, marker + i, data[i]);
+			    fpos + i, val, data[i]);
 		    errs++;
 		    if (errs > 20) goto err;
 		}
 	    }
-	    fpos += strsize;
+	    fpos += expect;
 	}
     }
+    if (tailsize > 0 && fgetc(fp) != EOF) {
+	fprintf(stderr, "File is longer than %ld\n", fpos);
+	goto err;
+    }
     printf("total read size = %ld\n", fpos);
     printf("Success\n");
 err:
@@ -5,8 +5,20 @@ off64_t	strsize = DEFAULT_STRSIZE;
 int	strcnt;
 size_t	len = DEFAULT_LENGTH;
 size_t	bufsiz;
-int	nprocs, myrank, dflag, vflag, rwflag, tflag;
+int	nprocs, myrank, dflag, vflag, rwflag, tflag, iflag;
 int	verbose;
+int	deviter = -1, devfew;
+int	nthreads;
+int	syncint;
+int	repflag;
+int	statflag;
+int	fppflag;
+off64_t	tailsize;
+off64_t	skipblk;
+int	zeroint;
+int	naggr, depth, nativeflag;
+int	nepoch = 1;
+int	appflag;
 
 char	fname[1024];
 
@@ -15,12 +27,21 @@ test_parse_args(int argc, char **argv)
 {
     int	opt;
     rwflag = DO_WRITE;
-    while ((opt = getopt(argc, argv, "drtvwVWc:f:l:s:")) != -1) {
+    while ((opt = getopt(argc, argv, "adiArPRtvwVWb:c:e:f:l:s:z:D:E:N:S:T:")) != -1) {
 	switch(opt) {
+	case 'a': /* check file size by fstat and collective stat */
+	    statflag = 1;
+	    break;
 	case 'd': /* debug mode */
 	    setenv("IOMIDDLE_DEBUG", "1", 1);
 	    dflag = 1;
 	    break;
+	case 'i': /* irregular offsets and lengths */
+	    iflag = 1;
+	    break;
+	case 'A': /* records of variable lengths are appended */
+	    appflag = 1;
+	    break;
 	case 'V': /* verbose mode */
 	    verbose = 1;
 	    break;
@@ -33,15 +54,27 @@ test_parse_args(int argc, char **argv)
 	case 'r': /* read, default write */
 	    rwflag = DO_READ;
 	    break;
+	case 'P': /* file per process */
+	    fppflag = 1;
+	    break;
+	case 'R': /* every process reads the whole file */
+	    repflag = 1;
+	    break;
 	case 't': /* truncate or not */
 	    tflag = 1;
 	    break;
 	case 'v': /* verify or not */
 	    vflag = 1;
 	    break;
+	case 'b': /* the first access is after this # of blocks */
+	    skipblk = atoll(optarg);
+	    break;
 	case 'c': /* stripe count == nprocs */
 	    strcnt = atoi(optarg);
 	    break;
+	case 'e': /* the last block ends at this byte, stripes are cut */
+	    tailsize = atoll(optarg);
+	    break;
 	case 'f': /* file name */
 	    strcpy(fname, optarg);
 	    break;
@@ -51,6 +84,31 @@ test_parse_args(int argc, char **argv)
 	case 's': /* stripe size */
 	    strsize = atoi(optarg);
 	    break;
+	case 'z': /* every this # of stripes of the file is all zero */
+	    zeroint = atoi(optarg);
+	    break;
+	case 'D': /* last rank splits its write from this iteration[,1] */
+	    deviter = atoi(optarg);
+	    if (strchr(optarg, ',')) {
+		devfew = atoi(strchr(optarg, ',') + 1);
+	    }
+	    break;
+	case 'E': /* the file is read this # of times, rewritten with -W/-w */
+	    nepoch = atoi(optarg);
+	    break;
+	case 'N': /* iomiddle_open with hints of naggr[,depth] */
+	    nativeflag = 1;
+	    naggr = atoi(optarg);
+	    if (strchr(optarg, ',')) {
+		depth = atoi(strchr(optarg, ',') + 1);
+	    }
+	    break;
+	case 'S': /* fsync every this # of writes */
+	    syncint = atoi(optarg);
+	    break;
+	case 'T': /* # of threads, each of which accesses its own file */
+	    nthreads = atoi(optarg);
+	    break;
 	}
     }
 }
@@ -12,13 +12,31 @@
 #define DO_READ		1
 #define DO_WRITE	2
 #define VERBOSE	if (verbose)
+/* the k-th stripe of the file is all zero with option -z */
+#define ZERO_STRIPE(k)	(zeroint > 0 && (k) % zeroint == 0)
+/* with option -A, rank r appends len + r records, the i-th of which has
+ * APPEND_WORDS(r, i) words: the # of words, r, i, and r*1000 + i + j */
+#define APPEND_WORDS(r, i)	(3 + ((i)*7 + (r)*13) % 61)
+#define APPEND_MAXWORDS	64
 
 extern off64_t	strsize;
 extern int	strcnt;
 extern size_t	len;
 extern size_t	bufsiz;
-extern int	nprocs, myrank, dflag, vflag, rwflag, tflag;
+extern int	nprocs, myrank, dflag, vflag, rwflag, tflag, iflag;
 extern int	verbose;
+extern int	deviter, devfew;
+extern int	nthreads;
+extern int	syncint;
+extern int	repflag;
+extern int	statflag;
+extern int	fppflag;
+extern off64_t	tailsize;
+extern off64_t	skipblk;
+extern int	zeroint;
+extern int	naggr, depth, nativeflag;
+extern int	nepoch;
+extern int	appflag;
 extern char	fname[1024];
 
 extern void test_parse_args(int, char **argc);
@@ -0,0 +1,236 @@
+/*
+ * Replayer of trace files recorded with IOMIDDLE_TRACE
+ *	Each process re-issues the calls recorded in prefix.rank with
+ *	synthetic data, and the elapsed time and bandwidth are reported.
+ *	It runs with or without the IO middleware preloaded, so that
+ *	tuning options may be compared against the recorded pattern.
+ *
+ * Usage:
+ *	$ mpiexec -n N ./iomiddle-replay [-d dir] [-w] [-v] prefix
+ *	-d dir:	files are opened in dir with the recorded base names
+ *	-w:	waiting as long as recorded between calls
+ *	-v:	each call is displayed
+ *	N must be the number of processes recorded.
+ */
+#define _GNU_SOURCE
+#define _LARGEFILE64_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <mpi.h>
+#include "../src/iomiddle.h"
+
+static int	myrank, nprocs;
+static char	*dir;
+static int	wflag, vflag;
+static int	*fdmap;		/* recorded fd -> fd of this replay */
+static int	nfdmap;
+static char	*buf;
+static size_t	bufsize;
+
+static uint64_t
+now_nsec(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static int *
+fd_slot(int fd)
+{
+    if (fd >= nfdmap) {
+	int	n = (fd + 1)*2, i;
+	fdmap = realloc(fdmap, sizeof(int)*n);
+	if (fdmap == NULL) {
+	    fprintf(stderr, "Cannot allocate memory\n");
+	    MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	for (i = nfdmap; i < n; i++) fdmap[i] = -1;
+	nfdmap = n;
+    }
+    return &fdmap[fd];
+}
+
+/*
+ * The buffer of synthetic data is extended to the largest size
+ */
+static void
+buf_extend(size_t len)
+{
+    size_t	i;
+
+    if (len <= bufsize) return;
+    buf = realloc(buf, len);
+    if (buf == NULL) {
+	fprintf(stderr, "Cannot allocate buffer memory. size = %ld\n",
+		(long) len);
+	MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+    for (i = bufsize; i < len; i++) {
+	buf[i] = (char) (i + myrank);
+    }
+    bufsize = len;
+}
+
+static int
+replay(FILE *fp, double *elapsed, long long *bytes)
+{
+    struct iomiddle_trace	tr;
+    char	rpath[PATH_MAX], path[PATH_MAX + 1];
+    uint64_t	t0;
+    int		errs = 0;
+    ssize_t	cc;
+    int		*fdp;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = now_nsec();
+    while (fread(&tr, sizeof(tr), 1, fp) == 1) {
+	if (wflag) {
+	    while (now_nsec() - t0 < tr.nsec) {
+		struct timespec	ts = { 0, 10000 };
+		nanosleep(&ts, NULL);
+	    }
+	}
+	if (vflag) {
+	    printf("[%d] op(%d) fd(%d) off(%lld) len(%lld) whence(%d)\n",
+		   myrank, tr.op, tr.fd, (long long) tr.off,
+		   (long long) tr.len, tr.whence);
+	}
+	fdp = fd_slot(tr.fd);
+	switch (tr.op) {
+	case IOMIDDLE_TR_OPEN:
+	    if (tr.len >= PATH_MAX
+		|| fread(rpath, 1, tr.len, fp) != tr.len) {
+		fprintf(stderr, "[%d] broken trace file\n", myrank);
+		return -1;
+	    }
+	    rpath[tr.len] = 0;
+	    if (dir) {
+		char	*bp = strrchr(rpath, '/');
+		snprintf(path, sizeof(path), "%s/%s", dir, bp ? bp + 1 : rpath);
+	    } else {
+		strcpy(path, rpath);
+	    }
+	    *fdp = open(path, (int) tr.off, 0644);
+	    if (*fdp < 0) {
+		fprintf(stderr, "[%d] Cannot open file %s\n", myrank, path);
+		errs++;
+	    }
+	    break;
+	case IOMIDDLE_TR_CLOSE:
+	    close(*fdp);
+	    *fdp = -1;
+	    break;
+	case IOMIDDLE_TR_WRITE:
+	    buf_extend(tr.len);
+	    cc = write(*fdp, buf, tr.len);
+	    if (cc != tr.len) {
+		fprintf(stderr, "[%d] write size = %ld, not %lld\n",
+			myrank, (long) cc, (long long) tr.len);
+		errs++;
+	    }
+	    if (cc > 0) *bytes += cc;
+	    break;
+	case IOMIDDLE_TR_READ:
+	    buf_extend(tr.len);
+	    cc = read(*fdp, buf, tr.len);
+	    if (cc < 0) {
+		fprintf(stderr, "[%d] read error %d\n", myrank, errno);
+		errs++;
+	    }
+	    if (cc > 0) *bytes += cc;
+	    break;
+	case IOMIDDLE_TR_LSEEK:
+	    if (lseek64(*fdp, tr.off, tr.whence) < 0) {
+		fprintf(stderr, "[%d] lseek error %d\n", myrank, errno);
+		errs++;
+	    }
+	    break;
+	case IOMIDDLE_TR_FSYNC:
+	    if ((tr.whence ? fdatasync(*fdp) : fsync(*fdp)) < 0) {
+		fprintf(stderr, "[%d] fsync error %d\n", myrank, errno);
+		errs++;
+	    }
+	    break;
+	default:
+	    fprintf(stderr, "[%d] unknown record %d\n", myrank, tr.op);
+	    return -1;
+	}
+    }
+    *elapsed = (now_nsec() - t0)/1e9;
+    return errs;
+}
+
+int
+main(int argc, char **argv)
+{
+    char	path[PATH_MAX];
+    struct iomiddle_trace_hdr	hdr;
+    FILE	*fp;
+    int		opt, errs = 0, gerrs;
+    double	elapsed = 0, maxel;
+    long long	bytes = 0, tot;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+    while ((opt = getopt(argc, argv, "d:vw")) != -1) {
+	switch (opt) {
+	case 'd': /* directory of files */
+	    dir = optarg;
+	    break;
+	case 'v': /* verbose */
+	    vflag = 1;
+	    break;
+	case 'w': /* keeping the recorded intervals */
+	    wflag = 1;
+	    break;
+	}
+    }
+    if (optind >= argc) {
+	if (myrank == 0) {
+	    fprintf(stderr, "usage: %s [-d dir] [-w] [-v] prefix\n", argv[0]);
+	}
+	MPI_Finalize();
+	return 1;
+    }
+    snprintf(path, PATH_MAX, "%s.%d", argv[optind], myrank);
+    if ((fp = fopen(path, "r")) == NULL
+	|| fread(&hdr, sizeof(hdr), 1, fp) != 1
+	|| memcmp(hdr.magic, IOMIDDLE_TRACE_MAGIC,
+		  sizeof(IOMIDDLE_TRACE_MAGIC)) != 0) {
+	fprintf(stderr, "[%d] Cannot read trace file %s\n", myrank, path);
+	MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+    if (hdr.nprocs != nprocs) {
+	fprintf(stderr, "[%d] %s is recorded by %d processes, not %d\n",
+		myrank, path, hdr.nprocs, nprocs);
+	MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+    errs = replay(fp, &elapsed, &bytes);
+    fclose(fp);
+    MPI_Reduce(&elapsed, &maxel, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&bytes, &tot, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Allreduce(&errs, &gerrs, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (myrank == 0) {
+	if (gerrs) {
+	    printf("\nERROR:  # of errors %d\n", gerrs);
+	} else {
+	    printf("SUCCESS\n");
+	}
+	printf("\t   Size: %lld bytes\n"
+	       "\t   Time: %12.9f second\n"
+	       "\t     BW: %12.9f MiB/sec\n",
+	       tot, maxel, maxel > 0 ? tot/maxel/(1024.0*1024.0) : 0.0);
+    }
+    MPI_Finalize();
+    return gerrs ? 1 : 0;
+}
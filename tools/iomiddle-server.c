@@ -0,0 +1,33 @@
+/*
+ * I/O server spawned by the IO middleware with IOMIDDLE_SERVERS
+ *	Stripes of the processes of its group are received and written
+ *	in blocks, see io_middle.c.  It must run with io_middle.so
+ *	preloaded, which is inherited from the environment of the job.
+ *
+ * Usage:
+ *	$ export IOMIDDLE_SERVERS=N
+ *	$ export IOMIDDLE_SERVER_PATH=/path/to/iomiddle-server
+ *	It is not run by hand.
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <mpi.h>
+#include "../src/iomiddle.h"
+
+int
+main(int argc, char **argv)
+{
+    int		rc = 0;
+
+    MPI_Init(&argc, &argv);
+    if (iomiddle_server == NULL) {
+	fprintf(stderr, "%s: io_middle.so is not preloaded\n", argv[0]);
+	rc = 1;
+    } else if (iomiddle_server() < 0) {
+	fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+	rc = 1;
+    }
+    MPI_Finalize();
+    return rc;
+}
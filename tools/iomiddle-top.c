@@ -0,0 +1,190 @@
+/*
+ * Monitor of counters published with IOMIDDLE_MONITOR
+ *	The shared memory segment of the node is read every interval, and
+ *	rates of the counters are displayed per process and in total.
+ *	It does not take part in the job, and only reads the segment.
+ *
+ * Usage:
+ *	$ ./iomiddle-top [-i sec] [-n count] name
+ *	-i sec:	  interval of updates, 1 second by default
+ *	-n count: exit after this number of updates, 0 (forever) by default
+ *	name is the value of IOMIDDLE_MONITOR.  It exits when the job
+ *	removes the segment.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../src/iomiddle.h"
+
+#define MiB	(1024.0*1024.0)
+
+static uint64_t
+now_nsec(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static struct iomiddle_mon_hdr *
+mon_attach(const char *name, size_t *szp)
+{
+    char	path[NAME_MAX];
+    struct iomiddle_mon_hdr	*hdr;
+    struct stat	sb;
+    int		fd;
+
+    snprintf(path, NAME_MAX, "/%s", name);
+    if ((fd = shm_open(path, O_RDONLY, 0)) < 0) {
+	return NULL;
+    }
+    if (fstat(fd, &sb) < 0 || sb.st_size < sizeof(*hdr)) {
+	close(fd);
+	return NULL;
+    }
+    hdr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+	return NULL;
+    }
+    if (memcmp(hdr->magic, IOMIDDLE_MON_MAGIC, sizeof(IOMIDDLE_MON_MAGIC))
+	|| hdr->recsize != sizeof(struct iomiddle_mon)
+	|| sizeof(*hdr) + (size_t) hdr->nlocal*hdr->recsize > sb.st_size) {
+	munmap(hdr, sb.st_size);
+	return NULL;
+    }
+    *szp = sb.st_size;
+    return hdr;
+}
+
+/*
+ * A record is copied field by field, which may be updated meanwhile
+ */
+static void
+mon_copy(struct iomiddle_mon *dst, struct iomiddle_mon *src)
+{
+    dst->rank = src->rank;
+    dst->pid = src->pid;
+    dst->staged = __atomic_load_n(&src->staged, __ATOMIC_RELAXED);
+    dst->written = __atomic_load_n(&src->written, __ATOMIC_RELAXED);
+    dst->read = __atomic_load_n(&src->read, __ATOMIC_RELAXED);
+    dst->flushes = __atomic_load_n(&src->flushes, __ATOMIC_RELAXED);
+    dst->inflush = __atomic_load_n(&src->inflush, __ATOMIC_RELAXED);
+    dst->qdepth = __atomic_load_n(&src->qdepth, __ATOMIC_RELAXED);
+    dst->xchg_nsec = __atomic_load_n(&src->xchg_nsec, __ATOMIC_RELAXED);
+    dst->write_nsec = __atomic_load_n(&src->write_nsec, __ATOMIC_RELAXED);
+}
+
+static void
+mon_row(const char *label, struct iomiddle_mon *cur, struct iomiddle_mon *old,
+	double sec, int n)
+{
+    char	pid[16] = "-";
+
+    if (cur->pid) snprintf(pid, sizeof(pid), "%d", cur->pid);
+    printf("%6s %8s %10.1f %10.1f %10.1f %8llu %4d %5d %6.1f %6.1f\n",
+	   label, pid,
+	   (cur->staged - old->staged)/MiB/sec,
+	   (cur->written - old->written)/MiB/sec,
+	   (cur->read - old->read)/MiB/sec,
+	   (unsigned long long) cur->flushes, cur->inflush, cur->qdepth,
+	   (cur->xchg_nsec - old->xchg_nsec)/1e7/sec/n,
+	   (cur->write_nsec - old->write_nsec)/1e7/sec/n);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct iomiddle_mon_hdr	*hdr;
+    struct iomiddle_mon	*recs, *cur, *old, tcur, told;
+    double	interval = 1.0, sec;
+    int		opt, count = 0, iter, i, n, tty = isatty(1);
+    size_t	sz;
+    uint64_t	t0, t1;
+    char	label[16];
+
+    while ((opt = getopt(argc, argv, "i:n:")) != -1) {
+	switch (opt) {
+	case 'i': /* interval in seconds */
+	    interval = atof(optarg);
+	    break;
+	case 'n': /* # of updates */
+	    count = atoi(optarg);
+	    break;
+	}
+    }
+    if (optind >= argc || interval <= 0) {
+	fprintf(stderr, "usage: %s [-i sec] [-n count] name\n", argv[0]);
+	return 1;
+    }
+    if ((hdr = mon_attach(argv[optind], &sz)) == NULL) {
+	fprintf(stderr, "Cannot attach the shared memory %s\n", argv[optind]);
+	return 1;
+    }
+    n = hdr->nlocal;
+    recs = (struct iomiddle_mon*) (hdr + 1);
+    cur = malloc(sizeof(struct iomiddle_mon)*n*2);
+    if (cur == NULL) {
+	fprintf(stderr, "Cannot allocate memory\n");
+	return 1;
+    }
+    old = cur + n;
+    for (i = 0; i < n; i++) mon_copy(&old[i], &recs[i]);
+    t0 = now_nsec();
+    for (iter = 0; count == 0 || iter < count; iter++) {
+	struct timespec	ts;
+	char		path[NAME_MAX];
+	int		fd;
+
+	ts.tv_sec = (time_t) interval;
+	ts.tv_nsec = (long) ((interval - ts.tv_sec)*1e9);
+	nanosleep(&ts, NULL);
+	snprintf(path, NAME_MAX, "/%s", argv[optind]);
+	if ((fd = shm_open(path, O_RDONLY, 0)) < 0) {
+	    /* the job has finished */
+	    break;
+	}
+	close(fd);
+	t1 = now_nsec();
+	sec = (t1 - t0)/1e9;
+	t0 = t1;
+	for (i = 0; i < n; i++) mon_copy(&cur[i], &recs[i]);
+	if (tty) printf("\033[H\033[2J");
+	printf("%s: %d of %d processes, every %.1f sec\n",
+	       argv[optind], n, hdr->nprocs, interval);
+	printf("%6s %8s %10s %10s %10s %8s %4s %5s %6s %6s\n",
+	       "rank", "pid", "stage MB/s", "write MB/s", "read MB/s",
+	       "flushes", "busy", "queue", "xchg%", "write%");
+	memset(&tcur, 0, sizeof(tcur));
+	memset(&told, 0, sizeof(told));
+	for (i = 0; i < n; i++) {
+	    snprintf(label, sizeof(label), "%d", cur[i].rank);
+	    mon_row(label, &cur[i], &old[i], sec, 1);
+	    tcur.staged += cur[i].staged;   told.staged += old[i].staged;
+	    tcur.written += cur[i].written; told.written += old[i].written;
+	    tcur.read += cur[i].read;	    told.read += old[i].read;
+	    tcur.flushes += cur[i].flushes;
+	    tcur.inflush += cur[i].inflush;
+	    tcur.qdepth += cur[i].qdepth;
+	    tcur.xchg_nsec += cur[i].xchg_nsec;
+	    told.xchg_nsec += old[i].xchg_nsec;
+	    tcur.write_nsec += cur[i].write_nsec;
+	    told.write_nsec += old[i].write_nsec;
+	}
+	/* times of the node are averaged over processes */
+	mon_row("node", &tcur, &told, sec, n);
+	fflush(stdout);
+	memcpy(old, cur, sizeof(struct iomiddle_mon)*n);
+    }
+    munmap(hdr, sz);
+    free(cur);
+    return 0;
+}